@@ -0,0 +1,12 @@
+#!/bin/sh
+# Builds and runs the benchmarks in cmp_bmfont_bench.cpp. Arguments are passed to the benchmark,
+# e.g. ./bench.sh 65000 120000 to run a single font with that many chars and kernings.
+
+set -e
+
+CXX=${CXX:-c++}
+CXXFLAGS=${CXXFLAGS:-"-O2 -DNDEBUG -std=c++14 -Wall -Wextra"}
+
+mkdir -p build
+$CXX $CXXFLAGS -I . cmp_bmfont_bench.cpp -o build/cmp_bmfont_bench -lpthread
+build/cmp_bmfont_bench "$@"
@@ -1,4 +1,4 @@
-/* cmp_bmfont - v0.2 - public domain BM Font loader
+/* cmp_bmfont - v0.26 - public domain BM Font loader
    no warranty implied; use at your own risk
 
 This is a single file library, in the spirit of (https://github.com/nothings/stb), including a
@@ -12,7 +12,7 @@ files, use the following:
 
 API:
 
-To load a BMFont file (in text form), use something like the following:
+To load a BMFont file (in text or binary form), use something like the following:
 
     cmp::BMFont *font = cmp::bmfont_parse_file("path_to_your_file");
     if (!font) {
@@ -24,8 +24,197 @@ To load a BMFont file (in text form), use something like the following:
 
     cmp::bmfont_free(font);
 
+A loaded font lives in a single block of memory. To use your own allocator everywhere, define both
+CMP_BMFONT_MALLOC(size, user) and CMP_BMFONT_FREE(ptr, user) before including the implementation.
+To place individual fonts in a specific arena, pass a cmp::BMFontAllocator to the load function:
+
+    cmp::BMFontAllocator allocator = {arena_alloc, arena_free, &level_arena};
+    cmp::BMFont *font = cmp::bmfont_parse_file("path_to_your_file", &allocator);
+
+Fonts that are already in memory (e.g. in a packed asset archive) can be loaded without touching
+the file system:
+
+    cmp::BMFont *font = cmp::bmfont_parse_memory(data, size);
+
+To look up the glyph for a codepoint (nullptr if the font doesn't have one):
+
+    const cmp::BMFont::Char *ch = cmp::bmfont_find_char(font, codepoint);
+
+And the kerning to apply between two codepoints (0 if there is none):
+
+    int16_t amount = cmp::bmfont_get_kerning(font, previous_codepoint, codepoint);
+
+To lay out a UTF-8 string into a caller provided vertex buffer (interleaved x, y, u, v here):
+
+    float vertices[MAX_QUADS * 4 * 4];
+    cmp::BMFontQuadBuffer quads = {};
+    quads.positions = &vertices[0];
+    quads.uvs = &vertices[2];
+    quads.position_stride = quads.uv_stride = 4 * sizeof(float);
+    quads.capacity = MAX_QUADS;
+    cmp::bmfont_layout(font, text, strlen(text), pen_x, pen_y, &quads);
+    // Upload quads.count * 4 vertices
+
+Fonts with several pages can have their quads grouped by page, for one draw call per page:
+
+    cmp::BMFontPageRange pages[MAX_PAGES]; // At least font->num_pages
+    cmp::bmfont_layout_paged(font, text, strlen(text), pen_x, pen_y, &quads, pages);
+    // Draw quads [pages[i].first, pages[i].first + pages[i].count) with page texture i
+
+Packed fonts (font->packed) keep a separate glyph set in each channel of their pages. Give the quad
+buffer a channel mask per vertex, and have the shader take dot(texel, mask) as the coverage:
+
+    uint8_t masks[MAX_QUADS * 4 * 4];
+    quads.channels = masks;
+
+To skip parsing at startup, a loaded font can be written once to a relocatable blob and then mapped
+directly on later runs:
+
+    cmp::bmfont_write_blob_file(font, "font.bmfb");       // e.g. in an asset build step
+    cmp::BMFont *font = cmp::bmfont_load_blob_file("font.bmfb");
+
+bmfont_get_error_string() is shared by every thread. To load fonts from several threads at once,
+use the reentrant _r functions, which report errors through a caller owned result instead:
+
+    cmp::BMFontResult result;
+    if (!cmp::bmfont_parse_file_r("path_to_your_file", &result)) {
+        fprintf(stderr, "%s (line %d, col %d)", result.error, result.line, result.col);
+    }
+    cmp::BMFont *font = result.font;
+
+To load many fonts at startup, hand them all to bmfont_parse_batch(), which spreads them over a
+pool of worker threads:
+
+    cmp::BMFontSource sources[] = {{"ui.fnt"}, {"title.fnt"}, {nullptr, data, size}};
+    cmp::BMFontResult results[3];
+    cmp::bmfont_parse_batch(sources, 3, results);    // results[i].font is nullptr on error
+
+Fixed fonts, e.g. for debug text, can be parsed at compile time instead (C++14 or later). The
+tables are laid out in the object itself, so there is no startup cost and no allocation:
+
+    static constexpr char debug_fnt[] = {
+    #embed "debug.fnt"
+    };    // or a string literal
+    static constexpr CMP_BMFONT_EMBEDDED_TYPE(debug_fnt) debug_font(debug_fnt, sizeof(debug_fnt));
+    const cmp::BMFont *font = &debug_font.font;
+
+Fonts that arrive in pieces, e.g. from a decompressor, can be parsed as the data comes in:
+
+    cmp::BMFontStreamParser *parser = cmp::bmfont_parser_create();
+    while (size_t len = read_chunk(archive, buffer, sizeof(buffer))) {
+        if (!cmp::bmfont_parser_feed(parser, buffer, len)) break;
+    }
+    cmp::BMFontResult result;
+    cmp::bmfont_parser_finish(parser, &result);    // Also frees the parser
+
+Large text fonts, e.g. CJK fonts, load in about half the time when loaded lazily. Each char and
+kerning is then decoded on its first lookup. This saves time, not memory: the file stays mapped
+until the font is freed, and the font keeps each record's offset besides the records themselves,
+so a lazy font takes more memory than the same font loaded eagerly:
+
+    cmp::BMFont *font = cmp::bmfont_parse_file_lazy("cjk.fnt");
+
+On Linux, tools can pick up fonts as they are re-exported. A watcher thread reloads changed files
+and swaps them in; render threads bracket their use of the fonts instead of taking locks:
+
+    cmp::BMFontWatcher *watcher = cmp::bmfont_watcher_create(1);
+    cmp::BMFontLive *live = cmp::bmfont_watcher_add(watcher, "ui.fnt", &result);
+    int reader = cmp::bmfont_watcher_add_reader(watcher);    // Once per render thread
+
+    cmp::bmfont_watcher_read_begin(watcher, reader);         // Each frame
+    const cmp::BMFont *font = cmp::bmfont_live_font(live);
+    // Draw with font
+    cmp::bmfont_watcher_read_end(watcher, reader);
+
+Labels that are drawn every frame can be replayed from a cache of finished layouts instead. The
+cache is bounded by a memory budget and evicts the least recently used strings first:
+
+    cmp::BMFontLayoutCache *cache = cmp::bmfont_layout_cache_create(1024 * 1024);
+    cmp::bmfont_layout_cached(cache, font, label, strlen(label), x, y, &quads);
+    cmp::bmfont_layout_cache_evict_font(cache, font);    // Frees its entries early
+
+Paragraphs are wrapped to a width with a BMFontWrap. Text editors and chat logs tell it about each
+edit, and only the lines around the edit are wrapped again:
+
+    cmp::BMFontWrap *wrap = cmp::bmfont_wrap_create(font);
+    cmp::bmfont_wrap_text(wrap, text, len, 400.0f);
+    // Insert one character at offset into text
+    cmp::bmfont_wrap_edit(wrap, text, len + 1, offset, 0, 1);
+    cmp::bmfont_layout_wrapped(wrap, text, first_visible, visible_lines, x, y, &quads);
+
+Custom layouts can iterate over the glyphs of a string in batches. ASCII runs are decoded 16
+bytes at a time and looked up through the dense index:
+
+    uint32_t codepoints[64];
+    const cmp::BMFont::Char *chars[64];
+    size_t consumed;
+    while (len) {
+        size_t count = cmp::bmfont_find_glyphs(font, text, len, codepoints, chars, 64, &consumed);
+        // chars[i] is the glyph for codepoints[i], or nullptr
+        text += consumed;
+        len -= consumed;
+    }
+
+Measuring and line breaking only need the advances of glyphs. A BMFontMetrics table keeps them,
+and the offsets, in packed arrays apart from the atlas coordinates:
+
+    cmp::BMFontMetrics *metrics = cmp::bmfont_metrics_create(font);
+    float width = cmp::bmfont_measure(metrics, text, len);
+    cmp::bmfont_wrap_use_metrics(wrap, metrics);
+    cmp::bmfont_metrics_destroy(metrics);    // Before freeing or reloading font
+
+Text that mixes scripts can draw from several fonts. A BMFontChain indexes all of them once, and
+each codepoint then takes a single lookup to find the first font that has it:
+
+    const cmp::BMFont *fonts[] = {latin, cjk, symbols};
+    cmp::BMFontChain *chain = cmp::bmfont_chain_create(fonts, 3);
+    const cmp::BMFont *owner;
+    const cmp::BMFont::Char *ch = cmp::bmfont_chain_find_char(chain, codepoint, &owner);
+    cmp::bmfont_chain_destroy(chain);    // Before freeing or reloading any of the fonts
+
+Shipped fonts can be cut down to the glyphs that are used, e.g. per locale in an asset build step.
+The subset keeps the kerning pairs between its glyphs and can be written back out as a .fnt file:
+
+    cmp::BMFont *subset = cmp::bmfont_subset(font, codepoints, num_codepoints);
+    cmp::bmfont_write_fnt_file(subset, "ui_ja.fnt", cmp::BMFONT_FORMAT_BINARY);
+
+To see where load time and memory go, define CMP_BMFONT_STATS for every file that includes this
+header. Each load is then reported to a hook, and lookups are counted:
+
+    void trace_load(const char *filename, const cmp::BMFontResult *result,
+                    const cmp::BMFontLoadStats *stats, void *user) {
+        // stats->phase_ns[cmp::BMFONT_PHASE_CHARS], stats->allocated_bytes, ...
+    }
+    cmp::bmfont_set_load_hook(trace_load, nullptr);
+    cmp::BMFontLookupStats lookups;
+    cmp::bmfont_get_lookup_stats(&lookups);
+
 CHANGELOG
 
+    v0.26 10/16/2026 - Add bmfont_subset; bmfont_write_fnt writes fonts as text or binary .fnt files
+    v0.25 10/16/2026 - Parse packed / channel settings; optional per-vertex channel masks in layouts
+    v0.24 10/16/2026 - Parse page / chnl of text chars; add bmfont_layout_paged for per-page batches
+    v0.23 10/16/2026 - Add BMFontMetrics, packed glyph metrics for measuring and line breaking
+    v0.22 10/16/2026 - Add BMFontChain, fallback fonts with one merged glyph index
+    v0.21 10/16/2026 - Add load and lookup instrumentation, compiled in with CMP_BMFONT_STATS
+    v0.20 10/16/2026 - Add bmfont_decode_utf8 / bmfont_find_glyphs with an SSE2 path for ASCII runs
+    v0.19 10/16/2026 - Add BMFontWrap for word wrapping, with incremental rewrapping after edits
+    v0.18 10/16/2026 - Add BMFontLayoutCache, an LRU cache of layouts for frequently drawn strings
+    v0.17 10/16/2026 - Add BMFontWatcher for hot reloading fonts when their files change (Linux)
+    v0.16 10/16/2026 - Faster text parsing: SSE2 delimiter scan and a fast path for record lines
+    v0.15 10/16/2026 - Add lazy loading, which decodes each char and kerning on first lookup
+    v0.14 10/16/2026 - Add bmfont_parser_feed / bmfont_parser_finish for parsing streamed input
+    v0.13 10/16/2026 - Page, char and kerning counts are now 32 bits; fix truncated ids above U+FFFF
+    v0.12 10/16/2026 - Add BMFontEmbedded for parsing fonts at compile time; lookups are constexpr
+    v0.11 10/16/2026 - Add bmfont_parse_batch for loading fonts on a worker pool; bmfont_free(nullptr)
+    v0.10 10/16/2026 - Add reentrant _r load functions that report errors through BMFontResult
+    v0.9 10/16/2026 - Load each font into a single block; add allocator hooks; fix kerning leak
+    v0.8 10/16/2026 - Add relocatable blob writer and loader
+    v0.7 10/16/2026 - Add bmfont_layout for emitting batched textured quads
+    v0.6 10/16/2026 - Add bmfont_get_kerning backed by a pair hash table built at load time
+    v0.5 10/16/2026 - Add bmfont_find_char backed by a lookup index built at load time
+    v0.4 10/16/2026 - Add loader for the binary (version 3) format; Char offsets are now signed
+    v0.3 10/16/2026 - Add bmfont_parse_memory; parse files through a memory map instead of stdio
     v0.2 11/20/2016 - Remove use of C++ limits header
     v0.1 11/19/2016 - Initial revision
 
@@ -39,10 +228,37 @@ publish, and distribute this file as you see fit.
 #ifndef CMP_BMFONT_INCLUDE
 #define CMP_BMFONT_INCLUDE
 
+#include <stddef.h>
 #include <stdint.h>
 
+// Compile time font embedding (BMFontEmbedded below) needs C++14 constexpr.
+#if __cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+#define CMP_BMFONT_HAS_EMBED
+#define CMP_BMFONT__CONSTEXPR14 constexpr
+#else
+#define CMP_BMFONT__CONSTEXPR14 inline
+#endif
+
 namespace cmp {
 
+// Codepoints below this value are looked up through a direct-mapped table; everything else goes
+// through a hash table.
+const uint32_t BMFONT_DENSE_CHAR_COUNT = 256;
+
+// Largest number of pages, chars or kernings a font may have. This keeps the size of every table
+// within 32 bits.
+const uint32_t BMFONT_MAX_COUNT = 0x07FFFFFF;
+
+// Custom allocator for fonts. A font and everything it references live in a single block, so alloc
+// is called once per load and free once per bmfont_free(). When no allocator is given the
+// CMP_BMFONT_MALLOC / CMP_BMFONT_FREE macros are used, which default to malloc / free and can be
+// overridden before including the implementation.
+struct BMFontAllocator {
+    void *(*alloc)(size_t size, void *user);
+    void (*free)(void *ptr, void *user);
+    void *user;
+};
+
 struct BMFont {
     struct Char {
         uint32_t id;
@@ -50,8 +266,8 @@ struct BMFont {
         uint16_t y;
         uint16_t width;
         uint16_t height;
-        uint16_t x_offset;
-        uint16_t y_offset;
+        int16_t  x_offset;
+        int16_t  y_offset;
         uint16_t x_advance;
         uint8_t  page;
         uint8_t  channel;
@@ -69,28 +285,1039 @@ struct BMFont {
     Char *    chars;
     Kerning * kernings;
 
+    // Codepoint lookup tables built at load time. Entries hold an index into chars plus one, zero
+    // meaning "not present". Use bmfont_find_char() rather than reading these directly.
+    uint32_t *char_dense_index; // BMFONT_DENSE_CHAR_COUNT entries
+    uint32_t *char_hash_index;  // char_hash_mask + 1 entries, or nullptr if there are no chars
+
+    // Kerning pair hash table built at load time, holding an index into kernings plus one. Use
+    // bmfont_get_kerning() rather than reading this directly.
+    uint32_t *kerning_hash_index; // kerning_hash_mask + 1 entries, or nullptr if no kernings
+
+    // Internal bookkeeping for bmfont_free(); not for use by callers.
+    const void *    _mapping;
+    size_t          _mapping_size;
+    BMFontAllocator _allocator;
+
+    // Lazily loaded fonts only: the text records are decoded from, and for each char and kerning
+    // the offset of its line in that text, or 0 once it has been decoded.
+    const char *_source;
+    size_t      _source_size;
+    uint32_t *  _char_offsets;
+    uint32_t *  _kerning_offsets;
+
     int16_t  font_size;
     uint16_t line_height;
     uint16_t base;
     uint16_t scale_w;
     uint16_t scale_h;
-    uint16_t num_pages;
-    uint16_t num_chars;
-    uint16_t num_kernings;
 
+    // What each channel of the pages holds: 0 the glyph, 1 the outline, 2 the glyph and the
+    // outline, 3 zero or 4 one. packed is 1 if each glyph is only in the channels in its
+    // Char::channel, so that one texture holds four single channel glyph sets.
     uint8_t  alpha_channel;
     uint8_t  red_channel;
     uint8_t  green_channel;
     uint8_t  blue_channel;
-    uint8_t  _padding[4];
+    uint8_t  packed;
+    uint8_t  _padding[1];
+
+    uint32_t num_pages;
+    uint32_t num_chars;
+    uint32_t num_kernings;
+    uint32_t char_hash_mask;
+    uint32_t kerning_hash_mask;
+    uint32_t _flags;
+
+    // Unique to each font loaded at run time, so that a font can be told apart from a freed one
+    // at the same address. 0 for embedded fonts, which are never freed.
+    uint64_t _id;
 };
 
 // Loads a BMFont from the specified file or returns nullptr if there is an error. Use
-// bmfont_get_error_string() to get the error.
-BMFont *bmfont_parse_file(const char *filename);
+// bmfont_get_error_string() to get the error. The file is memory mapped where the platform allows.
+// Both the text and the binary (version 3) formats are supported; the format is detected from the
+// file header. The font is allocated as a single block from allocator, or with CMP_BMFONT_MALLOC if
+// allocator is nullptr.
+BMFont *bmfont_parse_file(const char *filename, const BMFontAllocator *allocator = nullptr);
+
+// Loads a BMFont from a buffer that is already in memory. The buffer does not need to be NUL
+// terminated and is not referenced after this call returns.
+BMFont *bmfont_parse_memory(const char *           data,
+                            size_t                 size,
+                            const BMFontAllocator *allocator = nullptr);
+
+// Frees a font returned by any of the load functions, using the allocator it was loaded with. Does
+// nothing if font is nullptr.
 void  bmfont_free(BMFont *font);
+
+// Returns the error from the last load or write that didn't take a BMFontResult. Shared by all
+// threads; use the _r functions below when loading concurrently.
 const char *bmfont_get_error_string();
 
+// Outcome of one of the reentrant (_r) load functions. These functions share no mutable state, so
+// any number of them can run concurrently as long as each call has its own result.
+struct BMFontResult {
+    BMFont *font;       // The loaded font, or nullptr on error
+    int     line;       // Position of the error in a text file, or 0 if it has none
+    int     col;
+    char    error[512]; // "Success" or a description of the error
+};
+
+// Reentrant versions of the load functions. Each returns true and sets result->font on success, or
+// returns false and fills in the error fields of result.
+bool bmfont_parse_file_r(const char *filename,
+                         BMFontResult *result,
+                         const BMFontAllocator *allocator = nullptr);
+bool bmfont_parse_memory_r(const char *data,
+                           size_t size,
+                           BMFontResult *result,
+                           const BMFontAllocator *allocator = nullptr);
+bool bmfont_load_blob_r(const void *data,
+                        size_t size,
+                        BMFontResult *result,
+                        const BMFontAllocator *allocator = nullptr);
+bool bmfont_load_blob_file_r(const char *filename,
+                             BMFontResult *result,
+                             const BMFontAllocator *allocator = nullptr);
+
+// Incremental loader for fonts that arrive in chunks, e.g. from a decompressor or a network stream.
+// Text fonts are parsed line by line as the data is fed; the chunks can be split anywhere and are
+// not referenced after bmfont_parser_feed() returns. Text fonts are laid out in their final block
+// once the kernings count arrives, so memory use peaks at the size of the loaded font plus a copy
+// of its chars. Binary fonts are collected and parsed when the input ends.
+struct BMFontStreamParser;
+
+BMFontStreamParser *bmfont_parser_create(const BMFontAllocator *allocator = nullptr);
+
+// Returns false once the input is known to be invalid. Later chunks are then ignored, and the
+// error is reported by bmfont_parser_finish().
+bool bmfont_parser_feed(BMFontStreamParser *parser, const void *chunk, size_t len);
+
+// Ends the input and frees the parser. Reports the outcome like the _r load functions.
+bool bmfont_parser_finish(BMFontStreamParser *parser, BMFontResult *result);
+
+// Lazy versions of the load functions, for large fonts that must load quickly. A text font is
+// checked and indexed by codepoint at load, but each char and kerning is only fully decoded the
+// first time it is looked up. The font is still sized for all of its records and also keeps the
+// offset of each, so it takes more memory than an eager load. A char or kerning whose line turns
+// out to be malformed is treated as missing. The font keeps referencing its source text: the file
+// stays mapped until bmfont_free(), and the data passed to bmfont_parse_memory_lazy() must outlive
+// the font. Lookups on a lazy font write to it, so they must not run concurrently with each other.
+// Writing or subsetting a lazy font doesn't write to it; the source is parsed again instead.
+// Binary fonts are loaded as usual.
+BMFont *bmfont_parse_file_lazy(const char *filename, const BMFontAllocator *allocator = nullptr);
+BMFont *bmfont_parse_memory_lazy(const char *           data,
+                                 size_t                 size,
+                                 const BMFontAllocator *allocator = nullptr);
+bool bmfont_parse_file_lazy_r(const char *filename,
+                              BMFontResult *result,
+                              const BMFontAllocator *allocator = nullptr);
+bool bmfont_parse_memory_lazy_r(const char *data,
+                                size_t size,
+                                BMFontResult *result,
+                                const BMFontAllocator *allocator = nullptr);
+
+// Phases of a load, as indices into BMFontLoadStats::phase_ns. For binary fonts each phase is the
+// corresponding block.
+const uint32_t BMFONT_PHASE_INFO     = 0;
+const uint32_t BMFONT_PHASE_COMMON   = 1;
+const uint32_t BMFONT_PHASE_PAGES    = 2;
+const uint32_t BMFONT_PHASE_CHARS    = 3;
+const uint32_t BMFONT_PHASE_KERNINGS = 4;
+const uint32_t BMFONT_PHASE_INDEX    = 5; // Building the lookup tables
+const uint32_t BMFONT_PHASE_COUNT    = 6;
+
+#ifdef CMP_BMFONT_STATS
+// Instrumentation, compiled in when CMP_BMFONT_STATS is defined. The text and binary parse
+// functions above report each load to a hook, and lookups are counted. Lookups are then no longer
+// constexpr, so embedded fonts can't be queried at compile time.
+
+// Fonts are loaded in two passes, one that measures and one that fills in the font. Times cover
+// both; the counts are of the second pass only.
+struct BMFontLoadStats {
+    uint64_t phase_ns[BMFONT_PHASE_COUNT];
+    uint64_t total_ns;        // The whole call, including mapping the file
+    uint64_t bytes_read;      // Size of the font data
+    uint64_t tokens;          // Produced by the tokenizer
+    uint64_t fast_lines;      // Char and kerning lines read by the fast path without tokenizing
+    uint64_t unknown_keys;    // Keys the loader doesn't use, which are skipped
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+};
+
+// Called at the end of every load with its outcome and stats, on the thread that did the load.
+// filename is nullptr for loads from memory.
+typedef void BMFontLoadHook(const char *           filename,
+                            const BMFontResult *   result,
+                            const BMFontLoadStats *stats,
+                            void *                 user);
+
+// Installs the load hook, or removes it if hook is nullptr. Set it before loading any fonts.
+void bmfont_set_load_hook(BMFontLoadHook *hook, void *user);
+
+// Counts of bmfont_find_char() and bmfont_get_kerning() calls, including those made by the layout
+// functions, over all threads. A kerning lookup hits if the font has the pair.
+struct BMFontLookupStats {
+    uint64_t char_hits;
+    uint64_t char_misses;
+    uint64_t kerning_hits;
+    uint64_t kerning_misses;
+};
+
+void bmfont_get_lookup_stats(BMFontLookupStats *stats);
+void bmfont_reset_lookup_stats();
+#endif
+
+// Writes the font, including its lookup tables, to a single relocatable blob that can be loaded
+// with bmfont_load_blob() or bmfont_load_blob_file() without any parsing. The blob uses the byte
+// order of the machine that wrote it. Returns nullptr on error. Free the blob with
+// bmfont_free_blob().
+void *bmfont_write_blob(const BMFont *font, size_t *size);
+bool  bmfont_write_blob_file(const BMFont *font, const char *filename);
+void  bmfont_free_blob(void *blob);
+
+// Loads a font from a blob written by bmfont_write_blob(). The returned font points into the blob,
+// which must be 4 byte aligned, must not be modified, and must outlive the font. Only a single
+// small block is allocated for the font itself. Returns nullptr on error.
+BMFont *bmfont_load_blob(const void *data, size_t size, const BMFontAllocator *allocator = nullptr);
+
+// Maps a blob file written by bmfont_write_blob_file(). The mapping is released by bmfont_free().
+BMFont *bmfont_load_blob_file(const char *filename, const BMFontAllocator *allocator = nullptr);
+
+// Returns a new font with only the chars for the given codepoints and the kerning pairs between
+// them, e.g. to cut a font down to the glyphs one locale uses. Codepoints the font doesn't have
+// are skipped. Chars keep their order, page and atlas coordinates, so the subset draws with the
+// same page textures. Returns nullptr on error. Free the subset with bmfont_free().
+BMFont *bmfont_subset(const BMFont *         font,
+                      const uint32_t *       codepoints,
+                      size_t                 num_codepoints,
+                      const BMFontAllocator *allocator = nullptr);
+bool    bmfont_subset_r(const BMFont *         font,
+                        const uint32_t *       codepoints,
+                        size_t                 num_codepoints,
+                        BMFontResult *         result,
+                        const BMFontAllocator *allocator = nullptr);
+
+// Formats for bmfont_write_fnt().
+const uint32_t BMFONT_FORMAT_TEXT   = 0;
+const uint32_t BMFONT_FORMAT_BINARY = 1; // Version 3, as written by the BMFont tool
+
+// Writes the font as a .fnt file that the load functions, and other BMFont loaders, read back.
+// Only what BMFont keeps is written; other info keys like bold or padding are left out. The binary
+// format needs all page names to have the same length, as the BMFont tool writes them. Text
+// output is NUL terminated, not counting towards size. Returns nullptr on error. Free the output
+// with bmfont_free_blob(). The _r versions report errors through result, like the _r load
+// functions; bmfont_write_fnt_r() stores the output in *data.
+void *bmfont_write_fnt(const BMFont *font, uint32_t format, size_t *size);
+bool  bmfont_write_fnt_file(const BMFont *font, const char *filename, uint32_t format);
+bool  bmfont_write_fnt_r(const BMFont *font,
+                         uint32_t      format,
+                         void **       data,
+                         size_t *      size,
+                         BMFontResult *result);
+bool  bmfont_write_fnt_file_r(const BMFont *font,
+                              const char *  filename,
+                              uint32_t      format,
+                              BMFontResult *result);
+
+// One font for bmfont_parse_batch(): either a file, or a buffer in memory (text or binary form).
+struct BMFontSource {
+    const char *filename; // Loaded from this file when set...
+    const char *data;     // ...otherwise parsed from data / size, which must outlive the call
+    size_t      size;
+};
+
+// Loads count fonts across a pool of worker threads and writes the outcome for sources[i] to
+// results[i]. A num_threads of 0 uses one thread per core; the calling thread is one of them. The
+// allocator, if given, must be thread safe. Returns true if every font loaded. Fonts are loaded on
+// the calling thread alone when CMP_BMFONT_NO_THREADS is defined.
+bool bmfont_parse_batch(const BMFontSource *   sources,
+                        size_t                 count,
+                        BMFontResult *         results,
+                        unsigned               num_threads = 0,
+                        const BMFontAllocator *allocator = nullptr);
+
+// Hot reloading needs inotify and threads, so it is only available on Linux.
+#if defined(__linux__) && !defined(CMP_BMFONT_NO_THREADS)
+#define CMP_BMFONT_HAS_WATCHER
+
+// Watches font files on a background thread and reloads them when they are rewritten. A reloaded
+// font is published with an atomic pointer swap, and the font it replaces is freed once no reader
+// can still be using it, so readers never block and never see a partly loaded font.
+struct BMFontWatcher;
+
+// A watched font. bmfont_live_font() returns its current version.
+struct BMFontLive;
+
+// Called on the watcher thread after each reload. If the reload failed the previous font stays
+// current. A file rewritten with identical contents is not reloaded.
+typedef void BMFontReloadCallback(const char *filename, const BMFontResult *result, void *user);
+
+// Starts a watcher for up to max_readers reader threads. Returns nullptr if it can't be started.
+BMFontWatcher *bmfont_watcher_create(unsigned               max_readers,
+                                     BMFontReloadCallback * callback = nullptr,
+                                     void *                 user = nullptr,
+                                     const BMFontAllocator *allocator = nullptr);
+
+// Stops the watcher and frees every font it loaded. No reader may be using them any more.
+void bmfont_watcher_destroy(BMFontWatcher *watcher);
+
+// Loads a font file and starts watching it. Returns nullptr and fills in result on error. The
+// returned font is owned by the watcher.
+BMFontLive *bmfont_watcher_add(BMFontWatcher *watcher, const char *filename, BMFontResult *result);
+
+// Registers a reader thread and returns its index, or -1 if max_readers are already registered.
+int bmfont_watcher_add_reader(BMFontWatcher *watcher);
+
+// Unregisters a reader that isn't reading, so that its index can be handed out again.
+void bmfont_watcher_remove_reader(BMFontWatcher *watcher, int reader);
+
+// Bracket a reader's use of watched fonts, e.g. one frame. A font returned by bmfont_live_font()
+// stays valid until the reader calls bmfont_watcher_read_end(). Neither call blocks, and reads
+// don't nest. A reload waits for readers that might still use the old font, so keep reads short.
+// An index that bmfont_watcher_add_reader() didn't return, such as -1, is ignored.
+void bmfont_watcher_read_begin(BMFontWatcher *watcher, int reader);
+void bmfont_watcher_read_end(BMFontWatcher *watcher, int reader);
+
+// Returns the current version of a watched font. Call only between read_begin and read_end.
+const BMFont *bmfont_live_font(const BMFontLive *live);
+#endif
+
+// The lookup functions and the helpers that build their tables are defined here rather than in the
+// implementation so that they can be inlined, and evaluated at compile time for embedded fonts.
+
+constexpr uint32_t bmfont__hash_mix(uint32_t key) {
+    return key ^ (key >> 16);
+}
+
+constexpr uint32_t bmfont__hash(uint32_t key) {
+    return bmfont__hash_mix(key * 0x9E3779B1u);
+}
+
+constexpr uint32_t bmfont__hash_pair(uint32_t first, uint32_t second) {
+    return bmfont__hash(bmfont__hash(first) + second);
+}
+
+// Returns the number of slots for an open addressing table holding count entries. The load factor
+// is kept at or below 50% so probe sequences stay short.
+constexpr uint32_t bmfont__hash_capacity(uint32_t count, uint32_t capacity = 2) {
+    return capacity < count * 2 ? bmfont__hash_capacity(count, capacity * 2) : capacity;
+}
+
+// Decode the pending line of chars[i] / kernings[i] of a lazily loaded font. Return false if the
+// line is malformed.
+bool bmfont__load_lazy_char(const BMFont *font, uint32_t i);
+bool bmfont__load_lazy_kerning(const BMFont *font, uint32_t i);
+
+// Returns &chars[i], decoding it first if it is still pending, or nullptr if it can't be decoded.
+CMP_BMFONT__CONSTEXPR14 const BMFont::Char *bmfont__loaded_char(const BMFont *font, uint32_t i) {
+    if (font->_char_offsets && font->_char_offsets[i] && !bmfont__load_lazy_char(font, i)) {
+        return nullptr;
+    }
+    return &font->chars[i];
+}
+
+// Adds chars[i] to the lookup tables. When an id appears more than once the first occurrence wins.
+CMP_BMFONT__CONSTEXPR14 void bmfont__index_char(BMFont *font, uint32_t i) {
+    uint32_t id = font->chars[i].id;
+    if (id < BMFONT_DENSE_CHAR_COUNT) {
+        if (!font->char_dense_index[id]) font->char_dense_index[id] = i + 1;
+        return;
+    }
+
+    uint32_t slot = bmfont__hash(id) & font->char_hash_mask;
+    uint32_t index = font->char_hash_index[slot];
+    while (index && font->chars[index - 1].id != id) {
+        slot = (slot + 1) & font->char_hash_mask;
+        index = font->char_hash_index[slot];
+    }
+    if (!index) font->char_hash_index[slot] = i + 1;
+}
+
+// Adds kernings[i] to the lookup table. When a pair appears more than once the first occurrence
+// wins.
+CMP_BMFONT__CONSTEXPR14 void bmfont__index_kerning(BMFont *font, uint32_t i) {
+    const BMFont::Kerning *kerning = &font->kernings[i];
+    uint32_t slot = bmfont__hash_pair(kerning->first, kerning->second) & font->kerning_hash_mask;
+    uint32_t index = font->kerning_hash_index[slot];
+    while (index && (font->kernings[index - 1].first != kerning->first ||
+                     font->kernings[index - 1].second != kerning->second)) {
+        slot = (slot + 1) & font->kerning_hash_mask;
+        index = font->kerning_hash_index[slot];
+    }
+    if (!index) font->kerning_hash_index[slot] = i + 1;
+}
+
+#ifdef CMP_BMFONT_STATS
+static constexpr uint32_t BMFONT__LOOKUP_CHAR_HIT      = 0;
+static constexpr uint32_t BMFONT__LOOKUP_CHAR_MISS     = 1;
+static constexpr uint32_t BMFONT__LOOKUP_KERNING_HIT   = 2;
+static constexpr uint32_t BMFONT__LOOKUP_KERNING_MISS  = 3;
+
+void bmfont__count_lookup(uint32_t counter);
+
+#define CMP_BMFONT__LOOKUP inline
+#define CMP_BMFONT__COUNT_LOOKUP(counter) bmfont__count_lookup(counter)
+#else
+#define CMP_BMFONT__LOOKUP CMP_BMFONT__CONSTEXPR14
+#define CMP_BMFONT__COUNT_LOOKUP(counter) ((void)0)
+#endif
+
+// Returned by bmfont_find_char_index() for codepoints the font doesn't have.
+const uint32_t BMFONT_NO_CHAR = 0xFFFFFFFF;
+
+// Returns the index in chars of the char for the given codepoint, or BMFONT_NO_CHAR if the font
+// does not have it. Unlike bmfont_find_char() this never decodes a pending char of a lazily loaded
+// font, and only reads the id of chars outside the dense range. Meant for indexing BMFontMetrics.
+CMP_BMFONT__CONSTEXPR14 uint32_t bmfont_find_char_index(const BMFont *font, uint32_t codepoint) {
+    // Dense entries hold the index plus one, so an empty entry wraps around to BMFONT_NO_CHAR.
+    if (codepoint < BMFONT_DENSE_CHAR_COUNT) return font->char_dense_index[codepoint] - 1;
+
+    if (!font->char_hash_index) return BMFONT_NO_CHAR;
+
+    uint32_t slot = bmfont__hash(codepoint) & font->char_hash_mask;
+    for (uint32_t index = font->char_hash_index[slot]; index; index = font->char_hash_index[slot]) {
+        if (font->chars[index - 1].id == codepoint) return index - 1;
+        slot = (slot + 1) & font->char_hash_mask;
+    }
+    return BMFONT_NO_CHAR;
+}
+
+CMP_BMFONT__CONSTEXPR14 const BMFont::Char *bmfont__find_char(const BMFont *font,
+                                                              uint32_t      codepoint) {
+    uint32_t index = bmfont_find_char_index(font, codepoint);
+    return index != BMFONT_NO_CHAR ? bmfont__loaded_char(font, index) : nullptr;
+}
+
+CMP_BMFONT__CONSTEXPR14 const BMFont::Kerning *bmfont__find_kerning(const BMFont *font,
+                                                                    uint32_t      first,
+                                                                    uint32_t      second) {
+    if (!font->kerning_hash_index) return nullptr;
+
+    uint32_t slot = bmfont__hash_pair(first, second) & font->kerning_hash_mask;
+    for (uint32_t index = font->kerning_hash_index[slot]; index;
+         index = font->kerning_hash_index[slot]) {
+        const BMFont::Kerning *kerning = &font->kernings[index - 1];
+        if (kerning->first == first && kerning->second == second) {
+            if (font->_kerning_offsets && font->_kerning_offsets[index - 1] &&
+                !bmfont__load_lazy_kerning(font, index - 1)) {
+                return nullptr;
+            }
+            return kerning;
+        }
+        slot = (slot + 1) & font->kerning_hash_mask;
+    }
+    return nullptr;
+}
+
+// Returns the char for the given codepoint or nullptr if the font does not have it. This is O(1).
+CMP_BMFONT__LOOKUP const BMFont::Char *bmfont_find_char(const BMFont *font, uint32_t codepoint) {
+    const BMFont::Char *ch = bmfont__find_char(font, codepoint);
+    CMP_BMFONT__COUNT_LOOKUP(ch ? BMFONT__LOOKUP_CHAR_HIT : BMFONT__LOOKUP_CHAR_MISS);
+    return ch;
+}
+
+// Returns the kerning amount to apply between the given pair of codepoints, or 0 if the font has no
+// kerning for them. This is O(1).
+CMP_BMFONT__LOOKUP int16_t bmfont_get_kerning(const BMFont *font, uint32_t first, uint32_t second) {
+    const BMFont::Kerning *kerning = bmfont__find_kerning(font, first, second);
+    CMP_BMFONT__COUNT_LOOKUP(kerning ? BMFONT__LOOKUP_KERNING_HIT : BMFONT__LOOKUP_KERNING_MISS);
+    return kerning ? kerning->amount : 0;
+}
+
+// Decodes UTF-8 text into at most capacity codepoints and returns how many were written. Malformed
+// sequences decode to U+FFFD and consume a single byte. The number of bytes decoded is stored in
+// *consumed, which is less than len if the output filled up. Runs of ASCII are decoded 16 bytes at
+// a time where SSE2 is available.
+size_t bmfont_decode_utf8(const char *text,
+                          size_t      len,
+                          uint32_t *  codepoints,
+                          size_t      capacity,
+                          size_t *    consumed);
+
+// Like bmfont_decode_utf8(), and also looks up the char of each codepoint, or nullptr if the font
+// doesn't have it. Meant for iterating over the glyphs of a string in batches.
+size_t bmfont_find_glyphs(const BMFont *       font,
+                          const char *         text,
+                          size_t               len,
+                          uint32_t *           codepoints,
+                          const BMFont::Char **chars,
+                          size_t               capacity,
+                          size_t *             consumed);
+
+// Glyph metrics split out of BMFont::Char by how often they are read. Measuring and line breaking
+// only need advances and offsets, which are packed into arrays of 2 bytes per char instead of being
+// read out of 20 byte chars, so width-only passes over long text touch a fraction of the memory.
+// A flag per char tells whether it starts any kerning pair, which skips most kerning lookups.
+// The atlas coordinates stay in chars, and UVs normalized against scale_w / scale_h can be
+// precomputed for quad emission. The arrays are indexed like chars, see bmfont_find_char_index().
+// The fields are filled in by bmfont_metrics_create() and are read only.
+struct BMFontMetrics {
+    const BMFont *  font;
+    uint16_t *      x_advances;
+    int16_t *       x_offsets;
+    int16_t *       y_offsets;
+    uint8_t *       kerning_first; // Nonzero if the char is the first of a kerning pair
+    float *         uvs; // u0, v0, u1, v1 for each char, or nullptr if they weren't requested
+    BMFontAllocator allocator;
+    uint32_t        num_chars;
+    uint8_t         _padding[4];
+};
+
+// Builds the metrics table of a font, usually right after loading it, as one allocation. Pending
+// chars of a lazily loaded font are decoded. Returns nullptr if out of memory or if one of them is
+// malformed. The font must outlive the table; create a new one when the font is reloaded.
+BMFontMetrics *bmfont_metrics_create(const BMFont *         font,
+                                     bool                   with_uvs = false,
+                                     const BMFontAllocator *allocator = nullptr);
+void bmfont_metrics_destroy(BMFontMetrics *metrics);
+
+// Returns the width of the widest line of a UTF-8 string, as far as bmfont_layout() would advance
+// the pen, including kerning. Only reads the advances of the metrics table.
+float bmfont_measure(const BMFontMetrics *metrics, const char *text, size_t len);
+
+// Largest number of fonts in a BMFontChain.
+const uint32_t BMFONT_MAX_CHAIN_FONTS = 32;
+
+// A glyph in a chain index: the index of its font in the top bits, and its index in the font's
+// chars plus one in the rest, so that 0 means empty.
+const uint32_t BMFONT__CHAIN_CHAR_BITS = 27;
+const uint32_t BMFONT__CHAIN_CHAR_MASK = (1u << BMFONT__CHAIN_CHAR_BITS) - 1;
+
+static_assert(BMFONT_MAX_COUNT <= BMFONT__CHAIN_CHAR_MASK &&
+                      BMFONT_MAX_CHAIN_FONTS <= 1u << (32 - BMFONT__CHAIN_CHAR_BITS),
+              "Chain glyphs must fit in 32 bits");
+
+struct BMFont__ChainSlot {
+    uint32_t codepoint;
+    uint32_t glyph;
+};
+
+// An ordered list of fallback fonts, e.g. a Latin, a CJK and a symbol font, with one index over the
+// chars of all of them. A codepoint resolves to the first font in the list that has it, in a single
+// lookup. The fonts must outlive the chain; create a new chain when one of them is reloaded.
+//
+// The fields are filled in by bmfont_chain_create() and are read only. The hash slots follow the
+// struct in the same allocation.
+struct BMFontChain {
+    BMFontAllocator    allocator;
+    const BMFont *     fonts[BMFONT_MAX_CHAIN_FONTS];
+    BMFont__ChainSlot *slots;
+    uint32_t           dense[BMFONT_DENSE_CHAR_COUNT];
+    uint32_t           num_fonts;
+    uint32_t           slot_mask;
+};
+
+// Returns nullptr if there are more than BMFONT_MAX_CHAIN_FONTS fonts, more than BMFONT_MAX_COUNT
+// chars in total, or if out of memory.
+BMFontChain *bmfont_chain_create(const BMFont *const *  fonts,
+                                 uint32_t               num_fonts,
+                                 const BMFontAllocator *allocator = nullptr);
+void bmfont_chain_destroy(BMFontChain *chain);
+
+// Returns the char for the codepoint from the first font that has it and stores that font in
+// *font, or returns nullptr and stores nullptr if none of them has it.
+inline const BMFont::Char *bmfont_chain_find_char(const BMFontChain *chain,
+                                                  uint32_t           codepoint,
+                                                  const BMFont **    font) {
+    uint32_t glyph;
+    if (codepoint < BMFONT_DENSE_CHAR_COUNT) {
+        glyph = chain->dense[codepoint];
+    } else {
+        uint32_t slot = bmfont__hash(codepoint) & chain->slot_mask;
+        while (chain->slots[slot].glyph && chain->slots[slot].codepoint != codepoint) {
+            slot = (slot + 1) & chain->slot_mask;
+        }
+        glyph = chain->slots[slot].glyph;
+    }
+
+    const BMFont::Char *ch = nullptr;
+    *font = nullptr;
+    if (glyph) {
+        const BMFont *owner = chain->fonts[glyph >> BMFONT__CHAIN_CHAR_BITS];
+        ch = bmfont__loaded_char(owner, (glyph & BMFONT__CHAIN_CHAR_MASK) - 1);
+        if (ch) *font = owner;
+    }
+    return ch;
+}
+
+// bmfont_find_glyphs() over a chain. fonts[i] is the font that chars[i] comes from, or nullptr.
+// Kerning only applies between consecutive glyphs from the same font.
+size_t bmfont_chain_find_glyphs(const BMFontChain *  chain,
+                                const char *         text,
+                                size_t               len,
+                                uint32_t *           codepoints,
+                                const BMFont::Char **chars,
+                                const BMFont **      fonts,
+                                size_t               capacity,
+                                size_t *             consumed);
+
+// Destination for bmfont_layout(). Each glyph produces one quad made of four vertices, in the order
+// top-left, top-right, bottom-right, bottom-left. Positions and uvs are (float, float) pairs and
+// the strides are in bytes, so they can be interleaved in one vertex array or kept in separate
+// arrays. A stride of 0 means the pairs are tightly packed.
+//
+// channels is optional. If set, each vertex also gets 4 bytes of R, G, B, A channel mask, 255 for
+// the channels of the page that hold the glyph (Char::channel) and 0 for the others, with a stride
+// of 4 if channel_stride is 0. In a packed font the coverage of a glyph is then dot(texel, mask).
+// Chars without a channel get a mask of all four.
+struct BMFontQuadBuffer {
+    float *  positions;
+    float *  uvs;
+    uint8_t *channels;
+    size_t   position_stride;
+    size_t   uv_stride;
+    size_t   channel_stride;
+    uint32_t capacity; // Maximum number of quads that fit in the buffer
+    uint32_t count;    // Number of quads written so far; layout appends after these
+    uint32_t dropped;  // Number of glyphs that didn't fit
+    uint8_t  _padding[4];
+};
+
+// Lays out a UTF-8 string with the pen starting at (x, y), the top-left of the first line, and
+// appends a quad for each visible glyph to quads. Kerning is applied and '\n' starts a new line.
+// UVs are normalized against scale_w / scale_h. Codepoints the font doesn't have are skipped. Does
+// not allocate. Returns the pen x position after the last glyph.
+float bmfont_layout(const BMFont *    font,
+                    const char *      text,
+                    size_t            len,
+                    float             x,
+                    float             y,
+                    BMFontQuadBuffer *quads);
+
+// The quads on one page of the font, in the output of bmfont_layout_paged().
+struct BMFontPageRange {
+    uint32_t first; // Index of the first quad in the quad buffer
+    uint32_t count;
+};
+
+// Same as bmfont_layout(), but the quads are grouped by the page their glyph is on, in page order,
+// and pages[i] is set to the range of quads on page i. pages must hold font->num_pages ranges. A
+// string that spans several pages is then drawn with one draw call per page instead of switching
+// textures between glyphs. The text is decoded twice, first to count the glyphs on each page. Does
+// not allocate. Glyphs on pages the font doesn't have are skipped.
+float bmfont_layout_paged(const BMFont *    font,
+                          const char *      text,
+                          size_t            len,
+                          float             x,
+                          float             y,
+                          BMFontQuadBuffer *quads,
+                          BMFontPageRange * pages);
+
+// Cache of layouts for strings that are drawn over and over, e.g. UI labels. Each entry holds the
+// quads of one (font, string) pair laid out at the origin, and is replayed at any pen position
+// without looking up glyphs again. Least recently used entries are evicted to stay within the
+// memory budget. A cache must only be used by one thread at a time.
+struct BMFontLayoutCache;
+
+struct BMFontLayoutCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t   bytes_used; // Size of the cached layouts, which stays within the budget
+    size_t   budget;
+    uint32_t num_entries;
+    uint8_t  _padding[4];
+};
+
+BMFontLayoutCache *bmfont_layout_cache_create(size_t                 memory_budget,
+                                              const BMFontAllocator *allocator = nullptr);
+void bmfont_layout_cache_destroy(BMFontLayoutCache *cache);
+
+// Same as bmfont_layout(), but replays the quads from the cache if the string was laid out with
+// this font before. Positions can differ from bmfont_layout() in the last bits when (x, y) is not
+// integral. Strings whose layout is larger than the budget are laid out without being cached.
+float bmfont_layout_cached(BMFontLayoutCache *cache,
+                           const BMFont *     font,
+                           const char *       text,
+                           size_t             len,
+                           float              x,
+                           float              y,
+                           BMFontQuadBuffer * quads);
+
+// Entries are keyed by the font's load, so a font loaded at the address of a freed one never gets
+// the old font's layouts. Until they age out, the old entries still count against the budget;
+// evicting a font before freeing it releases them at once.
+void bmfont_layout_cache_evict_font(BMFontLayoutCache *cache, const BMFont *font);
+void bmfont_layout_cache_clear(BMFontLayoutCache *cache);
+
+void bmfont_layout_cache_get_stats(const BMFontLayoutCache *cache, BMFontLayoutCacheStats *stats);
+
+// A line of wrapped text, as a byte range of the text. Trailing spaces and the '\n' that ended the
+// line are not part of the range, so laying out [begin, end) draws exactly the visible line.
+struct BMFontLine {
+    size_t  begin;
+    size_t  end;
+    float   width; // Pen advance at the end of the line, including kerning
+    uint8_t _padding[4];
+};
+
+// Breaks text into lines no wider than a maximum width. Lines break at '\n', after spaces, and
+// around CJK ideographs, kana and hangul; words wider than a line are broken between characters.
+// The wrap keeps the start of every line, so after an edit only the lines from the one before the
+// edit up to the first line that starts where it did before are wrapped again.
+struct BMFontWrap;
+
+BMFontWrap *bmfont_wrap_create(const BMFont *font, const BMFontAllocator *allocator = nullptr);
+void bmfont_wrap_destroy(BMFontWrap *wrap);
+
+// Wraps the whole text. Returns false if out of memory.
+bool bmfont_wrap_text(BMFontWrap *wrap, const char *text, size_t len, float max_width);
+
+// Rewraps after removed bytes at offset were replaced by inserted bytes; text is the edited text.
+// The lines in [*first_line, *first_line + *num_lines) were wrapped again, the lines after them
+// only moved. Returns false if out of memory, in which case the lines are left as they were.
+bool bmfont_wrap_edit(BMFontWrap *wrap,
+                      const char *text,
+                      size_t      len,
+                      size_t      offset,
+                      size_t      removed,
+                      size_t      inserted,
+                      uint32_t *  first_line = nullptr,
+                      uint32_t *  num_lines = nullptr);
+
+const BMFontLine *bmfont_wrap_get_lines(const BMFontWrap *wrap, uint32_t *num_lines);
+
+// Makes the wrap read advances from a metrics table of its font, or from the font's chars again if
+// metrics is nullptr. Takes effect from the next wrap or edit, and the table must stay alive while
+// the wrap uses it.
+void bmfont_wrap_use_metrics(BMFontWrap *wrap, const BMFontMetrics *metrics);
+
+// Lays out num_lines wrapped lines starting at first_line, with (x, y) the top-left of the first.
+// Lines are line_height apart. Returns the y position below the last line.
+float bmfont_layout_wrapped(const BMFontWrap *wrap,
+                            const char *      text,
+                            uint32_t          first_line,
+                            uint32_t          num_lines,
+                            float             x,
+                            float             y,
+                            BMFontQuadBuffer *quads);
+
+#ifdef CMP_BMFONT_HAS_EMBED
+
+// A span of the embedded source text, e.g. a tag, key or value.
+struct BMFont__EmbedToken {
+    const char *str;
+    size_t      len;
+
+    constexpr bool equals(const char *s) const {
+        size_t i = 0;
+        while (i < len && s[i] && s[i] == str[i]) ++i;
+        return i == len && !s[i];
+    }
+};
+
+// Sizes gathered by the measuring pass over embedded source text. They become the template
+// arguments of BMFontEmbedded.
+struct BMFont__EmbedSizes {
+    uint32_t num_pages;
+    uint32_t num_chars;
+    uint32_t num_kernings;
+    uint32_t string_size;
+};
+
+// Compile time counterpart of the text parser. Tokens are split on the same characters as at run
+// time: whitespace, '=' and newlines.
+struct BMFont__EmbedReader {
+    const char *data;
+    size_t      size;
+    size_t      pos;
+
+    constexpr bool is_space(char c) const { return c == ' ' || c == '\r'; }
+
+    constexpr bool is_delimiter(char c) const { return is_space(c) || c == '=' || c == '\n'; }
+
+    constexpr bool at_end() const { return pos >= size; }
+
+    constexpr void skip_spaces() {
+        while (pos < size && is_space(data[pos])) ++pos;
+    }
+
+    constexpr void next_line() {
+        while (pos < size && data[pos] != '\n') ++pos;
+        if (pos < size) ++pos;
+    }
+
+    constexpr BMFont__EmbedToken read_token() {
+        skip_spaces();
+        size_t start = pos;
+        while (pos < size && !is_delimiter(data[pos])) ++pos;
+        return {data + start, pos - start};
+    }
+
+    // Reads the next key=value pair on the current line. Returns false at the end of the line.
+    constexpr bool read_pair(BMFont__EmbedToken *key, BMFont__EmbedToken *value) {
+        *key = read_token();
+        if (!key->len) return false;
+
+        skip_spaces();
+        if (pos < size && data[pos] == '=') ++pos;
+        *value = read_token();
+        return true;
+    }
+};
+
+// Evaluating a call to this function stops constant evaluation, so malformed embedded fonts are
+// reported by the compiler with the message in the diagnostic.
+inline void bmfont__embed_error(const char *message) {
+    (void)message;
+}
+
+template <typename T>
+constexpr T bmfont__embed_int(BMFont__EmbedToken token) {
+    size_t i = 0;
+    bool negative = token.len > 0 && token.str[0] == '-';
+    if (negative) ++i;
+    if (i == token.len) bmfont__embed_error("Expected integer");
+
+    int64_t value = 0;
+    for (; i < token.len; ++i) {
+        if (token.str[i] < '0' || token.str[i] > '9') bmfont__embed_error("Expected integer");
+        value = value * 10 + (token.str[i] - '0');
+        if (value > 0xFFFFFFFFll) bmfont__embed_error("Integer out of range");
+    }
+    if (negative) value = -value;
+    if ((int64_t)(T)value != value) bmfont__embed_error("Integer out of range");
+    return (T)value;
+}
+
+constexpr uint32_t bmfont__embed_count(BMFont__EmbedToken token) {
+    uint32_t count = bmfont__embed_int<uint32_t>(token);
+    if (count > BMFONT_MAX_COUNT) bmfont__embed_error("Count out of range");
+    return count;
+}
+
+// Copies a string value into the string section of an embedded font, or only measures it.
+constexpr char *bmfont__embed_string(BMFont__EmbedToken token,
+                                     bool               measuring,
+                                     char *             strings,
+                                     uint32_t *         offset) {
+    char *dest = nullptr;
+    if (!measuring) {
+        dest = strings + *offset;
+        for (size_t i = 0; i < token.len; ++i) dest[i] = token.str[i];
+    }
+    *offset += (uint32_t)token.len + 1;
+    return dest;
+}
+
+// Parses embedded source text into font. When measuring, font is a scratch font with no arrays and
+// only the counts and sizes are gathered. Otherwise font's page_names, chars and kernings arrays
+// are filled, and strings receives the font and page names.
+constexpr BMFont__EmbedSizes bmfont__embed_parse(const char *data,
+                                                 size_t      size,
+                                                 bool        measuring,
+                                                 BMFont *    font,
+                                                 char *      strings) {
+    // Accept a terminated string literal as well as raw file contents from #embed.
+    if (size && !data[size - 1]) --size;
+
+    BMFont__EmbedReader reader = {data, size, 0};
+    BMFont__EmbedSizes sizes = {};
+    BMFont__EmbedToken key = {};
+    BMFont__EmbedToken value = {};
+    uint32_t num_pages = 0;
+    uint32_t num_chars = 0;
+    uint32_t num_kernings = 0;
+
+    while (!reader.at_end()) {
+        BMFont__EmbedToken tag = reader.read_token();
+        if (tag.equals("info")) {
+            while (reader.read_pair(&key, &value)) {
+                if (key.equals("face")) {
+                    font->font_name =
+                            bmfont__embed_string(value, measuring, strings, &sizes.string_size);
+                } else if (key.equals("size")) {
+                    font->font_size = bmfont__embed_int<int16_t>(value);
+                }
+            }
+        } else if (tag.equals("common")) {
+            while (reader.read_pair(&key, &value)) {
+                if (key.equals("lineHeight")) {
+                    font->line_height = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("base")) {
+                    font->base = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("scaleW")) {
+                    font->scale_w = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("scaleH")) {
+                    font->scale_h = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("pages")) {
+                    font->num_pages = bmfont__embed_count(value);
+                } else if (key.equals("packed")) {
+                    font->packed = bmfont__embed_int<uint8_t>(value);
+                } else if (key.equals("alphaChnl")) {
+                    font->alpha_channel = bmfont__embed_int<uint8_t>(value);
+                } else if (key.equals("redChnl")) {
+                    font->red_channel = bmfont__embed_int<uint8_t>(value);
+                } else if (key.equals("greenChnl")) {
+                    font->green_channel = bmfont__embed_int<uint8_t>(value);
+                } else if (key.equals("blueChnl")) {
+                    font->blue_channel = bmfont__embed_int<uint8_t>(value);
+                }
+            }
+        } else if (tag.equals("page")) {
+            uint32_t id = 0;
+            BMFont__EmbedToken file = {};
+            while (reader.read_pair(&key, &value)) {
+                if (key.equals("id")) {
+                    id = bmfont__embed_int<uint32_t>(value);
+                } else if (key.equals("file")) {
+                    file = value;
+                }
+            }
+            if (file.len < 2 || file.str[0] != '"' || file.str[file.len - 1] != '"') {
+                bmfont__embed_error("Page tag missing quoted filename");
+            }
+            if (id >= font->num_pages) bmfont__embed_error("Page id out of range");
+
+            file = {file.str + 1, file.len - 2};
+            char *name = bmfont__embed_string(file, measuring, strings, &sizes.string_size);
+            if (!measuring) font->page_names[id] = name;
+            ++num_pages;
+        } else if (tag.equals("chars")) {
+            while (reader.read_pair(&key, &value)) {
+                if (key.equals("count")) font->num_chars = bmfont__embed_count(value);
+            }
+        } else if (tag.equals("char")) {
+            if (num_chars >= font->num_chars) bmfont__embed_error("More chars than specified");
+
+            BMFont::Char ch = {};
+            while (reader.read_pair(&key, &value)) {
+                if (key.equals("id")) {
+                    ch.id = bmfont__embed_int<uint32_t>(value);
+                } else if (key.equals("x")) {
+                    ch.x = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("y")) {
+                    ch.y = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("width")) {
+                    ch.width = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("height")) {
+                    ch.height = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("xoffset")) {
+                    ch.x_offset = bmfont__embed_int<int16_t>(value);
+                } else if (key.equals("yoffset")) {
+                    ch.y_offset = bmfont__embed_int<int16_t>(value);
+                } else if (key.equals("xadvance")) {
+                    ch.x_advance = bmfont__embed_int<uint16_t>(value);
+                } else if (key.equals("page")) {
+                    ch.page = bmfont__embed_int<uint8_t>(value);
+                } else if (key.equals("chnl")) {
+                    ch.channel = bmfont__embed_int<uint8_t>(value);
+                }
+            }
+            if (!measuring) font->chars[num_chars] = ch;
+            ++num_chars;
+        } else if (tag.equals("kernings")) {
+            while (reader.read_pair(&key, &value)) {
+                if (key.equals("count")) font->num_kernings = bmfont__embed_count(value);
+            }
+        } else if (tag.equals("kerning")) {
+            if (num_kernings >= font->num_kernings) {
+                bmfont__embed_error("More kernings than specified");
+            }
+
+            BMFont::Kerning kerning = {};
+            while (reader.read_pair(&key, &value)) {
+                if (key.equals("first")) {
+                    kerning.first = bmfont__embed_int<uint32_t>(value);
+                } else if (key.equals("second")) {
+                    kerning.second = bmfont__embed_int<uint32_t>(value);
+                } else if (key.equals("amount")) {
+                    kerning.amount = bmfont__embed_int<int16_t>(value);
+                }
+            }
+            if (!measuring) font->kernings[num_kernings] = kerning;
+            ++num_kernings;
+        } else if (tag.len) {
+            bmfont__embed_error("Unexpected tag");
+        }
+
+        reader.next_line();
+    }
+
+    if (num_pages != font->num_pages) bmfont__embed_error("Fewer pages than specified");
+    if (num_chars != font->num_chars) bmfont__embed_error("Fewer chars than specified");
+    if (num_kernings != font->num_kernings) bmfont__embed_error("Fewer kernings than specified");
+
+    sizes.num_pages = num_pages;
+    sizes.num_chars = num_chars;
+    sizes.num_kernings = num_kernings;
+
+    // Round the string section up so that BMFontEmbedded needs no tail padding. The sections
+    // before it are all multiples of 4 bytes; chars and kernings arrays hold at least one entry.
+    uint32_t records = (num_chars ? num_chars : 1) + (num_kernings ? num_kernings : 1);
+    uint32_t string_size = (sizes.string_size + 7) & ~7u;
+    sizes.string_size = string_size + (records & 1) * 4;
+    if (sizes.string_size == 0) sizes.string_size = 8;
+    return sizes;
+}
+
+constexpr BMFont__EmbedSizes bmfont__embed_measure(const char *data, size_t size) {
+    BMFont scratch = {};
+    return bmfont__embed_parse(data, size, true, &scratch, nullptr);
+}
+
+// A font parsed at compile time from the text of a .fnt file. All tables, including the lookup
+// indices, are laid out in the object itself, so declaring it constexpr costs nothing at startup
+// and allocates nothing. Use it through the font member like any other font; don't free it.
+// Declare it with CMP_BMFONT_EMBEDDED_TYPE, which measures the text to size the tables.
+template <uint32_t NumPages, uint32_t NumChars, uint32_t NumKernings, uint32_t StringSize>
+struct BMFontEmbedded {
+    BMFont          font;
+    char *          page_names[NumPages ? NumPages : 1];
+    BMFont::Char    chars[NumChars ? NumChars : 1];
+    BMFont::Kerning kernings[NumKernings ? NumKernings : 1];
+    uint32_t        char_dense_index[BMFONT_DENSE_CHAR_COUNT];
+    uint32_t        char_hash_index[bmfont__hash_capacity(NumChars)];
+    uint32_t        kerning_hash_index[bmfont__hash_capacity(NumKernings)];
+    char            strings[StringSize];
+
+    // data is the file text, either a string literal or the bytes from #embed, and size its
+    // length with or without a terminating NUL.
+    constexpr BMFontEmbedded(const char *data, size_t size)
+        : font()
+        , page_names()
+        , chars()
+        , kernings()
+        , char_dense_index()
+        , char_hash_index()
+        , kerning_hash_index()
+        , strings() {
+        font.page_names = page_names;
+        font.chars = chars;
+        font.kernings = kernings;
+        bmfont__embed_parse(data, size, false, &font, strings);
+
+        font.char_dense_index = char_dense_index;
+        if (NumChars) {
+            font.char_hash_index = char_hash_index;
+            font.char_hash_mask = bmfont__hash_capacity(NumChars) - 1;
+        }
+        for (uint32_t i = 0; i < NumChars; ++i) bmfont__index_char(&font, i);
+
+        if (NumKernings) {
+            font.kerning_hash_index = kerning_hash_index;
+            font.kerning_hash_mask = bmfont__hash_capacity(NumKernings) - 1;
+        }
+        for (uint32_t i = 0; i < NumKernings; ++i) bmfont__index_kerning(&font, i);
+    }
+
+    // The font points into the object itself, so it must not be copied.
+    BMFontEmbedded(const BMFontEmbedded &) = delete;
+    BMFontEmbedded &operator=(const BMFontEmbedded &) = delete;
+};
+
+// Names the BMFontEmbedded type for the font text in data, which must be an array usable in
+// constant expressions.
+#define CMP_BMFONT_EMBEDDED_TYPE(data)                                                             \
+    ::cmp::BMFontEmbedded<::cmp::bmfont__embed_measure(data, sizeof(data)).num_pages,              \
+                          ::cmp::bmfont__embed_measure(data, sizeof(data)).num_chars,              \
+                          ::cmp::bmfont__embed_measure(data, sizeof(data)).num_kernings,           \
+                          ::cmp::bmfont__embed_measure(data, sizeof(data)).string_size>
+
+#endif // ifdef CMP_BMFONT_HAS_EMBED
+
 } // namespace cmp
 
 #endif // ifndef CMP_BMFONT_INCLUDE
@@ -100,11 +1327,73 @@ const char *bmfont_get_error_string();
 #undef CMP_BMFONT_IMPLEMENTATION
 
 #include <assert.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(CMP_BMFONT_NO_MMAP) && defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#define CMP_BMFONT__WINDOWS_MMAP
+#elif !defined(CMP_BMFONT_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CMP_BMFONT__POSIX_MMAP
+#endif
+
+#if !defined(CMP_BMFONT_NO_THREADS) && defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#define CMP_BMFONT__WIN32_THREADS
+#elif !defined(CMP_BMFONT_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#include <pthread.h>
+#include <unistd.h>
+#define CMP_BMFONT__PTHREADS
+#endif
+
+#if defined(CMP_BMFONT_STATS) && defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(CMP_BMFONT_STATS)
+#include <time.h>
+#endif
+
+#ifdef CMP_BMFONT_HAS_WATCHER
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+// The text tokenizer scans for delimiters 16 bytes at a time where SSE2 is available. Define
+// CMP_BMFONT_NO_SIMD to always use the scalar loop.
+#if !defined(CMP_BMFONT_NO_SIMD) &&                                                                \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define CMP_BMFONT__SSE2
+#endif
+
+#if defined(CMP_BMFONT_MALLOC) != defined(CMP_BMFONT_FREE)
+#error "Define both CMP_BMFONT_MALLOC and CMP_BMFONT_FREE, or neither"
+#endif
+
+#ifndef CMP_BMFONT_MALLOC
+#define CMP_BMFONT_MALLOC(size, user) ((void)(user), malloc(size))
+#define CMP_BMFONT_FREE(ptr, user) ((void)(user), free(ptr))
+#endif
+
 namespace cmp {
 
 #define CMP_BMFONT__CONCAT2(x, y) x##y
@@ -138,25 +1427,256 @@ static char bmfont__error[BMFONT_MAX_TOKEN_LENGTH * 2 + 1024];
 static constexpr unsigned BMFONT__PARSER_OK  = 0x0001;
 static constexpr unsigned BMFONT__PARSER_EOF = 0x0002;
 
-struct BMFont__Parser {
-    FILE *   file;
-    char     next_token[BMFONT_MAX_TOKEN_LENGTH];
-    int      start_line, start_col;
-    int      curr_line, curr_col;
-    unsigned flags;
-    int      next_char;
+void bmfont__reset_result(BMFontResult *result) {
+    result->font = nullptr;
+    result->line = 0;
+    result->col = 0;
+    strcpy(result->error, "Success");
+}
+
+void bmfont__set_error(BMFontResult *result, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(result->error, sizeof(result->error), fmt, args);
+    va_end(args);
+}
+
+// Used by the non-reentrant API to report the outcome of a call through bmfont_get_error_string().
+BMFont *bmfont__publish_result(const BMFontResult *result) {
+    snprintf(bmfont__error, sizeof(bmfont__error), "%s", result->error);
+    return result->font;
+}
+
+static volatile int64_t bmfont__last_font_id;
+
+// Returns the id for a newly loaded font (see BMFont::_id).
+uint64_t bmfont__next_font_id() {
+#if defined(CMP_BMFONT__WIN32_THREADS)
+    return (uint64_t)InterlockedIncrement64((volatile LONG64 *)&bmfont__last_font_id);
+#elif defined(CMP_BMFONT__PTHREADS)
+    return (uint64_t)__atomic_add_fetch(&bmfont__last_font_id, 1, __ATOMIC_RELAXED);
+#else
+    return (uint64_t)++bmfont__last_font_id;
+#endif
+}
+
+#ifdef CMP_BMFONT_STATS
+static BMFontLoadHook *bmfont__load_hook;
+static void *          bmfont__load_hook_user;
+
+// Stats of the load running on this thread, or nullptr if there is none or no hook is installed.
+static thread_local BMFontLoadStats *bmfont__load_stats;
+
+static volatile int64_t bmfont__lookup_counts[4];
+
+void bmfont_set_load_hook(BMFontLoadHook *hook, void *user) {
+    bmfont__load_hook = hook;
+    bmfont__load_hook_user = user;
+}
+
+void bmfont__count_lookup(uint32_t counter) {
+#if defined(CMP_BMFONT__WIN32_THREADS)
+    InterlockedExchangeAdd64((volatile LONG64 *)&bmfont__lookup_counts[counter], 1);
+#elif defined(CMP_BMFONT__PTHREADS)
+    __atomic_fetch_add(&bmfont__lookup_counts[counter], 1, __ATOMIC_RELAXED);
+#else
+    bmfont__lookup_counts[counter]++;
+#endif
+}
+
+void bmfont_get_lookup_stats(BMFontLookupStats *stats) {
+    uint64_t counts[4];
+    for (uint32_t i = 0; i < 4; ++i) {
+#if defined(CMP_BMFONT__WIN32_THREADS)
+        counts[i] = (uint64_t)InterlockedCompareExchange64(
+                (volatile LONG64 *)&bmfont__lookup_counts[i], 0, 0);
+#elif defined(CMP_BMFONT__PTHREADS)
+        counts[i] = (uint64_t)__atomic_load_n(&bmfont__lookup_counts[i], __ATOMIC_RELAXED);
+#else
+        counts[i] = (uint64_t)bmfont__lookup_counts[i];
+#endif
+    }
+    stats->char_hits = counts[BMFONT__LOOKUP_CHAR_HIT];
+    stats->char_misses = counts[BMFONT__LOOKUP_CHAR_MISS];
+    stats->kerning_hits = counts[BMFONT__LOOKUP_KERNING_HIT];
+    stats->kerning_misses = counts[BMFONT__LOOKUP_KERNING_MISS];
+}
+
+void bmfont_reset_lookup_stats() {
+    for (uint32_t i = 0; i < 4; ++i) {
+#if defined(CMP_BMFONT__WIN32_THREADS)
+        InterlockedExchange64((volatile LONG64 *)&bmfont__lookup_counts[i], 0);
+#elif defined(CMP_BMFONT__PTHREADS)
+        __atomic_store_n(&bmfont__lookup_counts[i], 0, __ATOMIC_RELAXED);
+#else
+        bmfont__lookup_counts[i] = 0;
+#endif
+    }
+}
+
+uint64_t bmfont__now_ns() {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+// Reports the outermost load on this thread to the hook when it goes out of scope, which is after
+// the load has filled in its result.
+struct BMFont__LoadScope {
+    BMFontLoadStats     stats;
+    const char *        filename;
+    const BMFontResult *result;
+    uint64_t            start;
+    bool                active;
+    uint8_t             _padding[7];
+
+    BMFont__LoadScope(const char *filename, const BMFontResult *result)
+        : stats()
+        , filename(filename)
+        , result(result)
+        , start(0)
+        , active(bmfont__load_hook && !bmfont__load_stats) {
+        if (!active) return;
+        start = bmfont__now_ns();
+        bmfont__load_stats = &stats;
+    }
+
+    ~BMFont__LoadScope() {
+        if (!active) return;
+        stats.total_ns = bmfont__now_ns() - start;
+        bmfont__load_stats = nullptr;
+        bmfont__load_hook(filename, result, &stats, bmfont__load_hook_user);
+    }
+
+    BMFont__LoadScope(const BMFont__LoadScope &) = delete;
+    BMFont__LoadScope &operator=(const BMFont__LoadScope &) = delete;
 };
 
-void *bmfont__calloc(int count, size_t size)
-{
-    void *mem = calloc(count, size);
-    if (!mem)
-    {
-        strcpy(bmfont__error, "Out of memory.");
+#define CMP_BMFONT__LOAD_SCOPE(filename, result)                                                   \
+    BMFont__LoadScope CMP_BMFONT__CONCAT(bmfont__load_scope, __LINE__)(filename, result)
+#define CMP_BMFONT__COUNT_LOAD(counter, amount)                                                    \
+    (bmfont__load_stats ? (void)(bmfont__load_stats->counter += (amount)) : (void)0)
+#else
+#define CMP_BMFONT__LOAD_SCOPE(filename, result) ((void)0)
+#define CMP_BMFONT__COUNT_LOAD(counter, amount) ((void)0)
+#endif
+
+// Phase timing for the loader. Each call to bmfont__end_phase charges the time since *start to
+// phase and restarts the clock. Without CMP_BMFONT_STATS these compile to nothing.
+uint64_t bmfont__start_phase() {
+#ifdef CMP_BMFONT_STATS
+    return bmfont__load_stats ? bmfont__now_ns() : 0;
+#else
+    return 0;
+#endif
+}
+
+void bmfont__end_phase(uint32_t phase, uint64_t *start) {
+#ifdef CMP_BMFONT_STATS
+    if (!bmfont__load_stats) return;
+    uint64_t now = bmfont__now_ns();
+    bmfont__load_stats->phase_ns[phase] += now - *start;
+    *start = now;
+#else
+    (void)phase;
+    (void)start;
+#endif
+}
+
+void *bmfont__default_alloc(size_t size, void *user) {
+    return CMP_BMFONT_MALLOC(size, user);
+}
+
+void bmfont__default_free(void *ptr, void *user) {
+    CMP_BMFONT_FREE(ptr, user);
+}
+
+BMFontAllocator bmfont__allocator_or_default(const BMFontAllocator *allocator) {
+    if (allocator) return *allocator;
+
+    BMFontAllocator result = {};
+    result.alloc = bmfont__default_alloc;
+    result.free = bmfont__default_free;
+    return result;
+}
+
+// Allocates a zeroed block.
+void *bmfont__alloc(const BMFontAllocator *allocator, size_t size, BMFontResult *result) {
+    void *mem = allocator->alloc(size ? size : 1, allocator->user);
+    if (!mem) {
+        bmfont__set_error(result, "Out of memory.");
+        return nullptr;
     }
+    CMP_BMFONT__COUNT_LOAD(allocations, 1);
+    CMP_BMFONT__COUNT_LOAD(allocated_bytes, size);
+    memset(mem, 0, size);
     return mem;
 }
 
+size_t bmfont__align8(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+// A loaded font and everything it references live in one block. Loading runs over the input twice:
+// the first pass only measures (base is nullptr and pushes just add up their sizes), the second
+// fills a block of exactly the measured size. Both passes must push the same sizes in the same
+// order.
+struct BMFont__Arena {
+    char * base;
+    size_t size;
+    size_t capacity;
+};
+
+bool bmfont__arena_measuring(const BMFont__Arena *arena) {
+    return !arena->base;
+}
+
+void *bmfont__arena_push(BMFont__Arena *arena, size_t size) {
+    // Saturate rather than wrap, so that a font too large for the address space fails to allocate.
+    size_t offset = bmfont__align8(arena->size);
+    if (offset < arena->size || size > SIZE_MAX - offset) {
+        arena->size = SIZE_MAX;
+        return nullptr;
+    }
+    arena->size = offset + size;
+    if (bmfont__arena_measuring(arena)) return nullptr;
+
+    assert(arena->size <= arena->capacity);
+    return arena->base + offset;
+}
+
+// Tokens are slices of the input buffer. The buffer is not required to be NUL terminated, so any
+// code that looks at a token must respect next_token_len.
+struct BMFont__Parser {
+#ifdef CMP_BMFONT_STATS
+    BMFontLoadStats *stats; // Set while filling in a font
+#endif
+    const char *   curr;
+    const char *   end;
+    const char *   next_token;
+    size_t         next_token_len;
+    BMFont__Arena *arena;
+    BMFontResult * result;
+    int            start_line, start_col;
+    int            curr_line, curr_col;
+    unsigned       flags;
+    uint8_t        _padding[4];
+};
+
+#ifdef CMP_BMFONT_STATS
+#define CMP_BMFONT__COUNT_PARSE(parser, counter, amount)                                           \
+    ((parser)->stats ? (void)((parser)->stats->counter += (amount)) : (void)0)
+#else
+#define CMP_BMFONT__COUNT_PARSE(parser, counter, amount) ((void)0)
+#endif
+
 bool bmfont__parser_ok(BMFont__Parser *parser) {
     return parser->flags & BMFONT__PARSER_OK;
 }
@@ -168,66 +1688,141 @@ bool bmfont__parser_ready(BMFont__Parser *parser) {
 void bmfont__set_parser_error(BMFont__Parser *parser, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vsnprintf(bmfont__error, sizeof(bmfont__error), fmt, args);
+    vsnprintf(parser->result->error, sizeof(parser->result->error), fmt, args);
+    parser->result->line = parser->start_line;
+    parser->result->col = parser->start_col;
     parser->flags &= ~BMFONT__PARSER_OK;
     va_end(args);
 }
 
+// Length to use with "%.*s" when printing the current token in an error message.
+int bmfont__token_print_len(BMFont__Parser *parser) {
+    return parser->next_token_len < BMFONT_MAX_TOKEN_LENGTH ? (int)parser->next_token_len
+                                                            : (int)BMFONT_MAX_TOKEN_LENGTH;
+}
+
+bool bmfont__token_equals(BMFont__Parser *parser, const char *token) {
+    size_t len = strlen(token);
+    return parser->next_token_len == len && !memcmp(parser->next_token, token, len);
+}
+
+void bmfont__parser_init(BMFont__Parser *parser,
+                         const char *    data,
+                         size_t          size,
+                         BMFont__Arena * arena,
+                         BMFontResult *  result) {
+    *parser = {};
+    parser->arena = arena;
+    parser->result = result;
+    parser->curr = data;
+    parser->end = data + size;
+    parser->curr_line = 1;
+    parser->curr_col = 1;
+    parser->flags = BMFONT__PARSER_OK;
+}
+
+#ifdef CMP_BMFONT__SSE2
+// Index of the lowest set bit of a non-zero mask.
+unsigned bmfont__lowest_bit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Skips spaces and '\r' starting at p, adding a column for each space. Padding runs between
+// fields are skipped 16 bytes at a time.
+const char *bmfont__skip_whitespace(const char *p, const char *end, int *col) {
+#ifdef CMP_BMFONT__SSE2
+    const __m128i spaces = _mm_set1_epi8(' ');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        unsigned others = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces)) & 0xFFFF;
+        if (others) {
+            unsigned n = bmfont__lowest_bit(others);
+            *col += (int)n;
+            p += n;
+            break;
+        }
+        *col += 16;
+        p += 16;
+    }
+#endif
+
+    while (p != end && (*p == ' ' || *p == '\r')) {
+        if (*p == ' ') ++*col;
+        ++p;
+    }
+    return p;
+}
+
+// Returns the first '=', ' ', '\r' or '\n' at or after p, or end if there is none.
+const char *bmfont__find_delimiter(const char *p, const char *end) {
+#ifdef CMP_BMFONT__SSE2
+    const __m128i equals = _mm_set1_epi8('=');
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i returns = _mm_set1_epi8('\r');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, equals), _mm_cmpeq_epi8(bytes, spaces)),
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, returns), _mm_cmpeq_epi8(bytes, newlines)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+        if (mask) return p + bmfont__lowest_bit(mask);
+        p += 16;
+    }
+#endif
+
+    while (p != end && *p != '=' && *p != ' ' && *p != '\r' && *p != '\n') ++p;
+    return p;
+}
+
 // TODO: handle '=' between quotes
 bool bmfont__load_next_token(BMFont__Parser *parser) {
     assert(bmfont__parser_ok(parser));
     if (bmfont__parser_ready(parser)) {
-        // Consume any whitespace
-        while (parser->next_char == ' ' || parser->next_char == '\r') {
-            if (parser->next_char == EOF) break;
-            if (parser->next_char == ' ') parser->curr_col++;
-            if (parser->next_char == '\n') {
-                parser->curr_col = 1;
-                parser->curr_line++;
-            }
-            parser->next_char = fgetc(parser->file);
-        }
+        const char *end = parser->end;
+        const char *p   = bmfont__skip_whitespace(parser->curr, end, &parser->curr_col);
 
         parser->start_col = parser->curr_col;
         parser->start_line = parser->curr_line;
 
-        if (parser->next_char == EOF) {
+        if (p == end) {
+            parser->curr = p;
+            parser->next_token = p;
+            parser->next_token_len = 0;
             parser->flags |= BMFONT__PARSER_EOF;
             return true;
         }
 
-        if (parser->next_char == '\n') {
+        parser->next_token = p;
+        CMP_BMFONT__COUNT_PARSE(parser, tokens, 1);
+
+        if (*p == '\n') {
             parser->curr_col = 1;
             parser->curr_line++;
-            strcpy(parser->next_token, "\n");
-            parser->next_char = fgetc(parser->file);
+            parser->next_token_len = 1;
+            parser->curr = p + 1;
             return true;
         }
 
-        if (parser->next_char == '=') {
+        if (*p == '=') {
             parser->curr_col++;
-            strcpy(parser->next_token, "=");
-            parser->next_char = fgetc(parser->file);
+            parser->next_token_len = 1;
+            parser->curr = p + 1;
             return true;
         }
 
-        int len = 0;
-        do {
-            parser->curr_col++;
-            parser->next_token[len++] = (char)parser->next_char;
-        } while ((parser->next_char = fgetc(parser->file)) != EOF && parser->next_char != '=' &&
-                 parser->next_char != ' ' && parser->next_char != '\r' &&
-                 parser->next_char != '\n' && len < BMFONT_MAX_TOKEN_LENGTH);
-
-        if (len == BMFONT_MAX_TOKEN_LENGTH) {
-            bmfont__set_parser_error(parser,
-                                     "Token length is too large to parse (line %d, col %d).",
-                                     parser->start_line,
-                                     parser->start_col);
-            return false;
-        }
+        p = bmfont__find_delimiter(p + 1, end);
 
-        parser->next_token[len] = '\0';
+        parser->next_token_len = (size_t)(p - parser->next_token);
+        parser->curr_col += (int)parser->next_token_len;
+        parser->curr = p;
     }
 
     return bmfont__parser_ok(parser);
@@ -246,7 +1841,7 @@ bool bmfont__expect_more_tokens(BMFont__Parser *parser) {
 
 bool bmfont__match_token_and_advance(BMFont__Parser *parser, const char *token) {
     if (!bmfont__expect_more_tokens(parser) || !bmfont__parser_ok(parser) ||
-        strcmp(parser->next_token, token)) {
+        !bmfont__token_equals(parser, token)) {
         return false;
     }
     return bmfont__load_next_token(parser);
@@ -256,9 +1851,10 @@ bool bmfont__expect_token_and_advance(BMFont__Parser *parser, const char *token)
     if (!bmfont__match_token_and_advance(parser, token)) {
         if (!(parser->flags & BMFONT__PARSER_EOF)) {
             bmfont__set_parser_error(parser,
-                                     "Unexpected token (line %d, col %d): %s. Expected token: %s",
+                                     "Unexpected token (line %d, col %d): %.*s. Expected token: %s",
                                      parser->start_line,
                                      parser->start_col,
+                                     bmfont__token_print_len(parser),
                                      parser->next_token,
                                      token);
         }
@@ -269,47 +1865,68 @@ bool bmfont__expect_token_and_advance(BMFont__Parser *parser, const char *token)
 }
 
 bool bmfont__match_key_and_advance_to_value(BMFont__Parser *parser, const char *token) {
-    return !strcmp(parser->next_token, token) &&
+    return bmfont__token_equals(parser, token) &&
         bmfont__load_next_token(parser) &&
         bmfont__match_token_and_advance(parser, "=");
 }
 
-bool bmfont__get_token_as_long(BMFont__Parser *parser, int64_t *dest) {
-    if (!bmfont__expect_more_tokens(parser)) return false;
-    char *end_ptr;
-    int64_t long_value = strtol(parser->next_token, &end_ptr, 0);
-    if (*end_ptr != '\0') {
-        bmfont__set_parser_error(parser,
-                                 "Expected an integer value (line %d, col %d). Got: %s",
-                                 parser->start_line,
-                                 parser->start_col,
-                                 parser->next_token);
-        return false;
+// Parses a token made of an optional sign and up to 18 decimal digits, the form every value in
+// files written by BMFont takes. Returns false for anything else, e.g. hex or octal, which is left
+// to strtoll.
+bool bmfont__parse_decimal(const char *p, size_t len, int64_t *dest) {
+    size_t i = 0;
+    bool negative = false;
+    if (len && (p[0] == '-' || p[0] == '+')) {
+        negative = p[0] == '-';
+        i = 1;
     }
+    if (i == len || len - i > 18 || (p[i] == '0' && len - i > 1)) return false;
 
-    *dest = long_value;
+    int64_t value = 0;
+    for (; i < len; ++i) {
+        unsigned digit = (unsigned)(uint8_t)p[i] - '0';
+        if (digit > 9) return false;
+        value = value * 10 + digit;
+    }
+    *dest = negative ? -value : value;
     return true;
 }
 
-bool bmfont__do_get_token_as_int_and_advance(BMFont__Parser *parser, int64_t min, int64_t max, int64_t *dest) {
+bool bmfont__do_get_token_as_int_and_advance(BMFont__Parser *parser,
+                                             int64_t         min,
+                                             int64_t         max,
+                                             int64_t *       dest) {
     if (!bmfont__expect_more_tokens(parser)) return false;
-    char *end_ptr;
-    int64_t long_value = strtol(parser->next_token, &end_ptr, 0);
-    if (*end_ptr != '\0') {
+
+    // The token is not NUL terminated, so copy it out before handing it to strtoll. Anything that
+    // does not fit is too long to be a valid integer anyway.
+    char buf[32];
+    size_t len = parser->next_token_len;
+    int64_t long_value = 0;
+    bool valid = bmfont__parse_decimal(parser->next_token, len, &long_value);
+    if (!valid && len > 0 && len < sizeof(buf)) {
+        char *end_ptr;
+        memcpy(buf, parser->next_token, len);
+        buf[len] = '\0';
+        long_value = strtoll(buf, &end_ptr, 0);
+        valid = *end_ptr == '\0';
+    }
+    if (!valid) {
         bmfont__set_parser_error(parser,
-                                 "Expected an integer value (line %d, col %d). Got: %s",
+                                 "Expected an integer value (line %d, col %d). Got: %.*s",
                                  parser->start_line,
                                  parser->start_col,
+                                 bmfont__token_print_len(parser),
                                  parser->next_token);
         return false;
     }
 
     if (long_value < min || long_value > max) {
         bmfont__set_parser_error(parser,
-                                 "Integer value out of range (line %d, col %d). Got: %ld",
+                                 "Integer value out of range (line %d, col %d). Got: %lld",
                                  parser->start_line,
                                  parser->start_col,
-                                 long_value);
+                                 (long long)long_value);
         return false;
     }
 
@@ -326,10 +1943,19 @@ bool bmfont__get_token_as_int_and_advance(BMFont__Parser *parser, int16_t *dest)
     return false;
 }
 
+bool bmfont__get_token_as_int_and_advance(BMFont__Parser *parser, uint8_t *dest) {
+    int64_t long_value;
+    if (bmfont__do_get_token_as_int_and_advance(parser, 0, 255, &long_value)) {
+        *dest = (uint8_t)long_value;
+        return true;
+    }
+    return false;
+}
+
 bool bmfont__get_token_as_int_and_advance(BMFont__Parser *parser, uint16_t *dest) {
     int64_t long_value;
     if (bmfont__do_get_token_as_int_and_advance(parser, 0, 65535, &long_value)) {
-        *dest = (int16_t)long_value;
+        *dest = (uint16_t)long_value;
         return true;
     }
     return false;
@@ -338,7 +1964,17 @@ bool bmfont__get_token_as_int_and_advance(BMFont__Parser *parser, uint16_t *dest
 bool bmfont__get_token_as_int_and_advance(BMFont__Parser *parser, uint32_t *dest) {
     int64_t long_value;
     if (bmfont__do_get_token_as_int_and_advance(parser, 0, 4294967295, &long_value)) {
-        *dest = (int16_t)long_value;
+        *dest = (uint32_t)long_value;
+        return true;
+    }
+    return false;
+}
+
+// Reads the number of pages, chars or kernings.
+bool bmfont__get_token_as_count_and_advance(BMFont__Parser *parser, uint32_t *dest) {
+    int64_t long_value;
+    if (bmfont__do_get_token_as_int_and_advance(parser, 0, BMFONT_MAX_COUNT, &long_value)) {
+        *dest = (uint32_t)long_value;
         return true;
     }
     return false;
@@ -346,31 +1982,159 @@ bool bmfont__get_token_as_int_and_advance(BMFont__Parser *parser, uint32_t *dest
 
 bool bmfont__copy_token_and_advance(BMFont__Parser *parser, char **dest) {
     if (!bmfont__expect_more_tokens(parser)) return false;
-    *dest = strdup(parser->next_token);
+
+    *dest = (char *)bmfont__arena_push(parser->arena, parser->next_token_len + 1);
+    if (*dest) memcpy(*dest, parser->next_token, parser->next_token_len);
     return bmfont__load_next_token(parser);
 }
 
 bool bmfont__copy_quoted_token_and_advance(BMFont__Parser *parser, char **dest) {
     if (!bmfont__expect_more_tokens(parser)) return false;
 
-    size_t len = strlen(parser->next_token);
+    size_t len = parser->next_token_len;
     if (len < 2 || parser->next_token[0] != '"' || parser->next_token[len - 1] != '"') {
         bmfont__set_parser_error(parser,
-                                 "Expected quoted string (line %d, col %d). Got: %s",
+                                 "Expected quoted string (line %d, col %d). Got: %.*s",
                                  parser->start_line,
                                  parser->start_col,
+                                 bmfont__token_print_len(parser),
                                  parser->next_token);
         return false;
     }
 
-    *dest = (char *)bmfont__calloc((int)len - 2, sizeof(char *));
-    if (!dest) {
-        parser->flags &= ~BMFONT__PARSER_OK;
-        return false;
+    *dest = (char *)bmfont__arena_push(parser->arena, len - 1);
+    if (*dest) memcpy(*dest, parser->next_token + 1, len - 2);
+    return bmfont__load_next_token(parser);
+}
+
+// Skips past the newline that ends the current line without tokenizing anything in between. Used
+// by the measuring pass, which only needs to count records.
+void bmfont__skip_line(BMFont__Parser *parser) {
+    if (!bmfont__parser_ready(parser)) return;
+
+    if (!bmfont__token_equals(parser, "\n")) {
+        size_t remaining = (size_t)(parser->end - parser->curr);
+        const char *nl = (const char *)memchr(parser->curr, '\n', remaining);
+        parser->curr = nl ? nl : parser->end;
+        bmfont__load_next_token(parser);
     }
+    if (bmfont__parser_ready(parser)) bmfont__match_token_and_advance(parser, "\n");
+}
 
-    strncpy(*dest, parser->next_token + 1, len - 2);
-    return bmfont__load_next_token(parser);
+// Char and kerning lines, which make up nearly all of a file, first go through a fast path that
+// reads "key=value" pairs straight from the buffer. It handles lines the way BMFont writes them,
+// with decimal values. Anything else, including every error, makes it give up without moving the
+// parser, and the line is parsed again token by token so that errors are reported as usual.
+
+static constexpr int BMFONT__FIELD_UNSUPPORTED = -1;
+static constexpr int BMFONT__FIELD_END         = 0;
+static constexpr int BMFONT__FIELD_PAIR        = 1;
+
+struct BMFont__Field {
+    const char *key;
+    const char *value;
+    size_t      key_len;
+    size_t      value_len;
+};
+
+// Reads the next pair of a record line on the fast path. Returns BMFONT__FIELD_END with *p at the
+// newline once the line is done.
+int bmfont__next_field(const char **p, const char *end, BMFont__Field *field) {
+    int col = 0;
+    const char *q = bmfont__skip_whitespace(*p, end, &col);
+    if (q == end) return BMFONT__FIELD_UNSUPPORTED;
+    if (*q == '\n') {
+        *p = q;
+        return BMFONT__FIELD_END;
+    }
+
+    field->key = q;
+    q = bmfont__find_delimiter(q, end);
+    if (q == end || *q != '=' || q == field->key) return BMFONT__FIELD_UNSUPPORTED;
+    field->key_len = (size_t)(q - field->key);
+
+    field->value = ++q;
+    q = bmfont__find_delimiter(q, end);
+    if (q == end || *q == '=' || q == field->value) return BMFONT__FIELD_UNSUPPORTED;
+    field->value_len = (size_t)(q - field->value);
+
+    *p = q;
+    return BMFONT__FIELD_PAIR;
+}
+
+bool bmfont__field_is(const BMFont__Field *field, const char *key, size_t len) {
+    return field->key_len == len && !memcmp(field->key, key, len);
+}
+
+bool bmfont__do_get_field_as_int(const BMFont__Field *field,
+                                 int64_t              min,
+                                 int64_t              max,
+                                 int64_t *            dest) {
+    return bmfont__parse_decimal(field->value, field->value_len, dest) && *dest >= min &&
+        *dest <= max;
+}
+
+bool bmfont__get_field_as_int(const BMFont__Field *field, int16_t *dest) {
+    int64_t long_value;
+    if (!bmfont__do_get_field_as_int(field, -32768, 32767, &long_value)) return false;
+    *dest = (int16_t)long_value;
+    return true;
+}
+
+bool bmfont__get_field_as_int(const BMFont__Field *field, uint8_t *dest) {
+    int64_t long_value;
+    if (!bmfont__do_get_field_as_int(field, 0, 255, &long_value)) return false;
+    *dest = (uint8_t)long_value;
+    return true;
+}
+
+bool bmfont__get_field_as_int(const BMFont__Field *field, uint16_t *dest) {
+    int64_t long_value;
+    if (!bmfont__do_get_field_as_int(field, 0, 65535, &long_value)) return false;
+    *dest = (uint16_t)long_value;
+    return true;
+}
+
+bool bmfont__get_field_as_int(const BMFont__Field *field, uint32_t *dest) {
+    int64_t long_value;
+    if (!bmfont__do_get_field_as_int(field, 0, 4294967295, &long_value)) return false;
+    *dest = (uint32_t)long_value;
+    return true;
+}
+
+// Moves the parser to the token after the newline at p, which ends a line the fast path has read.
+void bmfont__finish_fast_line(BMFont__Parser *parser, const char *newline) {
+    CMP_BMFONT__COUNT_PARSE(parser, fast_lines, 1);
+    parser->curr = newline;
+    bmfont__load_next_token(parser);
+    bmfont__match_token_and_advance(parser, "\n");
+}
+
+// Skips up to count record lines that start with tag, which is all the measuring pass needs to do
+// with them, by looking only for the newlines. Stops at the first line that doesn't start with the
+// tag and a space, or has no newline, and leaves it to the token parser. Returns the number of
+// lines skipped.
+uint32_t bmfont__skip_records(BMFont__Parser *parser, const char *tag, uint32_t count) {
+    if (!bmfont__parser_ready(parser)) return 0;
+
+    size_t len = strlen(tag);
+    const char *p = parser->next_token;
+    const char *end = parser->end;
+    uint32_t skipped = 0;
+    while (skipped < count && (size_t)(end - p) > len && !memcmp(p, tag, len) && p[len] == ' ') {
+        const char *newline = (const char *)memchr(p + len, '\n', (size_t)(end - p) - len);
+        if (!newline) break;
+        p = newline + 1;
+        ++skipped;
+    }
+
+    if (skipped) {
+        parser->curr = p;
+        parser->curr_line = parser->start_line + (int)skipped;
+        parser->curr_col = 1;
+        bmfont__load_next_token(parser);
+    }
+    return skipped;
 }
 
 bool bmfont__parse_info(BMFont__Parser *parser, BMFont *font) {
@@ -382,6 +2146,7 @@ bool bmfont__parse_info(BMFont__Parser *parser, BMFont *font) {
         } else if (bmfont__match_key_and_advance_to_value(parser, "size")) {
             bmfont__get_token_as_int_and_advance(parser, &font->font_size);
         } else {
+            CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, !bmfont__token_equals(parser, "="));
             bmfont__match_token_and_advance(parser, "=");
             bmfont__load_next_token(parser);
         }
@@ -403,10 +2168,21 @@ bool bmfont__parse_common(BMFont__Parser *parser, BMFont *font) {
         } else if (bmfont__match_key_and_advance_to_value(parser, "scaleH")) {
             bmfont__get_token_as_int_and_advance(parser, &font->scale_h);
         } else if (bmfont__match_key_and_advance_to_value(parser, "pages")) {
-            bmfont__get_token_as_int_and_advance(parser, &font->num_pages);
-            font->page_names = (char **)bmfont__calloc(font->num_pages, sizeof(char *));
-            if (!font->page_names) parser->flags &= ~BMFONT__PARSER_OK;
+            bmfont__get_token_as_count_and_advance(parser, &font->num_pages);
+            font->page_names =
+                    (char **)bmfont__arena_push(parser->arena, font->num_pages * sizeof(char *));
+        } else if (bmfont__match_key_and_advance_to_value(parser, "packed")) {
+            bmfont__get_token_as_int_and_advance(parser, &font->packed);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "alphaChnl")) {
+            bmfont__get_token_as_int_and_advance(parser, &font->alpha_channel);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "redChnl")) {
+            bmfont__get_token_as_int_and_advance(parser, &font->red_channel);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "greenChnl")) {
+            bmfont__get_token_as_int_and_advance(parser, &font->green_channel);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "blueChnl")) {
+            bmfont__get_token_as_int_and_advance(parser, &font->blue_channel);
         } else {
+            CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, !bmfont__token_equals(parser, "="));
             bmfont__match_token_and_advance(parser, "=");
             bmfont__load_next_token(parser);
         }
@@ -415,248 +2191,3754 @@ bool bmfont__parse_common(BMFont__Parser *parser, BMFont *font) {
     return bmfont__parser_ok(parser);
 }
 
-bool bmfont__parse_pages(BMFont__Parser *parser, BMFont *font) {
-    int i;
-    for (i = 0; i < font->num_pages && bmfont__match_token_and_advance(parser, "page"); ++i) {
-        uint32_t id = 0;
-        char *filename = nullptr;
-
-        while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
-            if (bmfont__match_key_and_advance_to_value(parser, "id")) {
-                bmfont__get_token_as_int_and_advance(parser, &id);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "file")) {
-                bmfont__copy_quoted_token_and_advance(parser, &filename);
-            } else {
-                bmfont__match_token_and_advance(parser, "=");
-                bmfont__load_next_token(parser);
-            }
-        }
+void bmfont__set_count_error(BMFont__Parser *parser,
+                             const char *    what,
+                             uint32_t        expected,
+                             uint32_t        actual) {
+    bmfont__set_parser_error(parser,
+                             "Fewer %s than specified in file. Expected: %u, actual: %u",
+                             what,
+                             expected,
+                             actual);
+}
 
-        if (filename == nullptr) {
-            bmfont__set_parser_error(parser,
-                                     "Page tag missing filename (line %d)",
-                                     parser->start_line);
+// Parses the rest of a page line, after the "page" tag.
+bool bmfont__parse_page(BMFont__Parser *parser, BMFont *font) {
+    uint32_t id = 0;
+    char *filename = nullptr;
+    bool has_filename = false;
+    int line = parser->start_line;
 
-            if (filename) free(filename);
-            return false;
+    while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
+        if (bmfont__match_key_and_advance_to_value(parser, "id")) {
+            bmfont__get_token_as_int_and_advance(parser, &id);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "file")) {
+            has_filename = bmfont__copy_quoted_token_and_advance(parser, &filename);
+        } else {
+            CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, !bmfont__token_equals(parser, "="));
+            bmfont__match_token_and_advance(parser, "=");
+            bmfont__load_next_token(parser);
         }
+    }
+
+    if (!bmfont__parser_ok(parser)) return false;
 
-        font->page_names[id] = filename;
+    if (!has_filename) {
+        bmfont__set_parser_error(parser, "Page tag missing filename (line %d)", line);
+        return false;
     }
 
-    if (i != font->num_pages) {
+    if (id >= font->num_pages) {
         bmfont__set_parser_error(parser,
-                                 "Fewer pages than specified in file. Expected: %d, actual: "
-                                 "%d",
-                                 font->num_pages,
-                                 i);
+                                 "Page id out of range (line %d). Got: %u, pages: %u",
+                                 line,
+                                 (unsigned)id,
+                                 font->num_pages);
+        return false;
+    }
+
+    if (font->page_names) font->page_names[id] = filename;
+    return true;
+}
+
+bool bmfont__parse_pages(BMFont__Parser *parser, BMFont *font) {
+    uint32_t i;
+    for (i = 0; i < font->num_pages && bmfont__match_token_and_advance(parser, "page"); ++i) {
+        if (!bmfont__parse_page(parser, font)) return false;
     }
 
+    if (i != font->num_pages) bmfont__set_count_error(parser, "pages", font->num_pages, i);
+
     return bmfont__parser_ok(parser);
 }
 
-bool bmfont__parse_chars(BMFont__Parser *parser, BMFont *font) {
+// Parses the "chars" line and reserves space for the chars it announces.
+bool bmfont__parse_chars_header(BMFont__Parser *parser, BMFont *font) {
     if (!bmfont__expect_token_and_advance(parser, "chars")) return false;
 
     while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
         if (bmfont__match_key_and_advance_to_value(parser, "count")) {
-            if (bmfont__get_token_as_int_and_advance(parser, &font->num_chars)) {
-                font->chars = (BMFont::Char *)bmfont__calloc(font->num_chars, sizeof(BMFont::Char));
-                if (!font->chars) parser->flags &= ~BMFONT__PARSER_OK;
+            if (bmfont__get_token_as_count_and_advance(parser, &font->num_chars)) {
+                font->chars = (BMFont::Char *)bmfont__arena_push(
+                        parser->arena, font->num_chars * sizeof(BMFont::Char));
+                if (font->_source) {
+                    font->_char_offsets = (uint32_t *)bmfont__arena_push(
+                            parser->arena, font->num_chars * sizeof(uint32_t));
+                }
             }
         } else {
+            CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, !bmfont__token_equals(parser, "="));
             bmfont__match_token_and_advance(parser, "=");
             bmfont__load_next_token(parser);
         }
     }
 
-    int i;
-    for (i = 0; i < font->num_chars && bmfont__match_token_and_advance(parser, "char"); ++i) {
-        BMFont::Char *ch = &font->chars[i];
-        while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
-            if (bmfont__match_key_and_advance_to_value(parser, "id")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->id);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "x")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->x);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "y")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->y);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "width")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->width);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "height")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->height);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "xoffset")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->x_offset);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "yoffset")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->y_offset);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "xadvance")) {
-                bmfont__get_token_as_int_and_advance(parser, &ch->x_advance);
+    return bmfont__parser_ok(parser);
+}
+
+// Fast path for bmfont__parse_char. Keys are dispatched on their length first.
+bool bmfont__parse_char_fast(BMFont__Parser *parser, BMFont::Char *ch) {
+    if (!bmfont__parser_ready(parser)) return false;
+
+    const char *p = parser->next_token;
+    BMFont__Field field;
+    int status;
+    uint32_t unknown_keys = 0; // Only used for stats
+    while ((status = bmfont__next_field(&p, parser->end, &field)) == BMFONT__FIELD_PAIR) {
+        bool ok = true;
+        bool known = true;
+        switch (field.key_len) {
+        case 1:
+            if (field.key[0] == 'x') ok = bmfont__get_field_as_int(&field, &ch->x);
+            else if (field.key[0] == 'y') ok = bmfont__get_field_as_int(&field, &ch->y);
+            else known = false;
+            break;
+        case 2:
+            if (bmfont__field_is(&field, "id", 2)) ok = bmfont__get_field_as_int(&field, &ch->id);
+            else known = false;
+            break;
+        case 4:
+            if (bmfont__field_is(&field, "page", 4)) {
+                ok = bmfont__get_field_as_int(&field, &ch->page);
+            } else if (bmfont__field_is(&field, "chnl", 4)) {
+                ok = bmfont__get_field_as_int(&field, &ch->channel);
+            } else {
+                known = false;
+            }
+            break;
+        case 5:
+            if (bmfont__field_is(&field, "width", 5)) {
+                ok = bmfont__get_field_as_int(&field, &ch->width);
             } else {
-                bmfont__match_token_and_advance(parser, "=");
-                bmfont__load_next_token(parser);
+                known = false;
             }
+            break;
+        case 6:
+            if (bmfont__field_is(&field, "height", 6)) {
+                ok = bmfont__get_field_as_int(&field, &ch->height);
+            } else {
+                known = false;
+            }
+            break;
+        case 7:
+            if (bmfont__field_is(&field, "xoffset", 7)) {
+                ok = bmfont__get_field_as_int(&field, &ch->x_offset);
+            } else if (bmfont__field_is(&field, "yoffset", 7)) {
+                ok = bmfont__get_field_as_int(&field, &ch->y_offset);
+            } else {
+                known = false;
+            }
+            break;
+        case 8:
+            if (bmfont__field_is(&field, "xadvance", 8)) {
+                ok = bmfont__get_field_as_int(&field, &ch->x_advance);
+            } else {
+                known = false;
+            }
+            break;
+        default:
+            known = false;
+            break;
         }
+        if (!ok) return false;
+        unknown_keys += !known;
     }
+    if (status != BMFONT__FIELD_END) return false;
 
-    if (i != font->num_chars) {
-        bmfont__set_parser_error(parser,
-                                 "Fewer chars than specified in file. Expected: %d, actual: %d",
-                                 font->num_chars,
-                                 i);
+    CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, unknown_keys);
+    (void)unknown_keys;
+    bmfont__finish_fast_line(parser, p);
+    return true;
+}
+
+// Parses the rest of a char line, after the "char" tag.
+bool bmfont__parse_char(BMFont__Parser *parser, BMFont::Char *ch) {
+    if (bmfont__parse_char_fast(parser, ch)) return true;
+
+    while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
+        if (bmfont__match_key_and_advance_to_value(parser, "id")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->id);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "x")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->x);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "y")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->y);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "width")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->width);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "height")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->height);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "xoffset")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->x_offset);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "yoffset")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->y_offset);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "xadvance")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->x_advance);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "page")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->page);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "chnl")) {
+            bmfont__get_token_as_int_and_advance(parser, &ch->channel);
+        } else {
+            CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, !bmfont__token_equals(parser, "="));
+            bmfont__match_token_and_advance(parser, "=");
+            bmfont__load_next_token(parser);
+        }
     }
 
     return bmfont__parser_ok(parser);
 }
 
-bool bmfont__parse_kernings(BMFont__Parser *parser, BMFont *font) {
-    // We treat kerning as optional
-    if (!bmfont__parser_ready(parser)) {
-        font->kernings = (BMFont::Kerning *)bmfont__calloc(0, sizeof(BMFont::Kerning));
-        return false;
+// Offset of the current token in the source text of a lazily loaded font.
+uint32_t bmfont__lazy_offset(BMFont__Parser *parser, const BMFont *font) {
+    return (uint32_t)(parser->next_token - font->_source);
+}
+
+// Lazy counterpart of bmfont__parse_char. When the line starts with the id, as it does in files
+// written by BMFont, only the id is read and the line is left for bmfont__load_lazy_char.
+// Otherwise the line is parsed in full.
+bool bmfont__parse_lazy_char(BMFont__Parser *parser, BMFont *font, uint32_t i) {
+    uint32_t offset = bmfont__lazy_offset(parser, font);
+    BMFont::Char *ch = &font->chars[i];
+
+    const char *p = parser->next_token;
+    const char *newline;
+    BMFont__Field field;
+    if (bmfont__parser_ready(parser) &&
+        bmfont__next_field(&p, parser->end, &field) == BMFONT__FIELD_PAIR &&
+        bmfont__field_is(&field, "id", 2) && bmfont__get_field_as_int(&field, &ch->id) &&
+        (newline = (const char *)memchr(p, '\n', (size_t)(parser->end - p))) != nullptr) {
+        font->_char_offsets[i] = offset;
+        bmfont__finish_fast_line(parser, newline);
+        return true;
+    }
+
+    if (!bmfont__match_key_and_advance_to_value(parser, "id")) {
+        return bmfont__parser_ok(parser) && bmfont__parse_char(parser, ch);
+    }
+
+    if (!bmfont__get_token_as_int_and_advance(parser, &ch->id)) return false;
+    font->_char_offsets[i] = offset;
+    bmfont__skip_line(parser);
+    return bmfont__parser_ok(parser);
+}
+
+bool bmfont__parse_chars(BMFont__Parser *parser, BMFont *font) {
+    if (!bmfont__parse_chars_header(parser, font)) return false;
+
+    uint32_t i = 0;
+    if (bmfont__arena_measuring(parser->arena)) {
+        i = bmfont__skip_records(parser, "char", font->num_chars);
+    }
+    for (; i < font->num_chars && bmfont__match_token_and_advance(parser, "char"); ++i) {
+        if (bmfont__arena_measuring(parser->arena)) {
+            bmfont__skip_line(parser);
+        } else if (font->_source) {
+            if (!bmfont__parse_lazy_char(parser, font, i)) return false;
+        } else if (!bmfont__parse_char(parser, &font->chars[i])) {
+            return false;
+        }
     }
 
+    if (i != font->num_chars) bmfont__set_count_error(parser, "chars", font->num_chars, i);
+
+    return bmfont__parser_ok(parser);
+}
+
+// Parses the "kernings" line and reserves space for the kernings it announces.
+bool bmfont__parse_kernings_header(BMFont__Parser *parser, BMFont *font) {
     bmfont__expect_token_and_advance(parser, "kernings");
 
     while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
         if (bmfont__match_key_and_advance_to_value(parser, "count")) {
-            if (bmfont__get_token_as_int_and_advance(parser, &font->num_kernings)) {
-                font->kernings = (BMFont::Kerning *)bmfont__calloc(font->num_kernings, sizeof(BMFont::Kerning));
-                if (!font->kernings) parser->flags &= ~BMFONT__PARSER_OK;
+            if (bmfont__get_token_as_count_and_advance(parser, &font->num_kernings)) {
+                font->kernings = (BMFont::Kerning *)bmfont__arena_push(
+                        parser->arena, font->num_kernings * sizeof(BMFont::Kerning));
+                if (font->_source) {
+                    font->_kerning_offsets = (uint32_t *)bmfont__arena_push(
+                            parser->arena, font->num_kernings * sizeof(uint32_t));
+                }
             }
         } else {
+            CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, !bmfont__token_equals(parser, "="));
             bmfont__match_token_and_advance(parser, "=");
             bmfont__load_next_token(parser);
         }
     }
 
-    int i;
-    for (i = 0; i < font->num_kernings && bmfont__match_token_and_advance(parser, "kerning"); ++i) {
-        BMFont::Kerning *kerning = &font->kernings[i];
-        while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
-            if (bmfont__match_key_and_advance_to_value(parser, "first")) {
-                bmfont__get_token_as_int_and_advance(parser, &kerning->first);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "second")) {
-                bmfont__get_token_as_int_and_advance(parser, &kerning->second);
-            } else if (bmfont__match_key_and_advance_to_value(parser, "amount")) {
-                bmfont__get_token_as_int_and_advance(parser, &kerning->amount);
-            } else {
-                bmfont__match_token_and_advance(parser, "=");
-                bmfont__load_next_token(parser);
-            }
+    return bmfont__parser_ok(parser);
+}
+
+// Fast path for bmfont__parse_kerning.
+bool bmfont__parse_kerning_fast(BMFont__Parser *parser, BMFont::Kerning *kerning) {
+    if (!bmfont__parser_ready(parser)) return false;
+
+    const char *p = parser->next_token;
+    BMFont__Field field;
+    int status;
+    uint32_t unknown_keys = 0; // Only used for stats
+    while ((status = bmfont__next_field(&p, parser->end, &field)) == BMFONT__FIELD_PAIR) {
+        bool ok = true;
+        if (bmfont__field_is(&field, "first", 5)) {
+            ok = bmfont__get_field_as_int(&field, &kerning->first);
+        } else if (bmfont__field_is(&field, "second", 6)) {
+            ok = bmfont__get_field_as_int(&field, &kerning->second);
+        } else if (bmfont__field_is(&field, "amount", 6)) {
+            ok = bmfont__get_field_as_int(&field, &kerning->amount);
+        } else {
+            unknown_keys++;
+        }
+        if (!ok) return false;
+    }
+    if (status != BMFONT__FIELD_END) return false;
+
+    CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, unknown_keys);
+    (void)unknown_keys;
+    bmfont__finish_fast_line(parser, p);
+    return true;
+}
+
+// Parses the rest of a kerning line, after the "kerning" tag.
+bool bmfont__parse_kerning(BMFont__Parser *parser, BMFont::Kerning *kerning) {
+    if (bmfont__parse_kerning_fast(parser, kerning)) return true;
+
+    while (bmfont__parser_ready(parser) && !bmfont__match_token_and_advance(parser, "\n")) {
+        if (bmfont__match_key_and_advance_to_value(parser, "first")) {
+            bmfont__get_token_as_int_and_advance(parser, &kerning->first);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "second")) {
+            bmfont__get_token_as_int_and_advance(parser, &kerning->second);
+        } else if (bmfont__match_key_and_advance_to_value(parser, "amount")) {
+            bmfont__get_token_as_int_and_advance(parser, &kerning->amount);
+        } else {
+            CMP_BMFONT__COUNT_PARSE(parser, unknown_keys, !bmfont__token_equals(parser, "="));
+            bmfont__match_token_and_advance(parser, "=");
+            bmfont__load_next_token(parser);
         }
+    }
+
+    return bmfont__parser_ok(parser);
+}
+
+// Lazy counterpart of bmfont__parse_kerning. Reads the pair when it comes first on the line and
+// leaves the amount for bmfont__load_lazy_kerning.
+bool bmfont__parse_lazy_kerning(BMFont__Parser *parser, BMFont *font, uint32_t i) {
+    uint32_t offset = bmfont__lazy_offset(parser, font);
+    BMFont::Kerning *kerning = &font->kernings[i];
+
+    const char *p = parser->next_token;
+    const char *newline;
+    BMFont__Field first, second;
+    if (bmfont__parser_ready(parser) &&
+        bmfont__next_field(&p, parser->end, &first) == BMFONT__FIELD_PAIR &&
+        bmfont__next_field(&p, parser->end, &second) == BMFONT__FIELD_PAIR &&
+        bmfont__field_is(&first, "first", 5) && bmfont__field_is(&second, "second", 6) &&
+        bmfont__get_field_as_int(&first, &kerning->first) &&
+        bmfont__get_field_as_int(&second, &kerning->second) &&
+        (newline = (const char *)memchr(p, '\n', (size_t)(parser->end - p))) != nullptr) {
+        font->_kerning_offsets[i] = offset;
+        bmfont__finish_fast_line(parser, newline);
+        return true;
+    }
+
+    if (!bmfont__match_key_and_advance_to_value(parser, "first") ||
+        !bmfont__get_token_as_int_and_advance(parser, &kerning->first) ||
+        !bmfont__match_key_and_advance_to_value(parser, "second")) {
+        return bmfont__parser_ok(parser) && bmfont__parse_kerning(parser, kerning);
+    }
 
-        ++kerning;
+    if (!bmfont__get_token_as_int_and_advance(parser, &kerning->second)) return false;
+    font->_kerning_offsets[i] = offset;
+    bmfont__skip_line(parser);
+    return bmfont__parser_ok(parser);
+}
+
+bool bmfont__parse_kernings(BMFont__Parser *parser, BMFont *font) {
+    // We treat kerning as optional
+    if (!bmfont__parser_ready(parser)) return false;
+
+    if (!bmfont__parse_kernings_header(parser, font)) return false;
+
+    uint32_t i = 0;
+    if (bmfont__arena_measuring(parser->arena)) {
+        i = bmfont__skip_records(parser, "kerning", font->num_kernings);
+    }
+    for (; i < font->num_kernings && bmfont__match_token_and_advance(parser, "kerning"); ++i) {
+        if (bmfont__arena_measuring(parser->arena)) {
+            bmfont__skip_line(parser);
+        } else if (font->_source) {
+            if (!bmfont__parse_lazy_kerning(parser, font, i)) return false;
+        } else if (!bmfont__parse_kerning(parser, &font->kernings[i])) {
+            return false;
+        }
     }
 
     if (i != font->num_kernings) {
-        bmfont__set_parser_error(parser,
-                                 "Fewer kernings than specified in file. Expected: %d, actual: %d",
-                                 font->num_kernings,
-                                 i);
+        bmfont__set_count_error(parser, "kernings", font->num_kernings, i);
     }
 
     return bmfont__parser_ok(parser);
 }
 
-BMFont *bmfont_parse_file(const char *filename)
-{
-    strcpy(bmfont__error, "Success");
+static constexpr uint8_t BMFONT__FILE_MAP_NONE   = 0;
+static constexpr uint8_t BMFONT__FILE_MAP_MAPPED = 1;
+static constexpr uint8_t BMFONT__FILE_MAP_HEAP   = 2;
 
+// Set on fonts whose _mapping was read into a heap block rather than memory mapped.
+static constexpr uint32_t BMFONT__FONT_MAPPED_HEAP = 0x0001;
+
+// A read-only view of a whole file. Uses mmap / MapViewOfFile where available and falls back to
+// reading the file into a heap block otherwise (or when CMP_BMFONT_NO_MMAP is defined).
+struct BMFont__FileMap {
+    const char *data;
+    size_t      size;
+    uint8_t     kind;
+    uint8_t     _padding[7];
+};
+
+bool bmfont__read_file(const char *           filename,
+                       BMFont__FileMap *      map,
+                       const BMFontAllocator *allocator,
+                       BMFontResult *         result) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        snprintf(bmfont__error,
-                 sizeof(bmfont__error),
-                 "Couldn't open file: %s. Error: %s",
+        bmfont__set_error(result, "Couldn't open file: %s. Error: %s",
                  filename,
                  strerror(errno));
-        return nullptr;
+        return false;
     }
     CMP_BMFONT__DEFER { fclose(file); };
 
-    BMFont__Parser parser = {};
-    parser.file = file;
-    parser.curr_line = 1;
-    parser.curr_col = 1;
-    parser.next_char = fgetc(file);
-    parser.flags = BMFONT__PARSER_OK;
-    bmfont__load_next_token(&parser);
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) size = ftell(file);
+    if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        bmfont__set_error(result, "Couldn't read file: %s. Error: %s",
+                 filename,
+                 strerror(errno));
+        return false;
+    }
 
-    BMFont *font = (BMFont *)bmfont__calloc(1, sizeof(BMFont));
-    if (!font) return nullptr;
+    char *data = (char *)bmfont__alloc(allocator, (size_t)size + 1, result);
+    if (!data) return false;
+
+    if (fread(data, 1, (size_t)size, file) != (size_t)size) {
+        bmfont__set_error(result, "Couldn't read file: %s", filename);
+        allocator->free(data, allocator->user);
+        return false;
+    }
 
-    bmfont__parse_info(&parser, font) && bmfont__parse_common(&parser, font) &&
-        bmfont__parse_pages(&parser, font) && bmfont__parse_chars(&parser, font) &&
-        bmfont__parse_kernings(&parser, font);
+    map->data = data;
+    map->size = (size_t)size;
+    map->kind = BMFONT__FILE_MAP_HEAP;
+    return true;
+}
 
-    if (!bmfont__parser_ok(&parser)) {
-        bmfont_free(font);
-        return nullptr;
+bool bmfont__map_file(const char *           filename,
+                      BMFont__FileMap *      map,
+                      const BMFontAllocator *allocator,
+                      BMFontResult *         result) {
+    *map = {};
+
+#if defined(CMP_BMFONT__WINDOWS_MMAP)
+    HANDLE file = CreateFileA(filename,
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              nullptr,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        bmfont__set_error(result, "Couldn't open file: %s. Error: %lu",
+                 filename,
+                 (unsigned long)GetLastError());
+        return false;
     }
+    CMP_BMFONT__DEFER { CloseHandle(file); };
 
-    if (!(parser.flags & BMFONT__PARSER_EOF)) {
-        bmfont__set_parser_error(&parser,
-                                 "Expected EOF (line %d, col %d). Got: %s",
-                                 parser.start_line,
-                                 parser.start_col,
-                                 parser.next_token);
-        bmfont_free(font);
-        return nullptr;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) return bmfont__read_file(filename, map, allocator, result);
+    if (size.QuadPart == 0) {
+        map->data = "";
+        return true;
     }
 
-    return font;
-}
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) return bmfont__read_file(filename, map, allocator, result);
+    CMP_BMFONT__DEFER { CloseHandle(mapping); };
 
-void bmfont_free(BMFont *font) {
-    if (font->font_name) free(font->font_name);
-    if (font->page_names) {
-        for (int i = 0; i < font->num_pages; ++i) {
-            free(font->page_names[i]);
-        }
-        free(font->page_names);
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) return bmfont__read_file(filename, map, allocator, result);
+
+    map->data = (const char *)data;
+    map->size = (size_t)size.QuadPart;
+    map->kind = BMFONT__FILE_MAP_MAPPED;
+    return true;
+#elif defined(CMP_BMFONT__POSIX_MMAP)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        bmfont__set_error(result, "Couldn't open file: %s. Error: %s",
+                 filename,
+                 strerror(errno));
+        return false;
     }
-    if (font->chars) free(font->chars);
-    free(font);
-}
+    CMP_BMFONT__DEFER { close(fd); };
 
-const char *bmfont_get_error_string()
-{
-    return bmfont__error;
+    struct stat st;
+    if (fstat(fd, &st) != 0) return bmfont__read_file(filename, map, allocator, result);
+    if (st.st_size == 0) {
+        map->data = "";
+        return true;
+    }
+
+    void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return bmfont__read_file(filename, map, allocator, result);
+
+    map->data = (const char *)data;
+    map->size = (size_t)st.st_size;
+    map->kind = BMFONT__FILE_MAP_MAPPED;
+    return true;
+#else
+    return bmfont__read_file(filename, map, allocator, result);
+#endif
 }
 
-} // namespace cmp
+void bmfont__unmap_file(BMFont__FileMap *map, const BMFontAllocator *allocator) {
+    if (map->kind == BMFONT__FILE_MAP_HEAP) {
+        allocator->free((void *)map->data, allocator->user);
+    } else if (map->kind == BMFONT__FILE_MAP_MAPPED) {
+#if defined(CMP_BMFONT__WINDOWS_MMAP)
+        UnmapViewOfFile(map->data);
+#elif defined(CMP_BMFONT__POSIX_MMAP)
+        munmap((void *)map->data, map->size);
+#endif
+    }
+    *map = {};
+}
 
-#endif // ifdef CMP_BMFONT_IMPLEMENTATION
+// Binary (version 3) format. See http://www.angelcode.com/products/bmfont/doc/file_format.html.
+// All values are little endian.
+static constexpr uint8_t BMFONT__BINARY_BLOCK_INFO     = 1;
+static constexpr uint8_t BMFONT__BINARY_BLOCK_COMMON   = 2;
+static constexpr uint8_t BMFONT__BINARY_BLOCK_PAGES    = 3;
+static constexpr uint8_t BMFONT__BINARY_BLOCK_CHARS    = 4;
+static constexpr uint8_t BMFONT__BINARY_BLOCK_KERNINGS = 5;
+
+static constexpr size_t BMFONT__BINARY_INFO_SIZE    = 14;
+static constexpr size_t BMFONT__BINARY_COMMON_SIZE  = 15;
+static constexpr size_t BMFONT__BINARY_CHAR_SIZE    = 20;
+static constexpr size_t BMFONT__BINARY_KERNING_SIZE = 10;
+
+bool bmfont__is_binary(const char *data, size_t size) {
+    return size >= 3 && data[0] == 'B' && data[1] == 'M' && data[2] == 'F';
+}
 
+bool bmfont__is_little_endian() {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
 
-#ifdef CMP_BMFONT_SELF_TEST
+uint16_t bmfont__read_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
 
-#include <stdio.h>
+uint32_t bmfont__read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-using namespace cmp;
+void bmfont__set_binary_error(BMFontResult *result, size_t offset, const char *fmt, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    bmfont__set_error(result,
+             "Invalid binary BMFont (offset %llu): %s",
+             (unsigned long long)offset,
+             message);
+}
 
-#define ASSERT_NULLPTR(actual)                                                                     \
-    if (actual != nullptr) {                                                                       \
-        printf("%s(%d): failed: expected nullptr, got: %p\n", __FILE__, __LINE__, actual);         \
-        fail = true;                                                                               \
+// Copies a NUL terminated string that must lie entirely within [p, end).
+bool bmfont__copy_binary_string(const uint8_t *p,
+                                const uint8_t *end,
+                                size_t         offset,
+                                BMFont__Arena *arena,
+                                BMFontResult * result,
+                                char **        dest,
+                                size_t *       len) {
+    const uint8_t *nul = (const uint8_t *)memchr(p, '\0', (size_t)(end - p));
+    if (!nul) {
+        bmfont__set_binary_error(result, offset, "Unterminated string");
+        return false;
     }
 
+    *len = (size_t)(nul - p);
+    *dest = (char *)bmfont__arena_push(arena, *len + 1);
+    if (*dest) memcpy(*dest, p, *len);
+    return true;
+}
 
-#define ASSERT_STR_EQ(expected, actual)                                                            \
-    if (actual == nullptr || strcmp(expected, actual)) {                                           \
-        printf("%s(%d): failed: expected: '%s', got: '%s'\n",                                      \
-               __FILE__,                                                                           \
-               __LINE__,                                                                           \
-               expected,                                                                           \
-               actual);                                                                            \
-        fail = true;                                                    \
+bool bmfont__parse_binary(const uint8_t *data,
+                          size_t         size,
+                          BMFont__Arena *arena,
+                          BMFontResult * result,
+                          BMFont *       font) {
+    if (size < 4 || data[3] != 3) {
+        bmfont__set_binary_error(result, 3,
+                                 "Unsupported version: %d. Expected: 3",
+                                 size < 4 ? -1 : data[3]);
+        return false;
     }
 
-#define ASSERT_INT_EQ(expected, actual)                                                            \
-    if (expected != actual) {                                                                      \
-        printf("%s(%d): failed: expected: %d, got: %d\n", __FILE__, __LINE__, expected, actual);   \
-        fail = true;                                                                               \
-    }
+    unsigned seen_blocks = 0;
+    size_t offset = 4;
+    uint64_t start = bmfont__start_phase();
+    while (offset < size) {
+        if (size - offset < 5) {
+            bmfont__set_binary_error(result, offset, "Truncated block header");
+            return false;
+        }
 
-static bool fail = false;
+        uint8_t  type       = data[offset];
+        uint32_t block_size = bmfont__read_u32(data + offset + 1);
+        offset += 5;
+        if (block_size > size - offset) {
+            bmfont__set_binary_error(result, offset, "Block %d overruns the end of the file", type);
+            return false;
+        }
+
+        const uint8_t *block = data + offset;
+        const uint8_t *block_end = block + block_size;
+        if (type < BMFONT__BINARY_BLOCK_INFO || type > BMFONT__BINARY_BLOCK_KERNINGS) {
+            bmfont__set_binary_error(result, offset, "Unknown block type: %d", type);
+            return false;
+        }
+        if (seen_blocks & (1u << type)) {
+            bmfont__set_binary_error(result, offset, "Duplicate block type: %d", type);
+            return false;
+        }
+        seen_blocks |= 1u << type;
+
+        if (type == BMFONT__BINARY_BLOCK_INFO) {
+            if (block_size < BMFONT__BINARY_INFO_SIZE) {
+                bmfont__set_binary_error(result, offset, "Malformed info block");
+                return false;
+            }
+            size_t len;
+            if (!bmfont__copy_binary_string(block + BMFONT__BINARY_INFO_SIZE,
+                                            block_end,
+                                            offset + BMFONT__BINARY_INFO_SIZE,
+                                            arena,
+                                            result,
+                                            &font->font_name,
+                                            &len)) {
+                return false;
+            }
+            font->font_size = (int16_t)bmfont__read_u16(block);
+        } else if (type == BMFONT__BINARY_BLOCK_COMMON) {
+            if (block_size < BMFONT__BINARY_COMMON_SIZE) {
+                bmfont__set_binary_error(result, offset, "Malformed common block");
+                return false;
+            }
+            font->line_height   = bmfont__read_u16(block + 0);
+            font->base          = bmfont__read_u16(block + 2);
+            font->scale_w       = bmfont__read_u16(block + 4);
+            font->scale_h       = bmfont__read_u16(block + 6);
+            font->num_pages     = bmfont__read_u16(block + 8);
+            font->packed        = (block[10] >> 7) & 1;
+            font->alpha_channel = block[11];
+            font->red_channel   = block[12];
+            font->green_channel = block[13];
+            font->blue_channel  = block[14];
+            font->page_names =
+                    (char **)bmfont__arena_push(arena, font->num_pages * sizeof(char *));
+        } else if (type == BMFONT__BINARY_BLOCK_PAGES) {
+            if (!(seen_blocks & (1u << BMFONT__BINARY_BLOCK_COMMON))) {
+                bmfont__set_binary_error(result, offset, "Pages block before common block");
+                return false;
+            }
+            const uint8_t *p = block;
+            for (uint32_t i = 0; i < font->num_pages; ++i) {
+                if (p == block_end) {
+                    bmfont__set_binary_error(result, offset,
+                                             "Fewer pages than specified in file. Expected: %u, "
+                                             "actual: %u",
+                                             font->num_pages,
+                                             i);
+                    return false;
+                }
+                size_t len;
+                char *name;
+                if (!bmfont__copy_binary_string(p,
+                                                block_end,
+                                                offset + (size_t)(p - block),
+                                                arena,
+                                                result,
+                                                &name,
+                                                &len)) {
+                    return false;
+                }
+                if (font->page_names) font->page_names[i] = name;
+                p += len + 1;
+            }
+        } else if (type == BMFONT__BINARY_BLOCK_CHARS) {
+            if (block_size % BMFONT__BINARY_CHAR_SIZE ||
+                block_size / BMFONT__BINARY_CHAR_SIZE > BMFONT_MAX_COUNT) {
+                bmfont__set_binary_error(result, offset, "Malformed chars block");
+                return false;
+            }
+            font->num_chars = (uint32_t)(block_size / BMFONT__BINARY_CHAR_SIZE);
+            font->chars = (BMFont::Char *)bmfont__arena_push(
+                    arena, font->num_chars * sizeof(BMFont::Char));
+
+            static_assert(sizeof(BMFont::Char) == BMFONT__BINARY_CHAR_SIZE,
+                          "BMFont::Char must match the binary char record");
+            if (bmfont__arena_measuring(arena)) {
+                // Nothing to copy yet
+            } else if (bmfont__is_little_endian()) {
+                // The in-memory record has the same layout as the file record.
+                memcpy(font->chars, block, block_size);
+            } else {
+                for (uint32_t i = 0; i < font->num_chars; ++i) {
+                    const uint8_t *rec = block + (size_t)i * BMFONT__BINARY_CHAR_SIZE;
+                    BMFont::Char * ch  = &font->chars[i];
+                    ch->id        = bmfont__read_u32(rec + 0);
+                    ch->x         = bmfont__read_u16(rec + 4);
+                    ch->y         = bmfont__read_u16(rec + 6);
+                    ch->width     = bmfont__read_u16(rec + 8);
+                    ch->height    = bmfont__read_u16(rec + 10);
+                    ch->x_offset  = (int16_t)bmfont__read_u16(rec + 12);
+                    ch->y_offset  = (int16_t)bmfont__read_u16(rec + 14);
+                    ch->x_advance = bmfont__read_u16(rec + 16);
+                    ch->page      = rec[18];
+                    ch->channel   = rec[19];
+                }
+            }
+        } else if (type == BMFONT__BINARY_BLOCK_KERNINGS) {
+            if (block_size % BMFONT__BINARY_KERNING_SIZE ||
+                block_size / BMFONT__BINARY_KERNING_SIZE > BMFONT_MAX_COUNT) {
+                bmfont__set_binary_error(result, offset, "Malformed kerning pairs block");
+                return false;
+            }
+            font->num_kernings = (uint32_t)(block_size / BMFONT__BINARY_KERNING_SIZE);
+            font->kernings = (BMFont::Kerning *)bmfont__arena_push(
+                    arena, font->num_kernings * sizeof(BMFont::Kerning));
+
+            // Kerning records are packed to 10 bytes in the file, so they can't be copied as is.
+            for (uint32_t i = 0; font->kernings && i < font->num_kernings; ++i) {
+                const uint8_t *rec = block + (size_t)i * BMFONT__BINARY_KERNING_SIZE;
+                font->kernings[i].first  = bmfont__read_u32(rec + 0);
+                font->kernings[i].second = bmfont__read_u32(rec + 4);
+                font->kernings[i].amount = (int16_t)bmfont__read_u16(rec + 8);
+            }
+        }
+
+        // Block types are numbered in the same order as the phases.
+        bmfont__end_phase(BMFONT_PHASE_INFO + type - BMFONT__BINARY_BLOCK_INFO, &start);
+        offset += block_size;
+    }
+
+    static const char *required_names[] = {nullptr, "info", "common", "pages", "chars"};
+    for (uint8_t type = BMFONT__BINARY_BLOCK_INFO; type <= BMFONT__BINARY_BLOCK_CHARS; ++type) {
+        if (!(seen_blocks & (1u << type))) {
+            bmfont__set_binary_error(result, offset, "Missing %s block", required_names[type]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The char hash table is sized from num_chars rather than from the number of sparse chars, so that
+// its size is known before any char has been parsed.
+bool bmfont__build_char_index(BMFont__Arena *arena, BMFont *font) {
+    font->char_dense_index =
+            (uint32_t *)bmfont__arena_push(arena, BMFONT_DENSE_CHAR_COUNT * sizeof(uint32_t));
+    if (!font->num_chars) return true;
+
+    uint32_t capacity = bmfont__hash_capacity(font->num_chars);
+    font->char_hash_index = (uint32_t *)bmfont__arena_push(arena, capacity * sizeof(uint32_t));
+    font->char_hash_mask = capacity - 1;
+    if (bmfont__arena_measuring(arena)) return true;
+
+    for (uint32_t i = 0; i < font->num_chars; ++i) bmfont__index_char(font, i);
+
+    return true;
+}
+
+bool bmfont__build_kerning_index(BMFont__Arena *arena, BMFont *font) {
+    if (!font->num_kernings) return true;
+
+    uint32_t capacity = bmfont__hash_capacity(font->num_kernings);
+    font->kerning_hash_index = (uint32_t *)bmfont__arena_push(arena, capacity * sizeof(uint32_t));
+    font->kerning_hash_mask = capacity - 1;
+    if (bmfont__arena_measuring(arena)) return true;
+
+    for (uint32_t i = 0; i < font->num_kernings; ++i) bmfont__index_kerning(font, i);
+
+    return true;
+}
+
+bool bmfont__build_indices(BMFont__Arena *arena, BMFont *font) {
+    return bmfont__build_char_index(arena, font) && bmfont__build_kerning_index(arena, font);
+}
+
+// Runs one pass of the loader (see BMFont__Arena). While measuring, the font header is written to
+// scratch instead of the arena. Returns nullptr on error.
+BMFont *bmfont__load_pass(const char *   data,
+                          size_t         size,
+                          bool           lazy,
+                          BMFont__Arena *arena,
+                          BMFontResult * result,
+                          BMFont *       scratch) {
+    BMFont *font = (BMFont *)bmfont__arena_push(arena, sizeof(BMFont));
+    if (!font) {
+        *scratch = {};
+        font = scratch;
+    }
+
+    if (bmfont__is_binary(data, size)) {
+        if (!bmfont__parse_binary((const uint8_t *)data, size, arena, result, font)) return nullptr;
+        uint64_t start = bmfont__start_phase();
+        bool indexed = bmfont__build_indices(arena, font);
+        bmfont__end_phase(BMFONT_PHASE_INDEX, &start);
+        return indexed ? font : nullptr;
+    }
+
+    // Line offsets are stored in 32 bits; larger files are loaded eagerly.
+    if (lazy && size <= UINT32_MAX) {
+        font->_source = data;
+        font->_source_size = size;
+    }
+
+    BMFont__Parser parser;
+    bmfont__parser_init(&parser, data, size, arena, result);
+#ifdef CMP_BMFONT_STATS
+    if (!bmfont__arena_measuring(arena)) parser.stats = bmfont__load_stats;
+#endif
+    uint64_t start = bmfont__start_phase();
+    bmfont__load_next_token(&parser);
+
+    bool ok = bmfont__parse_info(&parser, font);
+    bmfont__end_phase(BMFONT_PHASE_INFO, &start);
+    ok = ok && bmfont__parse_common(&parser, font);
+    bmfont__end_phase(BMFONT_PHASE_COMMON, &start);
+    ok = ok && bmfont__parse_pages(&parser, font);
+    bmfont__end_phase(BMFONT_PHASE_PAGES, &start);
+    ok = ok && bmfont__parse_chars(&parser, font);
+    bmfont__end_phase(BMFONT_PHASE_CHARS, &start);
+    ok = ok && bmfont__parse_kernings(&parser, font);
+    bmfont__end_phase(BMFONT_PHASE_KERNINGS, &start);
+
+    if (!bmfont__parser_ok(&parser)) return nullptr;
+
+    if (!(parser.flags & BMFONT__PARSER_EOF)) {
+        bmfont__set_parser_error(&parser,
+                                 "Expected EOF (line %d, col %d). Got: %.*s",
+                                 parser.start_line,
+                                 parser.start_col,
+                                 bmfont__token_print_len(&parser),
+                                 parser.next_token);
+        return nullptr;
+    }
+
+    bool indexed = bmfont__build_indices(arena, font);
+    bmfont__end_phase(BMFONT_PHASE_INDEX, &start);
+    return indexed ? font : nullptr;
+}
+
+bool bmfont__parse_memory(const char *           data,
+                          size_t                 size,
+                          bool                   lazy,
+                          BMFontResult *         result,
+                          const BMFontAllocator *allocator)
+{
+    bmfont__reset_result(result);
+    CMP_BMFONT__COUNT_LOAD(bytes_read, size);
+
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFont__Arena arena = {};
+    BMFont scratch;
+    if (!bmfont__load_pass(data, size, lazy, &arena, result, &scratch)) return false;
+
+    arena.capacity = arena.size;
+    arena.size = 0;
+    arena.base = (char *)bmfont__alloc(&alloc, arena.capacity, result);
+    if (!arena.base) return false;
+
+    BMFont *font = bmfont__load_pass(data, size, lazy, &arena, result, &scratch);
+    if (!font) {
+        alloc.free(arena.base, alloc.user);
+        return false;
+    }
+
+    assert(arena.size == arena.capacity);
+    font->_allocator = alloc;
+    font->_id = bmfont__next_font_id();
+    result->font = font;
+    return true;
+}
+
+bool bmfont_parse_memory_r(const char *           data,
+                           size_t                 size,
+                           BMFontResult *         result,
+                           const BMFontAllocator *allocator)
+{
+    CMP_BMFONT__LOAD_SCOPE(nullptr, result);
+    return bmfont__parse_memory(data, size, false, result, allocator);
+}
+
+bool bmfont_parse_memory_lazy_r(const char *           data,
+                                size_t                 size,
+                                BMFontResult *         result,
+                                const BMFontAllocator *allocator)
+{
+    CMP_BMFONT__LOAD_SCOPE(nullptr, result);
+    return bmfont__parse_memory(data, size, true, result, allocator);
+}
+
+bool bmfont_parse_file_r(const char *filename, BMFontResult *result, const BMFontAllocator *allocator)
+{
+    CMP_BMFONT__LOAD_SCOPE(filename, result);
+    bmfont__reset_result(result);
+
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFont__FileMap map;
+    if (!bmfont__map_file(filename, &map, &alloc, result)) return false;
+    CMP_BMFONT__DEFER { bmfont__unmap_file(&map, &alloc); };
+
+    return bmfont_parse_memory_r(map.data, map.size, result, &alloc);
+}
+
+bool bmfont_parse_file_lazy_r(const char *           filename,
+                              BMFontResult *         result,
+                              const BMFontAllocator *allocator)
+{
+    CMP_BMFONT__LOAD_SCOPE(filename, result);
+    bmfont__reset_result(result);
+
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFont__FileMap map;
+    if (!bmfont__map_file(filename, &map, &alloc, result)) return false;
+
+    if (!bmfont_parse_memory_lazy_r(map.data, map.size, result, &alloc)) {
+        bmfont__unmap_file(&map, &alloc);
+        return false;
+    }
+
+    // The font decodes from the file, so it takes over the mapping unless it was loaded eagerly.
+    BMFont *font = result->font;
+    if (!font->_source) {
+        bmfont__unmap_file(&map, &alloc);
+        return true;
+    }
+
+    font->_mapping = map.data;
+    font->_mapping_size = map.size;
+    if (map.kind == BMFONT__FILE_MAP_HEAP) font->_flags |= BMFONT__FONT_MAPPED_HEAP;
+    return true;
+}
+
+BMFont *bmfont_parse_memory(const char *data, size_t size, const BMFontAllocator *allocator)
+{
+    BMFontResult result;
+    bmfont_parse_memory_r(data, size, &result, allocator);
+    return bmfont__publish_result(&result);
+}
+
+BMFont *bmfont_parse_file(const char *filename, const BMFontAllocator *allocator)
+{
+    BMFontResult result;
+    bmfont_parse_file_r(filename, &result, allocator);
+    return bmfont__publish_result(&result);
+}
+
+BMFont *bmfont_parse_memory_lazy(const char *data, size_t size, const BMFontAllocator *allocator)
+{
+    BMFontResult result;
+    bmfont_parse_memory_lazy_r(data, size, &result, allocator);
+    return bmfont__publish_result(&result);
+}
+
+BMFont *bmfont_parse_file_lazy(const char *filename, const BMFontAllocator *allocator)
+{
+    BMFontResult result;
+    bmfont_parse_file_lazy_r(filename, &result, allocator);
+    return bmfont__publish_result(&result);
+}
+
+// Starts a parser on the line of a pending record of a lazily loaded font. Lookups don't report
+// errors, so the parser doesn't track which line of the file it is on.
+void bmfont__lazy_parser_init(BMFont__Parser *parser,
+                              const BMFont *  font,
+                              uint32_t        offset,
+                              BMFontResult *  result) {
+    const char *line = font->_source + offset;
+    bmfont__parser_init(parser, line, font->_source_size - offset, nullptr, result);
+    bmfont__load_next_token(parser);
+}
+
+bool bmfont__decode_lazy_char(const BMFont *font, uint32_t i, BMFontResult *result) {
+    BMFont__Parser parser;
+    bmfont__lazy_parser_init(&parser, font, font->_char_offsets[i], result);
+
+    BMFont::Char ch = {};
+    if (!bmfont__parse_char(&parser, &ch)) return false;
+
+    // Lookups are const, but the chars of a lazy font always live in its own writable block.
+    BMFont *lazy = const_cast<BMFont *>(font);
+    lazy->chars[i] = ch;
+    lazy->_char_offsets[i] = 0;
+    return true;
+}
+
+bool bmfont__decode_lazy_kerning(const BMFont *font, uint32_t i, BMFontResult *result) {
+    BMFont__Parser parser;
+    bmfont__lazy_parser_init(&parser, font, font->_kerning_offsets[i], result);
+
+    BMFont::Kerning kerning = {};
+    if (!bmfont__parse_kerning(&parser, &kerning)) return false;
+
+    BMFont *lazy = const_cast<BMFont *>(font);
+    lazy->kernings[i] = kerning;
+    lazy->_kerning_offsets[i] = 0;
+    return true;
+}
+
+bool bmfont__load_lazy_char(const BMFont *font, uint32_t i) {
+    BMFontResult result;
+    return bmfont__decode_lazy_char(font, i, &result);
+}
+
+bool bmfont__load_lazy_kerning(const BMFont *font, uint32_t i) {
+    BMFontResult result;
+    return bmfont__decode_lazy_kerning(font, i, &result);
+}
+
+// Functions that read every record of a font take a fully decoded font. Decoding a lazily loaded
+// font in place would write to it, racing with threads that read the const font, so its source is
+// parsed again into a temporary eager copy instead. Returns font itself if it isn't lazy, or
+// nullptr on error. Release the result with bmfont__release_decoded().
+const BMFont *bmfont__decoded(const BMFont *font, BMFontResult *result) {
+    if (!font->_source) return font;
+    if (!bmfont_parse_memory_r(font->_source, font->_source_size, result, &font->_allocator)) {
+        return nullptr;
+    }
+
+    const BMFont *copy = result->font;
+    result->font = nullptr;
+    return copy;
+}
+
+void bmfont__release_decoded(const BMFont *font, const BMFont *decoded) {
+    if (decoded != font) bmfont_free(const_cast<BMFont *>(decoded));
+}
+
+// Sections of a text font in the order the stream parser expects them.
+static constexpr uint32_t BMFONT__STREAM_INFO     = 0;
+static constexpr uint32_t BMFONT__STREAM_COMMON   = 1;
+static constexpr uint32_t BMFONT__STREAM_PAGES    = 2;
+static constexpr uint32_t BMFONT__STREAM_CHARS    = 3;
+static constexpr uint32_t BMFONT__STREAM_CHAR     = 4;
+static constexpr uint32_t BMFONT__STREAM_KERNINGS = 5;
+static constexpr uint32_t BMFONT__STREAM_KERNING  = 6;
+static constexpr uint32_t BMFONT__STREAM_DONE     = 7;
+
+static constexpr uint32_t BMFONT__STREAM_TEXT   = 0x0001;
+static constexpr uint32_t BMFONT__STREAM_BINARY = 0x0002;
+static constexpr uint32_t BMFONT__STREAM_FAILED = 0x0004;
+
+// Holds the strings and arrays parsed from one header line until the font is assembled.
+struct BMFont__StreamBlock {
+    BMFont__StreamBlock *next;
+};
+
+// Growable buffer for a line that spans chunks, or for the whole input of a binary font.
+struct BMFont__StreamBuffer {
+    char * data;
+    size_t size;
+    size_t capacity;
+};
+
+struct BMFontStreamParser {
+    BMFontAllocator       allocator;
+    BMFontResult          result;
+    BMFont                font; // Staging font; its strings and arrays live in blocks
+    BMFont__StreamBlock * blocks;
+    BMFont *              assembled; // The font in its final block once all counts are known
+    BMFont__Arena         arena;     // Holds assembled; only its lookup tables are still to come
+    BMFont__StreamBuffer  pending;
+    uint32_t              section;
+    uint32_t              count; // Records seen so far in the current section
+    uint32_t              line;
+    uint32_t              flags;
+};
+
+bool bmfont__stream_append(BMFontStreamParser *stream, const char *data, size_t len) {
+    BMFont__StreamBuffer *buffer = &stream->pending;
+    if (buffer->size + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->size + len) capacity *= 2;
+
+        char *grown = (char *)bmfont__alloc(&stream->allocator, capacity, &stream->result);
+        if (!grown) return false;
+        if (buffer->size) memcpy(grown, buffer->data, buffer->size);
+        if (buffer->data) stream->allocator.free(buffer->data, stream->allocator.user);
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    if (len) memcpy(buffer->data + buffer->size, data, len);
+    buffer->size += len;
+    return true;
+}
+
+// Parses a header line into stream->font. The line is measured first so that the strings and
+// arrays it introduces can be given a block of their own.
+bool bmfont__stream_parse_header(BMFontStreamParser *stream,
+                                 const char *        line,
+                                 size_t              len,
+                                 bool (*parse)(BMFont__Parser *, BMFont *)) {
+    BMFont__Arena arena = {};
+    for (int pass = 0; pass < 2; ++pass) {
+        BMFont__Parser parser;
+        bmfont__parser_init(&parser, line, len, &arena, &stream->result);
+        parser.curr_line = (int)stream->line;
+        bmfont__load_next_token(&parser);
+        if (!parse(&parser, &stream->font)) return false;
+        if (pass == 1 || !arena.size) break;
+
+        size_t size = bmfont__align8(sizeof(BMFont__StreamBlock)) + arena.size;
+        BMFont__StreamBlock *block =
+                (BMFont__StreamBlock *)bmfont__alloc(&stream->allocator, size, &stream->result);
+        if (!block) return false;
+        block->next = stream->blocks;
+        stream->blocks = block;
+
+        arena.base = (char *)block + bmfont__align8(sizeof(BMFont__StreamBlock));
+        arena.capacity = arena.size;
+        arena.size = 0;
+    }
+    return true;
+}
+
+bool bmfont__stream_parse_info(BMFont__Parser *parser, BMFont *font) {
+    return bmfont__parse_info(parser, font);
+}
+
+bool bmfont__stream_parse_common(BMFont__Parser *parser, BMFont *font) {
+    return bmfont__parse_common(parser, font);
+}
+
+bool bmfont__stream_parse_page(BMFont__Parser *parser, BMFont *font) {
+    return bmfont__expect_token_and_advance(parser, "page") && bmfont__parse_page(parser, font);
+}
+
+bool bmfont__stream_parse_kernings(BMFont__Parser *parser, BMFont *font) {
+    // We treat kerning as optional, so the input may end here
+    return !bmfont__parser_ready(parser) || bmfont__parse_kernings_header(parser, font);
+}
+
+// Moves past sections that have no more records to come.
+void bmfont__stream_skip_empty_sections(BMFontStreamParser *stream) {
+    BMFont *font = &stream->font;
+    if (stream->section == BMFONT__STREAM_PAGES && stream->count == font->num_pages) {
+        stream->section = BMFONT__STREAM_CHARS;
+    }
+    if (stream->section == BMFONT__STREAM_CHAR && stream->count == font->num_chars) {
+        stream->section = BMFONT__STREAM_KERNINGS;
+    }
+    if (stream->section == BMFONT__STREAM_KERNING && stream->count == font->num_kernings) {
+        stream->section = BMFONT__STREAM_DONE;
+    }
+}
+
+// Copies the staged font into the arena the same way bmfont__load_pass() lays out a font, but
+// without the lookup tables. Kernings are only copied if staged has them.
+BMFont *bmfont__stream_layout(const BMFont *staged, BMFont__Arena *arena, BMFont *scratch) {
+    BMFont *font = (BMFont *)bmfont__arena_push(arena, sizeof(BMFont));
+    if (!font) font = scratch;
+    *font = *staged;
+
+    bool measuring = bmfont__arena_measuring(arena);
+    if (staged->font_name) {
+        size_t len = strlen(staged->font_name) + 1;
+        font->font_name = (char *)bmfont__arena_push(arena, len);
+        if (!measuring) memcpy(font->font_name, staged->font_name, len);
+    }
+
+    font->page_names = (char **)bmfont__arena_push(arena, font->num_pages * sizeof(char *));
+    for (uint32_t i = 0; i < font->num_pages; ++i) {
+        if (!staged->page_names || !staged->page_names[i]) continue;
+
+        size_t len = strlen(staged->page_names[i]) + 1;
+        char *name = (char *)bmfont__arena_push(arena, len);
+        if (!measuring) {
+            memcpy(name, staged->page_names[i], len);
+            font->page_names[i] = name;
+        }
+    }
+
+    font->chars = (BMFont::Char *)bmfont__arena_push(arena, font->num_chars * sizeof(BMFont::Char));
+    if (!measuring && font->num_chars) {
+        memcpy(font->chars, staged->chars, font->num_chars * sizeof(BMFont::Char));
+    }
+
+    font->kernings = (BMFont::Kerning *)bmfont__arena_push(
+            arena, font->num_kernings * sizeof(BMFont::Kerning));
+    if (!measuring && font->num_kernings && staged->kernings) {
+        memcpy(font->kernings, staged->kernings, font->num_kernings * sizeof(BMFont::Kerning));
+    }
+
+    return font;
+}
+
+// Copies the staged font into the arena, together with the lookup tables.
+BMFont *bmfont__stream_assemble(const BMFont *staged, BMFont__Arena *arena, BMFont *scratch) {
+    BMFont *font = bmfont__stream_layout(staged, arena, scratch);
+    return bmfont__build_indices(arena, font) ? font : nullptr;
+}
+
+void bmfont__stream_free_blocks(BMFontStreamParser *stream) {
+    BMFontAllocator allocator = stream->allocator;
+    for (BMFont__StreamBlock *block = stream->blocks; block;) {
+        BMFont__StreamBlock *next = block->next;
+        allocator.free(block, allocator.user);
+        block = next;
+    }
+    stream->blocks = nullptr;
+}
+
+void bmfont__stream_free(BMFontStreamParser *stream) {
+    BMFontAllocator allocator = stream->allocator;
+    bmfont__stream_free_blocks(stream);
+    if (stream->assembled) allocator.free(stream->arena.base, allocator.user);
+    if (stream->pending.data) allocator.free(stream->pending.data, allocator.user);
+    allocator.free(stream, allocator.user);
+}
+
+// Parses the kernings header. The font then has all its counts, so it is laid out in its final
+// block and the staging blocks are freed. The kerning lines are parsed straight into the font,
+// which saves staging them and copying them again at the end.
+bool bmfont__stream_begin_kernings(BMFontStreamParser *stream, const char *line, size_t len) {
+    BMFont__Arena *arena = &stream->arena;
+    BMFont__Parser parser;
+    bmfont__parser_init(&parser, line, len, arena, &stream->result);
+    parser.curr_line = (int)stream->line;
+    bmfont__load_next_token(&parser);
+    if (!bmfont__stream_parse_kernings(&parser, &stream->font)) return false;
+    if (!stream->font.num_kernings) return true;
+
+    BMFont scratch;
+    *arena = {};
+    bmfont__stream_assemble(&stream->font, arena, &scratch);
+
+    arena->capacity = arena->size;
+    arena->size = 0;
+    arena->base = (char *)bmfont__alloc(&stream->allocator, arena->capacity, &stream->result);
+    if (!arena->base) return false;
+
+    stream->assembled = bmfont__stream_layout(&stream->font, arena, &scratch);
+    bmfont__stream_free_blocks(stream);
+    stream->font = *stream->assembled;
+    return true;
+}
+
+
+// Parses one line of a text font, including its newline if it has one. Lines are checked against
+// the same rules, and produce the same errors, as when the whole file is parsed at once.
+bool bmfont__stream_parse_line(BMFontStreamParser *stream, const char *line, size_t len) {
+    BMFont *font = &stream->font;
+    bool ok = true;
+
+    BMFont__Arena arena = {};
+    BMFont__Parser parser;
+    bmfont__parser_init(&parser, line, len, &arena, &stream->result);
+    parser.curr_line = (int)stream->line;
+    bmfont__load_next_token(&parser);
+
+    switch (stream->section) {
+    case BMFONT__STREAM_INFO:
+        ok = bmfont__stream_parse_header(stream, line, len, bmfont__stream_parse_info);
+        stream->section = BMFONT__STREAM_COMMON;
+        break;
+    case BMFONT__STREAM_COMMON:
+        ok = bmfont__stream_parse_header(stream, line, len, bmfont__stream_parse_common);
+        stream->section = BMFONT__STREAM_PAGES;
+        break;
+    case BMFONT__STREAM_PAGES:
+        if (!bmfont__token_equals(&parser, "page")) {
+            bmfont__set_count_error(&parser, "pages", font->num_pages, stream->count);
+            ok = false;
+        } else {
+            ok = bmfont__stream_parse_header(stream, line, len, bmfont__stream_parse_page);
+            stream->count++;
+        }
+        break;
+    case BMFONT__STREAM_CHARS:
+        ok = bmfont__stream_parse_header(stream, line, len, bmfont__parse_chars_header);
+        stream->section = BMFONT__STREAM_CHAR;
+        stream->count = 0;
+        break;
+    case BMFONT__STREAM_KERNINGS:
+        ok = bmfont__stream_begin_kernings(stream, line, len);
+        stream->section = BMFONT__STREAM_KERNING;
+        stream->count = 0;
+        break;
+    default:
+        // Record lines need no storage of their own, so they are parsed in place.
+        if (stream->section == BMFONT__STREAM_CHAR) {
+            if (bmfont__match_token_and_advance(&parser, "char")) {
+                ok = bmfont__parse_char(&parser, &font->chars[stream->count++]);
+            } else {
+                bmfont__set_count_error(&parser, "chars", font->num_chars, stream->count);
+                ok = false;
+            }
+        } else if (stream->section == BMFONT__STREAM_KERNING) {
+            if (bmfont__match_token_and_advance(&parser, "kerning")) {
+                ok = bmfont__parse_kerning(&parser, &font->kernings[stream->count++]);
+            } else {
+                bmfont__set_count_error(&parser, "kernings", font->num_kernings, stream->count);
+                ok = false;
+            }
+        } else if (!(parser.flags & BMFONT__PARSER_EOF)) {
+            bmfont__set_parser_error(&parser,
+                                     "Expected EOF (line %d, col %d). Got: %.*s",
+                                     parser.start_line,
+                                     parser.start_col,
+                                     bmfont__token_print_len(&parser),
+                                     parser.next_token);
+            ok = false;
+        }
+        ok = ok && bmfont__parser_ok(&parser);
+        break;
+    }
+
+    stream->line++;
+    bmfont__stream_skip_empty_sections(stream);
+    return ok;
+}
+
+BMFontStreamParser *bmfont_parser_create(const BMFontAllocator *allocator) {
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFontResult result;
+    BMFontStreamParser *stream =
+            (BMFontStreamParser *)bmfont__alloc(&alloc, sizeof(BMFontStreamParser), &result);
+    if (!stream) return nullptr;
+
+    stream->allocator = alloc;
+    bmfont__reset_result(&stream->result);
+    stream->line = 1;
+    return stream;
+}
+
+bool bmfont_parser_feed(BMFontStreamParser *stream, const void *chunk, size_t len) {
+    if (stream->flags & BMFONT__STREAM_FAILED) return false;
+
+    const char *p = (const char *)chunk;
+    const char *end = p + len;
+    bool ok = true;
+
+    // The format is known once the first three bytes are in. Until then they are held back.
+    if (!(stream->flags & (BMFONT__STREAM_TEXT | BMFONT__STREAM_BINARY))) {
+        size_t held = stream->pending.size;
+        if (held + len < 3) {
+            ok = bmfont__stream_append(stream, p, len);
+            if (!ok) stream->flags |= BMFONT__STREAM_FAILED;
+            return ok;
+        }
+
+        char head[3];
+        if (held) memcpy(head, stream->pending.data, held);
+        memcpy(head + held, p, 3 - held);
+        if (bmfont__is_binary(head, 3)) {
+            stream->flags |= BMFONT__STREAM_BINARY;
+        } else {
+            stream->flags |= BMFONT__STREAM_TEXT;
+            stream->pending.size = 0;
+            if (held && !bmfont_parser_feed(stream, head, held)) return false;
+        }
+    }
+
+    if (stream->flags & BMFONT__STREAM_BINARY) {
+        ok = bmfont__stream_append(stream, p, len);
+    } else {
+        // Finish the line carried over from earlier chunks, then parse whole lines in place.
+        const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+        if (stream->pending.size && nl) {
+            ok = bmfont__stream_append(stream, p, (size_t)(nl + 1 - p)) &&
+                 bmfont__stream_parse_line(stream, stream->pending.data, stream->pending.size);
+            stream->pending.size = 0;
+            p = nl + 1;
+            nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+        }
+        while (ok && nl) {
+            ok = bmfont__stream_parse_line(stream, p, (size_t)(nl + 1 - p));
+            p = nl + 1;
+            nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+        }
+        ok = ok && bmfont__stream_append(stream, p, (size_t)(end - p));
+    }
+
+    if (!ok) stream->flags |= BMFONT__STREAM_FAILED;
+    return ok;
+}
+
+bool bmfont_parser_finish(BMFontStreamParser *stream, BMFontResult *result) {
+    CMP_BMFONT__DEFER { bmfont__stream_free(stream); };
+
+    if (stream->flags & BMFONT__STREAM_FAILED) {
+        *result = stream->result;
+        return false;
+    }
+
+    if (!(stream->flags & BMFONT__STREAM_TEXT)) {
+        // Binary fonts, and inputs too short to tell, are parsed in one go.
+        return bmfont_parse_memory_r(stream->pending.data ? stream->pending.data : "",
+                                     stream->pending.size,
+                                     result,
+                                     &stream->allocator);
+    }
+
+    // Parse the last line if it has no newline, then let the current section see the end of the
+    // input, which fails unless the font is complete.
+    bool ok = !stream->pending.size ||
+              bmfont__stream_parse_line(stream, stream->pending.data, stream->pending.size);
+    ok = ok && bmfont__stream_parse_line(stream, "", 0);
+    if (!ok) {
+        *result = stream->result;
+        return false;
+    }
+
+    bmfont__reset_result(result);
+    if (stream->assembled) {
+        // The records are in place; only the lookup tables are left.
+        BMFont *font = stream->assembled;
+        stream->assembled = nullptr;
+        bool built = bmfont__build_indices(&stream->arena, font);
+        assert(built && stream->arena.size == stream->arena.capacity);
+        (void)built;
+        font->_allocator = stream->allocator;
+        font->_id = bmfont__next_font_id();
+        result->font = font;
+        return true;
+    }
+
+    BMFont__Arena arena = {};
+    BMFont scratch;
+    bmfont__stream_assemble(&stream->font, &arena, &scratch);
+
+    arena.capacity = arena.size;
+    arena.size = 0;
+    arena.base = (char *)bmfont__alloc(&stream->allocator, arena.capacity, result);
+    if (!arena.base) return false;
+
+    BMFont *font = bmfont__stream_assemble(&stream->font, &arena, &scratch);
+    assert(font && arena.size == arena.capacity);
+    font->_allocator = stream->allocator;
+    font->_id = bmfont__next_font_id();
+    result->font = font;
+    return true;
+}
+
+// Relocatable blob format. All offsets are in bytes from the start of the blob and every section is
+// 8 byte aligned. page_names points at num_pages offsets, one per NUL terminated page name.
+static constexpr char     BMFONT__BLOB_MAGIC[4] = {'B', 'M', 'F', 'B'};
+static constexpr uint32_t BMFONT__BLOB_VERSION  = 1;
+
+struct BMFont__BlobHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t size;
+    uint32_t font_name;
+    uint32_t page_names;
+    uint32_t chars;
+    uint32_t kernings;
+    uint32_t char_dense_index;
+    uint32_t char_hash_index;
+    uint32_t kerning_hash_index;
+    uint32_t char_hash_mask;
+    uint32_t kerning_hash_mask;
+    uint32_t num_pages;
+    uint32_t num_chars;
+    uint32_t num_kernings;
+    int16_t  font_size;
+    uint16_t line_height;
+    uint16_t base;
+    uint16_t scale_w;
+    uint16_t scale_h;
+    uint8_t  alpha_channel;
+    uint8_t  red_channel;
+    uint8_t  green_channel;
+    uint8_t  blue_channel;
+    uint8_t  packed;
+    uint8_t  _padding[5];
+};
+
+size_t bmfont__char_hash_count(const BMFont *font) {
+    return font->char_hash_index ? (size_t)font->char_hash_mask + 1 : 0;
+}
+
+size_t bmfont__kerning_hash_count(const BMFont *font) {
+    return font->kerning_hash_index ? (size_t)font->kerning_hash_mask + 1 : 0;
+}
+
+void *bmfont_write_blob(const BMFont *source, size_t *size) {
+    // The blob holds decoded records only.
+    BMFontResult result;
+    bmfont__reset_result(&result);
+    const BMFont *font = bmfont__decoded(source, &result);
+    if (!font) return bmfont__publish_result(&result);
+    CMP_BMFONT__DEFER { bmfont__release_decoded(source, font); };
+
+    BMFont__BlobHeader header = {};
+    memcpy(header.magic, BMFONT__BLOB_MAGIC, sizeof(header.magic));
+    header.version = BMFONT__BLOB_VERSION;
+
+    // First pass: lay out the sections.
+    size_t offset = bmfont__align8(sizeof(header));
+    header.page_names = (uint32_t)offset;
+    offset = bmfont__align8(offset + font->num_pages * sizeof(uint32_t));
+    header.font_name = (uint32_t)offset;
+    offset += strlen(font->font_name ? font->font_name : "") + 1;
+    for (uint32_t i = 0; i < font->num_pages; ++i) {
+        offset += strlen(font->page_names[i] ? font->page_names[i] : "") + 1;
+    }
+    offset = bmfont__align8(offset);
+    header.chars = (uint32_t)offset;
+    offset = bmfont__align8(offset + font->num_chars * sizeof(BMFont::Char));
+    header.kernings = (uint32_t)offset;
+    offset = bmfont__align8(offset + font->num_kernings * sizeof(BMFont::Kerning));
+    header.char_dense_index = (uint32_t)offset;
+    offset = bmfont__align8(offset + BMFONT_DENSE_CHAR_COUNT * sizeof(uint32_t));
+    header.char_hash_index = (uint32_t)offset;
+    offset = bmfont__align8(offset + bmfont__char_hash_count(font) * sizeof(uint32_t));
+    header.kerning_hash_index = (uint32_t)offset;
+    offset = bmfont__align8(offset + bmfont__kerning_hash_count(font) * sizeof(uint32_t));
+
+    if (offset > 0xFFFFFFFFu) {
+        bmfont__set_error(&result, "Font is too large to write as a blob.");
+        return bmfont__publish_result(&result);
+    }
+
+    header.size               = (uint32_t)offset;
+    header.char_hash_mask     = font->char_hash_index ? font->char_hash_mask : 0;
+    header.kerning_hash_mask  = font->kerning_hash_index ? font->kerning_hash_mask : 0;
+    header.num_pages          = font->num_pages;
+    header.num_chars          = font->num_chars;
+    header.num_kernings       = font->num_kernings;
+    header.font_size          = font->font_size;
+    header.line_height        = font->line_height;
+    header.base               = font->base;
+    header.scale_w            = font->scale_w;
+    header.scale_h            = font->scale_h;
+    header.alpha_channel      = font->alpha_channel;
+    header.red_channel        = font->red_channel;
+    header.green_channel      = font->green_channel;
+    header.blue_channel       = font->blue_channel;
+    header.packed             = font->packed;
+
+    // Second pass: copy everything into place.
+    BMFontAllocator allocator = bmfont__allocator_or_default(nullptr);
+    char *blob = (char *)bmfont__alloc(&allocator, header.size, &result);
+    if (!blob) return bmfont__publish_result(&result);
+
+    memcpy(blob, &header, sizeof(header));
+
+    uint32_t *page_offsets = (uint32_t *)(blob + header.page_names);
+    char *str = blob + header.font_name;
+    size_t len = strlen(font->font_name ? font->font_name : "");
+    memcpy(str, font->font_name ? font->font_name : "", len);
+    str += len + 1;
+    for (uint32_t i = 0; i < font->num_pages; ++i) {
+        page_offsets[i] = (uint32_t)(str - blob);
+        len = strlen(font->page_names[i] ? font->page_names[i] : "");
+        memcpy(str, font->page_names[i] ? font->page_names[i] : "", len);
+        str += len + 1;
+    }
+
+    if (font->num_chars) {
+        memcpy(blob + header.chars, font->chars, font->num_chars * sizeof(BMFont::Char));
+    }
+    if (font->num_kernings) {
+        memcpy(blob + header.kernings, font->kernings, font->num_kernings * sizeof(BMFont::Kerning));
+    }
+    memcpy(blob + header.char_dense_index,
+           font->char_dense_index,
+           BMFONT_DENSE_CHAR_COUNT * sizeof(uint32_t));
+    if (font->char_hash_index) {
+        memcpy(blob + header.char_hash_index,
+               font->char_hash_index,
+               bmfont__char_hash_count(font) * sizeof(uint32_t));
+    }
+    if (font->kerning_hash_index) {
+        memcpy(blob + header.kerning_hash_index,
+               font->kerning_hash_index,
+               bmfont__kerning_hash_count(font) * sizeof(uint32_t));
+    }
+
+    *size = header.size;
+    return blob;
+}
+
+bool bmfont__write_file(const char *filename, const void *data, size_t size, BMFontResult *result) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        bmfont__set_error(result, "Couldn't open file: %s. Error: %s", filename, strerror(errno));
+        return false;
+    }
+
+    bool ok = fwrite(data, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) bmfont__set_error(result, "Couldn't write file: %s", filename);
+    return ok;
+}
+
+bool bmfont_write_blob_file(const BMFont *font, const char *filename) {
+    size_t size;
+    void *blob = bmfont_write_blob(font, &size);
+    if (!blob) return false;
+    CMP_BMFONT__DEFER { bmfont_free_blob(blob); };
+
+    BMFontResult result;
+    bmfont__reset_result(&result);
+    bool ok = bmfont__write_file(filename, blob, size, &result);
+    if (!ok) bmfont__publish_result(&result);
+    return ok;
+}
+
+void bmfont_free_blob(void *blob) {
+    BMFontAllocator allocator = bmfont__allocator_or_default(nullptr);
+    allocator.free(blob, allocator.user);
+}
+
+// Checks that a table of count uint32_t entries at offset lies within the blob.
+bool bmfont__blob_range_ok(const BMFont__BlobHeader *header, uint32_t offset, size_t bytes) {
+    return offset % 4 == 0 && offset <= header->size && bytes <= header->size - offset;
+}
+
+// Checks that every entry of an index table refers to one of count records, and that the table has
+// the free slots the probing loops rely on.
+bool bmfont__blob_index_ok(const uint32_t *table, size_t slots, uint32_t count) {
+    size_t empty = 0;
+    for (size_t i = 0; i < slots; ++i) {
+        if (table[i] > count) return false;
+        if (!table[i]) ++empty;
+    }
+    return empty > 0;
+}
+
+bool bmfont__blob_string_ok(const char *blob, const BMFont__BlobHeader *header, uint32_t offset) {
+    return offset < header->size && memchr(blob + offset, '\0', header->size - offset);
+}
+
+bool bmfont_load_blob_r(const void *           data,
+                        size_t                 size,
+                        BMFontResult *         result,
+                        const BMFontAllocator *allocator) {
+    bmfont__reset_result(result);
+
+    const char *blob = (const char *)data;
+    const BMFont__BlobHeader *header = (const BMFont__BlobHeader *)data;
+    if (size < sizeof(BMFont__BlobHeader) || memcmp(header->magic, BMFONT__BLOB_MAGIC, 4)) {
+        bmfont__set_error(result, "Not a BMFont blob.");
+        return false;
+    }
+    if (header->version != BMFONT__BLOB_VERSION) {
+        bmfont__set_error(result,
+                          "Unsupported blob version: %u. Expected: %u",
+                          (unsigned)header->version,
+                          (unsigned)BMFONT__BLOB_VERSION);
+        return false;
+    }
+    if ((uintptr_t)data % 4 != 0) {
+        bmfont__set_error(result, "Blob is not 4 byte aligned.");
+        return false;
+    }
+
+    size_t char_hash_slots = header->char_hash_index && header->char_hash_mask
+            ? (size_t)header->char_hash_mask + 1 : 0;
+    size_t kerning_hash_slots = header->kerning_hash_index && header->kerning_hash_mask
+            ? (size_t)header->kerning_hash_mask + 1 : 0;
+    bool ok = header->size <= size && header->num_pages <= BMFONT_MAX_COUNT &&
+              header->num_chars <= BMFONT_MAX_COUNT && header->num_kernings <= BMFONT_MAX_COUNT &&
+              bmfont__blob_range_ok(header,
+                                    header->page_names,
+                                    header->num_pages * sizeof(uint32_t)) &&
+              bmfont__blob_range_ok(header,
+                                    header->chars,
+                                    header->num_chars * sizeof(BMFont::Char)) &&
+              bmfont__blob_range_ok(header,
+                                    header->kernings,
+                                    header->num_kernings * sizeof(BMFont::Kerning)) &&
+              bmfont__blob_range_ok(header,
+                                    header->char_dense_index,
+                                    BMFONT_DENSE_CHAR_COUNT * sizeof(uint32_t)) &&
+              bmfont__blob_range_ok(header,
+                                    header->char_hash_index,
+                                    char_hash_slots * sizeof(uint32_t)) &&
+              bmfont__blob_range_ok(header,
+                                    header->kerning_hash_index,
+                                    kerning_hash_slots * sizeof(uint32_t)) &&
+              (header->char_hash_mask & (header->char_hash_mask + 1)) == 0 &&
+              (header->kerning_hash_mask & (header->kerning_hash_mask + 1)) == 0 &&
+              bmfont__blob_string_ok(blob, header, header->font_name);
+
+    const uint32_t *page_offsets = (const uint32_t *)(blob + header->page_names);
+    for (uint32_t i = 0; ok && i < header->num_pages; ++i) {
+        ok = bmfont__blob_string_ok(blob, header, page_offsets[i]);
+    }
+
+    ok = ok &&
+         bmfont__blob_index_ok((const uint32_t *)(blob + header->char_dense_index),
+                               BMFONT_DENSE_CHAR_COUNT,
+                               header->num_chars) &&
+         (!char_hash_slots ||
+          bmfont__blob_index_ok((const uint32_t *)(blob + header->char_hash_index),
+                                char_hash_slots,
+                                header->num_chars)) &&
+         (!kerning_hash_slots ||
+          bmfont__blob_index_ok((const uint32_t *)(blob + header->kerning_hash_index),
+                                kerning_hash_slots,
+                                header->num_kernings));
+    if (!ok) {
+        bmfont__set_error(result, "Corrupt BMFont blob.");
+        return false;
+    }
+
+    // The font and its page name pointers share one block; everything else points into the blob.
+    size_t block_size = bmfont__align8(sizeof(BMFont)) + header->num_pages * sizeof(char *);
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFont *font = (BMFont *)bmfont__alloc(&alloc, block_size, result);
+    if (!font) return false;
+
+    font->_allocator = alloc;
+    font->_id = bmfont__next_font_id();
+    font->page_names = (char **)((char *)font + bmfont__align8(sizeof(BMFont)));
+    for (uint32_t i = 0; i < header->num_pages; ++i) {
+        font->page_names[i] = (char *)blob + page_offsets[i];
+    }
+    font->font_name          = (char *)blob + header->font_name;
+    font->chars              = (BMFont::Char *)(blob + header->chars);
+    font->kernings           = (BMFont::Kerning *)(blob + header->kernings);
+    font->char_dense_index   = (uint32_t *)(blob + header->char_dense_index);
+    font->char_hash_index    = char_hash_slots ? (uint32_t *)(blob + header->char_hash_index)
+                                               : nullptr;
+    font->kerning_hash_index = kerning_hash_slots ? (uint32_t *)(blob + header->kerning_hash_index)
+                                                  : nullptr;
+    font->char_hash_mask     = header->char_hash_mask;
+    font->kerning_hash_mask  = header->kerning_hash_mask;
+    font->num_pages          = header->num_pages;
+    font->num_chars          = header->num_chars;
+    font->num_kernings       = header->num_kernings;
+    font->font_size          = header->font_size;
+    font->line_height        = header->line_height;
+    font->base               = header->base;
+    font->scale_w            = header->scale_w;
+    font->scale_h            = header->scale_h;
+    font->alpha_channel      = header->alpha_channel;
+    font->red_channel        = header->red_channel;
+    font->green_channel      = header->green_channel;
+    font->blue_channel       = header->blue_channel;
+    font->packed             = header->packed;
+    result->font = font;
+    return true;
+}
+
+bool bmfont_load_blob_file_r(const char *           filename,
+                             BMFontResult *         result,
+                             const BMFontAllocator *allocator) {
+    bmfont__reset_result(result);
+
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFont__FileMap map;
+    if (!bmfont__map_file(filename, &map, &alloc, result)) return false;
+
+    if (!bmfont_load_blob_r(map.data, map.size, result, &alloc)) {
+        bmfont__unmap_file(&map, &alloc);
+        return false;
+    }
+
+    BMFont *font = result->font;
+    font->_mapping = map.data;
+    font->_mapping_size = map.size;
+    if (map.kind == BMFONT__FILE_MAP_HEAP) font->_flags |= BMFONT__FONT_MAPPED_HEAP;
+    return true;
+}
+
+BMFont *bmfont_load_blob(const void *data, size_t size, const BMFontAllocator *allocator) {
+    BMFontResult result;
+    bmfont_load_blob_r(data, size, &result, allocator);
+    return bmfont__publish_result(&result);
+}
+
+BMFont *bmfont_load_blob_file(const char *filename, const BMFontAllocator *allocator) {
+    BMFontResult result;
+    bmfont_load_blob_file_r(filename, &result, allocator);
+    return bmfont__publish_result(&result);
+}
+
+bool bmfont_subset_r(const BMFont *         source,
+                     const uint32_t *       codepoints,
+                     size_t                 num_codepoints,
+                     BMFontResult *         result,
+                     const BMFontAllocator *allocator) {
+    bmfont__reset_result(result);
+    const BMFont *font = bmfont__decoded(source, result);
+    if (!font) return false;
+    CMP_BMFONT__DEFER { bmfont__release_decoded(source, font); };
+
+    // The kept records are staged in one temporary block, after a flag per char of the font, and
+    // then laid out like a font from the stream parser.
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    size_t flags_size = bmfont__align8(font->num_chars);
+    uint8_t *keep = (uint8_t *)bmfont__alloc(&alloc,
+                                             flags_size +
+                                                     font->num_chars * sizeof(BMFont::Char) +
+                                                     font->num_kernings * sizeof(BMFont::Kerning),
+                                             result);
+    if (!keep) return false;
+    CMP_BMFONT__DEFER { alloc.free(keep, alloc.user); };
+
+    for (size_t i = 0; i < num_codepoints; ++i) {
+        uint32_t index = bmfont_find_char_index(font, codepoints[i]);
+        if (index != BMFONT_NO_CHAR) keep[index] = 1;
+    }
+
+    BMFont staged = {};
+    staged.font_name     = font->font_name;
+    staged.page_names    = font->page_names;
+    staged.chars         = (BMFont::Char *)(keep + flags_size);
+    staged.kernings      = (BMFont::Kerning *)(staged.chars + font->num_chars);
+    staged.font_size     = font->font_size;
+    staged.line_height   = font->line_height;
+    staged.base          = font->base;
+    staged.scale_w       = font->scale_w;
+    staged.scale_h       = font->scale_h;
+    staged.alpha_channel = font->alpha_channel;
+    staged.red_channel   = font->red_channel;
+    staged.green_channel = font->green_channel;
+    staged.blue_channel  = font->blue_channel;
+    staged.packed        = font->packed;
+    staged.num_pages     = font->num_pages;
+
+    for (uint32_t i = 0; i < font->num_chars; ++i) {
+        if (keep[i]) staged.chars[staged.num_chars++] = font->chars[i];
+    }
+
+    // A pair is kept if both of its chars are, by the same lookup that finds them in the font.
+    for (uint32_t i = 0; i < font->num_kernings; ++i) {
+        const BMFont::Kerning *kerning = &font->kernings[i];
+        uint32_t first = bmfont_find_char_index(font, kerning->first);
+        uint32_t second = bmfont_find_char_index(font, kerning->second);
+        if (first != BMFONT_NO_CHAR && second != BMFONT_NO_CHAR && keep[first] && keep[second]) {
+            staged.kernings[staged.num_kernings++] = *kerning;
+        }
+    }
+
+    BMFont__Arena arena = {};
+    BMFont scratch;
+    bmfont__stream_assemble(&staged, &arena, &scratch);
+
+    arena.capacity = arena.size;
+    arena.size = 0;
+    arena.base = (char *)bmfont__alloc(&alloc, arena.capacity, result);
+    if (!arena.base) return false;
+
+    BMFont *subset = bmfont__stream_assemble(&staged, &arena, &scratch);
+    assert(subset && arena.size == arena.capacity);
+    subset->_allocator = alloc;
+    subset->_id = bmfont__next_font_id();
+    result->font = subset;
+    return true;
+}
+
+BMFont *bmfont_subset(const BMFont *         font,
+                      const uint32_t *       codepoints,
+                      size_t                 num_codepoints,
+                      const BMFontAllocator *allocator) {
+    BMFontResult result;
+    bmfont_subset_r(font, codepoints, num_codepoints, &result, allocator);
+    return bmfont__publish_result(&result);
+}
+
+// Output of the .fnt writers. Like a font in a BMFont__Arena, the output is produced twice: first
+// without a buffer to measure it, then into a buffer of that size.
+struct BMFont__Writer {
+    char * base;
+    size_t size;
+    size_t capacity;
+};
+
+void bmfont__write_bytes(BMFont__Writer *writer, const void *data, size_t len) {
+    if (writer->base) {
+        assert(len <= writer->capacity - writer->size);
+        memcpy(writer->base + writer->size, data, len);
+    }
+    writer->size += len;
+}
+
+// Binary .fnt files are little endian.
+void bmfont__write_u8(BMFont__Writer *writer, uint32_t value) {
+    uint8_t byte = (uint8_t)value;
+    bmfont__write_bytes(writer, &byte, 1);
+}
+
+void bmfont__write_u16(BMFont__Writer *writer, uint32_t value) {
+    uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+    bmfont__write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void bmfont__write_u32(BMFont__Writer *writer, uint32_t value) {
+    uint8_t bytes[4] = {
+            (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+    bmfont__write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void bmfont__write_format(BMFont__Writer *writer, const char *fmt, ...) {
+    // The buffer has room for the NUL that vsnprintf() appends after the last line.
+    char * dest = writer->base ? writer->base + writer->size : nullptr;
+    size_t room = writer->base ? writer->capacity - writer->size + 1 : 0;
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(dest, room, fmt, args);
+    va_end(args);
+    if (len > 0) writer->size += (size_t)len;
+}
+
+// Font names loaded from a text file keep the quotes they had there.
+bool bmfont__is_quoted(const char *name, size_t len) {
+    return len >= 2 && name[0] == '"' && name[len - 1] == '"';
+}
+
+void bmfont__write_fnt_text(const BMFont *font, BMFont__Writer *writer) {
+    // Names with spaces are quoted as the BMFont tool writes them, unless they kept their quotes.
+    const char *name = font->font_name ? font->font_name : "";
+    size_t name_len = strlen(name);
+    bool quote = !name_len || (strpbrk(name, " \t") && !bmfont__is_quoted(name, name_len));
+    bmfont__write_format(writer,
+                         quote ? "info face=\"%s\" size=%d\n" : "info face=%s size=%d\n",
+                         name,
+                         (int)font->font_size);
+
+    bmfont__write_format(writer,
+                         "common lineHeight=%u base=%u scaleW=%u scaleH=%u pages=%u packed=%u "
+                         "alphaChnl=%u redChnl=%u greenChnl=%u blueChnl=%u\n",
+                         (unsigned)font->line_height,
+                         (unsigned)font->base,
+                         (unsigned)font->scale_w,
+                         (unsigned)font->scale_h,
+                         (unsigned)font->num_pages,
+                         (unsigned)font->packed,
+                         (unsigned)font->alpha_channel,
+                         (unsigned)font->red_channel,
+                         (unsigned)font->green_channel,
+                         (unsigned)font->blue_channel);
+
+    for (uint32_t i = 0; i < font->num_pages; ++i) {
+        const char *page = font->page_names && font->page_names[i] ? font->page_names[i] : "";
+        bmfont__write_format(writer, "page id=%u file=\"%s\"\n", (unsigned)i, page);
+    }
+
+    bmfont__write_format(writer, "chars count=%u\n", (unsigned)font->num_chars);
+    for (uint32_t i = 0; i < font->num_chars; ++i) {
+        const BMFont::Char *ch = &font->chars[i];
+        bmfont__write_format(writer,
+                             "char id=%u x=%u y=%u width=%u height=%u xoffset=%d yoffset=%d "
+                             "xadvance=%u page=%u chnl=%u\n",
+                             (unsigned)ch->id,
+                             (unsigned)ch->x,
+                             (unsigned)ch->y,
+                             (unsigned)ch->width,
+                             (unsigned)ch->height,
+                             (int)ch->x_offset,
+                             (int)ch->y_offset,
+                             (unsigned)ch->x_advance,
+                             (unsigned)ch->page,
+                             (unsigned)ch->channel);
+    }
+
+    if (!font->num_kernings) return;
+    bmfont__write_format(writer, "kernings count=%u\n", (unsigned)font->num_kernings);
+    for (uint32_t i = 0; i < font->num_kernings; ++i) {
+        const BMFont::Kerning *kerning = &font->kernings[i];
+        bmfont__write_format(writer,
+                             "kerning first=%u second=%u amount=%d\n",
+                             (unsigned)kerning->first,
+                             (unsigned)kerning->second,
+                             (int)kerning->amount);
+    }
+}
+
+// Checks that the font fits the binary format. The page count is 16 bits, and readers take the
+// length of the first page name as that of every name to count the pages in the block.
+bool bmfont__binary_fnt_ok(const BMFont *font, BMFontResult *result) {
+    if (font->num_pages > 0xFFFF) {
+        bmfont__set_error(result, "Too many pages for a binary font: %u", font->num_pages);
+        return false;
+    }
+
+    size_t first_len = 0;
+    for (uint32_t i = 0; i < font->num_pages; ++i) {
+        const char *page = font->page_names && font->page_names[i] ? font->page_names[i] : "";
+        size_t len = strlen(page);
+        if (i == 0) first_len = len;
+        if (len != first_len) {
+            bmfont__set_error(result,
+                              "Page names must all have the same length in a binary font: %s",
+                              page);
+            return false;
+        }
+    }
+    return true;
+}
+
+void bmfont__write_fnt_binary(const BMFont *font, BMFont__Writer *writer) {
+    assert(font->num_pages <= 0xFFFF);
+    bmfont__write_bytes(writer, "BMF\3", 4);
+
+    // The binary format stores the name without quotes.
+    const char *name = font->font_name ? font->font_name : "";
+    size_t name_len = strlen(name);
+    if (bmfont__is_quoted(name, name_len)) {
+        name += 1;
+        name_len -= 2;
+    }
+    static const uint8_t zeros[8] = {};
+    bmfont__write_u8(writer, BMFONT__BINARY_BLOCK_INFO);
+    bmfont__write_u32(writer, (uint32_t)(BMFONT__BINARY_INFO_SIZE + name_len + 1));
+    bmfont__write_u16(writer, (uint16_t)font->font_size);
+    bmfont__write_u16(writer, 0);   // Bit field and char set
+    bmfont__write_u16(writer, 100); // stretchH
+    bmfont__write_u8(writer, 1);    // aa
+    bmfont__write_bytes(writer, zeros, 7); // Padding, spacing and outline
+    bmfont__write_bytes(writer, name, name_len);
+    bmfont__write_u8(writer, 0);
+
+    bmfont__write_u8(writer, BMFONT__BINARY_BLOCK_COMMON);
+    bmfont__write_u32(writer, BMFONT__BINARY_COMMON_SIZE);
+    bmfont__write_u16(writer, font->line_height);
+    bmfont__write_u16(writer, font->base);
+    bmfont__write_u16(writer, font->scale_w);
+    bmfont__write_u16(writer, font->scale_h);
+    bmfont__write_u16(writer, font->num_pages);
+    bmfont__write_u8(writer, (uint32_t)font->packed << 7);
+    bmfont__write_u8(writer, font->alpha_channel);
+    bmfont__write_u8(writer, font->red_channel);
+    bmfont__write_u8(writer, font->green_channel);
+    bmfont__write_u8(writer, font->blue_channel);
+
+    // All names have the same length (see bmfont__binary_fnt_ok()).
+    const char *first_page = font->num_pages && font->page_names && font->page_names[0]
+                                     ? font->page_names[0]
+                                     : "";
+    bmfont__write_u8(writer, BMFONT__BINARY_BLOCK_PAGES);
+    bmfont__write_u32(writer, font->num_pages * (uint32_t)(strlen(first_page) + 1));
+    for (uint32_t i = 0; i < font->num_pages; ++i) {
+        const char *page = font->page_names && font->page_names[i] ? font->page_names[i] : "";
+        bmfont__write_bytes(writer, page, strlen(page) + 1);
+    }
+
+    bmfont__write_u8(writer, BMFONT__BINARY_BLOCK_CHARS);
+    bmfont__write_u32(writer, font->num_chars * BMFONT__BINARY_CHAR_SIZE);
+    for (uint32_t i = 0; i < font->num_chars; ++i) {
+        const BMFont::Char *ch = &font->chars[i];
+        bmfont__write_u32(writer, ch->id);
+        bmfont__write_u16(writer, ch->x);
+        bmfont__write_u16(writer, ch->y);
+        bmfont__write_u16(writer, ch->width);
+        bmfont__write_u16(writer, ch->height);
+        bmfont__write_u16(writer, (uint16_t)ch->x_offset);
+        bmfont__write_u16(writer, (uint16_t)ch->y_offset);
+        bmfont__write_u16(writer, ch->x_advance);
+        bmfont__write_u8(writer, ch->page);
+        bmfont__write_u8(writer, ch->channel);
+    }
+
+    // Like the BMFont tool, fonts without kerning pairs have no kerning block.
+    if (!font->num_kernings) return;
+    bmfont__write_u8(writer, BMFONT__BINARY_BLOCK_KERNINGS);
+    bmfont__write_u32(writer, font->num_kernings * BMFONT__BINARY_KERNING_SIZE);
+    for (uint32_t i = 0; i < font->num_kernings; ++i) {
+        bmfont__write_u32(writer, font->kernings[i].first);
+        bmfont__write_u32(writer, font->kernings[i].second);
+        bmfont__write_u16(writer, (uint16_t)font->kernings[i].amount);
+    }
+}
+
+bool bmfont_write_fnt_r(const BMFont *source,
+                        uint32_t      format,
+                        void **       data,
+                        size_t *      size,
+                        BMFontResult *result) {
+    bmfont__reset_result(result);
+    *data = nullptr;
+    if (format != BMFONT_FORMAT_TEXT && format != BMFONT_FORMAT_BINARY) {
+        bmfont__set_error(result, "Unknown .fnt format: %u", format);
+        return false;
+    }
+    if (format == BMFONT_FORMAT_BINARY && !bmfont__binary_fnt_ok(source, result)) return false;
+
+    const BMFont *font = bmfont__decoded(source, result);
+    if (!font) return false;
+    CMP_BMFONT__DEFER { bmfont__release_decoded(source, font); };
+
+    BMFont__Writer writer = {};
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            BMFontAllocator allocator = bmfont__allocator_or_default(nullptr);
+            writer.capacity = writer.size;
+            writer.size = 0;
+            writer.base = (char *)bmfont__alloc(&allocator, writer.capacity + 1, result);
+            if (!writer.base) return false;
+        }
+
+        if (format == BMFONT_FORMAT_TEXT) {
+            bmfont__write_fnt_text(font, &writer);
+        } else {
+            bmfont__write_fnt_binary(font, &writer);
+        }
+    }
+
+    assert(writer.size == writer.capacity);
+    *data = writer.base;
+    *size = writer.size;
+    return true;
+}
+
+bool bmfont_write_fnt_file_r(const BMFont *font,
+                             const char *  filename,
+                             uint32_t      format,
+                             BMFontResult *result) {
+    void *data;
+    size_t size;
+    if (!bmfont_write_fnt_r(font, format, &data, &size, result)) return false;
+    CMP_BMFONT__DEFER { bmfont_free_blob(data); };
+
+    return bmfont__write_file(filename, data, size, result);
+}
+
+void *bmfont_write_fnt(const BMFont *font, uint32_t format, size_t *size) {
+    BMFontResult result;
+    void *data;
+    bmfont_write_fnt_r(font, format, &data, size, &result);
+    bmfont__publish_result(&result);
+    return data;
+}
+
+bool bmfont_write_fnt_file(const BMFont *font, const char *filename, uint32_t format) {
+    BMFontResult result;
+    bool ok = bmfont_write_fnt_file_r(font, filename, format, &result);
+    bmfont__publish_result(&result);
+    return ok;
+}
+
+static constexpr unsigned BMFONT__MAX_BATCH_THREADS = 64;
+
+struct BMFont__Batch {
+    const BMFontSource *   sources;
+    BMFontResult *         results;
+    const BMFontAllocator *allocator;
+    size_t                 count;
+    volatile int64_t       next; // Index of the next source to load, shared by all workers
+};
+
+int64_t bmfont__batch_take(BMFont__Batch *batch) {
+#if defined(CMP_BMFONT__WIN32_THREADS)
+    return InterlockedExchangeAdd64((volatile LONG64 *)&batch->next, 1);
+#elif defined(CMP_BMFONT__PTHREADS)
+    return __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+#else
+    return batch->next++;
+#endif
+}
+
+void bmfont__batch_work(BMFont__Batch *batch) {
+    for (;;) {
+        size_t i = (size_t)bmfont__batch_take(batch);
+        if (i >= batch->count) return;
+
+        const BMFontSource *source = &batch->sources[i];
+        if (source->filename) {
+            bmfont_parse_file_r(source->filename, &batch->results[i], batch->allocator);
+        } else {
+            bmfont_parse_memory_r(source->data, source->size, &batch->results[i], batch->allocator);
+        }
+    }
+}
+
+#if defined(CMP_BMFONT__WIN32_THREADS)
+DWORD WINAPI bmfont__batch_thread(LPVOID batch) {
+    bmfont__batch_work((BMFont__Batch *)batch);
+    return 0;
+}
+
+unsigned bmfont__core_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (unsigned)info.dwNumberOfProcessors;
+}
+#elif defined(CMP_BMFONT__PTHREADS)
+void *bmfont__batch_thread(void *batch) {
+    bmfont__batch_work((BMFont__Batch *)batch);
+    return nullptr;
+}
+
+unsigned bmfont__core_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned)count : 1;
+}
+#endif
+
+bool bmfont_parse_batch(const BMFontSource *   sources,
+                        size_t                 count,
+                        BMFontResult *         results,
+                        unsigned               num_threads,
+                        const BMFontAllocator *allocator) {
+    BMFont__Batch batch = {};
+    batch.sources = sources;
+    batch.results = results;
+    batch.allocator = allocator;
+    batch.count = count;
+
+#if defined(CMP_BMFONT__WIN32_THREADS) || defined(CMP_BMFONT__PTHREADS)
+    if (num_threads == 0) num_threads = bmfont__core_count();
+    if (num_threads > BMFONT__MAX_BATCH_THREADS) num_threads = BMFONT__MAX_BATCH_THREADS;
+    if (num_threads > count) num_threads = (unsigned)count;
+
+    // The calling thread is the first worker. If a thread can't be started, the ones that did
+    // start simply pick up its share.
+#if defined(CMP_BMFONT__WIN32_THREADS)
+    HANDLE   threads[BMFONT__MAX_BATCH_THREADS];
+    unsigned num_started = 0;
+    for (unsigned i = 1; i < num_threads; ++i) {
+        threads[num_started] = CreateThread(nullptr, 0, bmfont__batch_thread, &batch, 0, nullptr);
+        if (threads[num_started]) ++num_started;
+    }
+
+    bmfont__batch_work(&batch);
+
+    for (unsigned i = 0; i < num_started; ++i) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+#else
+    pthread_t threads[BMFONT__MAX_BATCH_THREADS];
+    unsigned  num_started = 0;
+    for (unsigned i = 1; i < num_threads; ++i) {
+        if (pthread_create(&threads[num_started], nullptr, bmfont__batch_thread, &batch) == 0) {
+            ++num_started;
+        }
+    }
+
+    bmfont__batch_work(&batch);
+
+    for (unsigned i = 0; i < num_started; ++i) pthread_join(threads[i], nullptr);
+#endif
+#else
+    (void)num_threads;
+    bmfont__batch_work(&batch);
+#endif
+
+    bool all_loaded = true;
+    for (size_t i = 0; i < count; ++i) {
+        if (!results[i].font) all_loaded = false;
+    }
+    return all_loaded;
+}
+
+// FNV-1a, for hashing file contents and strings.
+uint64_t bmfont__hash_bytes(const char *data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; ++i) hash = (hash ^ (uint8_t)data[i]) * 0x100000001B3ull;
+    return hash;
+}
+
+#ifdef CMP_BMFONT_HAS_WATCHER
+// A reader's epoch, or 0 while it isn't reading. Each slot has a cache line to itself so that
+// readers don't slow each other down.
+struct BMFont__ReaderSlot {
+    volatile uint64_t epoch;
+    volatile uint32_t in_use; // Handed out by bmfont_watcher_add_reader
+    uint8_t           _padding[52];
+};
+
+struct BMFontLive {
+    BMFont *volatile font;
+    BMFontLive *     next;
+    char *           filename;
+    char *           name; // File name within the watched directory
+    uint64_t         hash; // Of the file contents font was loaded from
+    int              wd;   // inotify watch on the directory
+    uint8_t          _padding[4];
+};
+
+struct BMFontWatcher {
+    BMFontAllocator       allocator;
+    BMFontReloadCallback *callback;
+    void *                user;
+    BMFont__ReaderSlot *  readers;
+    void *                readers_block;
+    BMFontLive *volatile  fonts; // Only ever grows until the watcher is destroyed
+    pthread_t             thread;
+    volatile uint64_t     epoch; // Advanced each time a font is replaced
+    uint32_t              max_readers;
+    int                   inotify_fd;
+    int                   wake_fd; // eventfd that tells the thread to stop
+    uint8_t               _padding[4];
+};
+
+// Loads filename unless its contents hash to *hash. Returns true and updates *hash if a font was
+// loaded, or false with result->font cleared if the file is unchanged or failed to load.
+bool bmfont__watcher_load(BMFontWatcher *watcher,
+                          const char *   filename,
+                          uint64_t *     hash,
+                          bool *         unchanged,
+                          BMFontResult * result) {
+    bmfont__reset_result(result);
+    *unchanged = false;
+
+    BMFont__FileMap map;
+    if (!bmfont__map_file(filename, &map, &watcher->allocator, result)) return false;
+    CMP_BMFONT__DEFER { bmfont__unmap_file(&map, &watcher->allocator); };
+
+    uint64_t new_hash = bmfont__hash_bytes(map.data, map.size);
+    if (new_hash == *hash) {
+        *unchanged = true;
+        return false;
+    }
+
+    if (!bmfont_parse_memory_r(map.data, map.size, result, &watcher->allocator)) return false;
+    *hash = new_hash;
+    return true;
+}
+
+// Waits until no reader can still hold a font that was replaced before the epoch advanced to
+// epoch: each reader is either outside a read or began its read at epoch or later, when the
+// replacement was already published.
+void bmfont__watcher_synchronize(BMFontWatcher *watcher, uint64_t epoch) {
+    // Slots that aren't in use have epoch 0, so it's simpler to check all of them.
+    for (uint32_t i = 0; i < watcher->max_readers; ++i) {
+        for (;;) {
+            uint64_t reader = __atomic_load_n(&watcher->readers[i].epoch, __ATOMIC_SEQ_CST);
+            if (reader == 0 || reader >= epoch) break;
+            usleep(1000);
+        }
+    }
+}
+
+void bmfont__watcher_reload(BMFontWatcher *watcher, BMFontLive *live) {
+    BMFontResult result;
+    bool unchanged;
+    if (bmfont__watcher_load(watcher, live->filename, &live->hash, &unchanged, &result)) {
+        BMFont *old = __atomic_exchange_n(&live->font, result.font, __ATOMIC_SEQ_CST);
+        uint64_t epoch = __atomic_add_fetch(&watcher->epoch, 1, __ATOMIC_SEQ_CST);
+        bmfont__watcher_synchronize(watcher, epoch);
+        bmfont_free(old);
+    }
+
+    if (!unchanged && watcher->callback) watcher->callback(live->filename, &result, watcher->user);
+}
+
+void *bmfont__watcher_thread(void *arg) {
+    BMFontWatcher *watcher = (BMFontWatcher *)arg;
+
+    // Events are variable length: a struct inotify_event followed by the file name.
+    alignas(inotify_event) char events[4096];
+    for (;;) {
+        pollfd fds[2] = {{watcher->inotify_fd, POLLIN, 0}, {watcher->wake_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        if (fds[1].revents) break;
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        ssize_t len = read(watcher->inotify_fd, events, sizeof(events));
+        for (ssize_t offset = 0; offset < len;) {
+            const inotify_event *event = (const inotify_event *)(events + offset);
+            offset += (ssize_t)(sizeof(inotify_event) + event->len);
+
+            // When the queue overflows, events were dropped and any of the files may have
+            // changed. Reloading every font is deliberate: fonts whose contents didn't change are
+            // kept after hashing their file, so this costs no more than reading each file once.
+            bool overflow = (event->mask & IN_Q_OVERFLOW) != 0;
+            if (!overflow && !event->len) continue;
+
+            BMFontLive *live = __atomic_load_n(&watcher->fonts, __ATOMIC_ACQUIRE);
+            for (; live; live = live->next) {
+                if (overflow || (live->wd == event->wd && !strcmp(live->name, event->name))) {
+                    bmfont__watcher_reload(watcher, live);
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+BMFontWatcher *bmfont_watcher_create(unsigned               max_readers,
+                                     BMFontReloadCallback * callback,
+                                     void *                 user,
+                                     const BMFontAllocator *allocator) {
+    BMFontResult result;
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFontWatcher *watcher = (BMFontWatcher *)bmfont__alloc(&alloc, sizeof(BMFontWatcher), &result);
+    if (!watcher) return nullptr;
+
+    watcher->allocator = alloc;
+    watcher->callback = callback;
+    watcher->user = user;
+    watcher->max_readers = max_readers;
+    watcher->epoch = 1;
+    watcher->inotify_fd = inotify_init1(IN_CLOEXEC);
+    watcher->wake_fd = eventfd(0, EFD_CLOEXEC);
+
+    // Over-allocate so the slots can start on a cache line.
+    size_t slot_size = sizeof(BMFont__ReaderSlot);
+    watcher->readers_block = bmfont__alloc(&alloc, (max_readers + 1) * slot_size, &result);
+    if (watcher->readers_block) {
+        uintptr_t address = (uintptr_t)watcher->readers_block;
+        watcher->readers = (BMFont__ReaderSlot *)((address + slot_size - 1) & ~(slot_size - 1));
+    }
+
+    if (watcher->inotify_fd < 0 || watcher->wake_fd < 0 || !watcher->readers ||
+        pthread_create(&watcher->thread, nullptr, bmfont__watcher_thread, watcher) != 0) {
+        if (watcher->inotify_fd >= 0) close(watcher->inotify_fd);
+        if (watcher->wake_fd >= 0) close(watcher->wake_fd);
+        if (watcher->readers_block) alloc.free(watcher->readers_block, alloc.user);
+        alloc.free(watcher, alloc.user);
+        return nullptr;
+    }
+    return watcher;
+}
+
+void bmfont_watcher_destroy(BMFontWatcher *watcher) {
+    if (!watcher) return;
+
+    uint64_t one = 1;
+    ssize_t written = write(watcher->wake_fd, &one, sizeof(one));
+    (void)written;
+    pthread_join(watcher->thread, nullptr);
+
+    BMFontAllocator alloc = watcher->allocator;
+    for (BMFontLive *live = watcher->fonts; live;) {
+        BMFontLive *next = live->next;
+        bmfont_free(live->font);
+        alloc.free(live, alloc.user);
+        live = next;
+    }
+
+    close(watcher->inotify_fd);
+    close(watcher->wake_fd);
+    alloc.free(watcher->readers_block, alloc.user);
+    alloc.free(watcher, alloc.user);
+}
+
+BMFontLive *bmfont_watcher_add(BMFontWatcher *watcher, const char *filename, BMFontResult *result) {
+    bmfont__reset_result(result);
+
+    size_t len = strlen(filename);
+    BMFontLive *live =
+            (BMFontLive *)bmfont__alloc(&watcher->allocator, sizeof(BMFontLive) + len + 1, result);
+    if (!live) return nullptr;
+
+    live->filename = (char *)(live + 1);
+    memcpy(live->filename, filename, len + 1);
+
+    // Editors often save by replacing the file, so watch its directory rather than the file.
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    char *slash = strrchr(live->filename, '/');
+    live->name = slash ? slash + 1 : live->filename;
+    if (!slash) {
+        live->wd = inotify_add_watch(watcher->inotify_fd, ".", mask);
+    } else if (slash == live->filename) {
+        live->wd = inotify_add_watch(watcher->inotify_fd, "/", mask);
+    } else {
+        *slash = '\0';
+        live->wd = inotify_add_watch(watcher->inotify_fd, live->filename, mask);
+        *slash = '/';
+    }
+
+    bool unchanged;
+    if (live->wd < 0) {
+        bmfont__set_error(result, "Failed to watch %s: %s", filename, strerror(errno));
+    } else if (bmfont__watcher_load(watcher, filename, &live->hash, &unchanged, result)) {
+        live->font = result->font;
+        live->next = __atomic_load_n(&watcher->fonts, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(
+                &watcher->fonts, &live->next, live, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+        return live;
+    }
+
+    watcher->allocator.free(live, watcher->allocator.user);
+    return nullptr;
+}
+
+int bmfont_watcher_add_reader(BMFontWatcher *watcher) {
+    for (uint32_t i = 0; i < watcher->max_readers; ++i) {
+        uint32_t free_slot = 0;
+        if (__atomic_compare_exchange_n(&watcher->readers[i].in_use, &free_slot, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Whether reader is an index that bmfont_watcher_add_reader could have returned.
+bool bmfont__watcher_reader_ok(const BMFontWatcher *watcher, int reader) {
+    return reader >= 0 && (uint32_t)reader < watcher->max_readers;
+}
+
+void bmfont_watcher_remove_reader(BMFontWatcher *watcher, int reader) {
+    if (!bmfont__watcher_reader_ok(watcher, reader)) return;
+    __atomic_store_n(&watcher->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&watcher->readers[reader].in_use, 0, __ATOMIC_RELEASE);
+}
+
+void bmfont_watcher_read_begin(BMFontWatcher *watcher, int reader) {
+    if (!bmfont__watcher_reader_ok(watcher, reader)) return;
+    // Must be visible before any font pointer is read; see bmfont__watcher_synchronize.
+    uint64_t epoch = __atomic_load_n(&watcher->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&watcher->readers[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+}
+
+void bmfont_watcher_read_end(BMFontWatcher *watcher, int reader) {
+    if (!bmfont__watcher_reader_ok(watcher, reader)) return;
+    __atomic_store_n(&watcher->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+const BMFont *bmfont_live_font(const BMFontLive *live) {
+    return __atomic_load_n(&live->font, __ATOMIC_SEQ_CST);
+}
+#endif // ifdef CMP_BMFONT_HAS_WATCHER
+
+void bmfont_free(BMFont *font) {
+    if (!font) return;
+
+    BMFontAllocator allocator = font->_allocator;
+    if (font->_mapping) {
+        BMFont__FileMap map = {};
+        map.data = (const char *)font->_mapping;
+        map.size = font->_mapping_size;
+        map.kind = (font->_flags & BMFONT__FONT_MAPPED_HEAP) ? BMFONT__FILE_MAP_HEAP
+                                                              : BMFONT__FILE_MAP_MAPPED;
+        bmfont__unmap_file(&map, &allocator);
+    }
+
+    // Everything else lives in the same block as the font.
+    allocator.free(font, allocator.user);
+}
+
+// Decodes the codepoint at *p and advances *p past it. Malformed sequences decode to U+FFFD and
+// consume a single byte.
+uint32_t bmfont__decode_utf8(const char **p, const char *end) {
+    const uint8_t *s = (const uint8_t *)*p;
+    size_t avail = (size_t)(end - *p);
+    uint32_t c = s[0];
+
+    if (c < 0x80) {
+        *p += 1;
+        return c;
+    }
+
+    size_t len;
+    uint32_t min;
+    if ((c & 0xE0) == 0xC0) {
+        len = 2;
+        min = 0x80;
+        c &= 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+        len = 3;
+        min = 0x800;
+        c &= 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+        len = 4;
+        min = 0x10000;
+        c &= 0x07;
+    } else {
+        *p += 1;
+        return 0xFFFD;
+    }
+
+    if (avail < len) {
+        *p += 1;
+        return 0xFFFD;
+    }
+    for (size_t i = 1; i < len; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *p += 1;
+            return 0xFFFD;
+        }
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+        *p += 1;
+        return 0xFFFD;
+    }
+
+    *p += len;
+    return c;
+}
+
+size_t bmfont_decode_utf8(const char *text,
+                          size_t      len,
+                          uint32_t *  codepoints,
+                          size_t      capacity,
+                          size_t *    consumed) {
+    const char *p = text;
+    const char *end = text + len;
+    size_t count = 0;
+
+    while (p != end && count != capacity) {
+#ifdef CMP_BMFONT__SSE2
+        // Widen 16 ASCII bytes to codepoints at a time, up to the first byte with the top bit set.
+        const __m128i zero = _mm_setzero_si128();
+        while (end - p >= 16 && capacity - count >= 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+            unsigned mask = (unsigned)_mm_movemask_epi8(bytes);
+            if (mask) {
+                unsigned ascii = bmfont__lowest_bit(mask);
+                for (unsigned i = 0; i < ascii; ++i) codepoints[count++] = (uint8_t)p[i];
+                p += ascii;
+                break;
+            }
+
+            __m128i low = _mm_unpacklo_epi8(bytes, zero);
+            __m128i high = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_si128((__m128i *)&codepoints[count + 0], _mm_unpacklo_epi16(low, zero));
+            _mm_storeu_si128((__m128i *)&codepoints[count + 4], _mm_unpackhi_epi16(low, zero));
+            _mm_storeu_si128((__m128i *)&codepoints[count + 8], _mm_unpacklo_epi16(high, zero));
+            _mm_storeu_si128((__m128i *)&codepoints[count + 12], _mm_unpackhi_epi16(high, zero));
+            count += 16;
+            p += 16;
+        }
+        if (p == end || count == capacity) break;
+
+        // Decode multibyte sequences one at a time until ASCII resumes with room for a block.
+        do {
+            codepoints[count++] = bmfont__decode_utf8(&p, end);
+        } while (p != end && count != capacity &&
+                 ((uint8_t)*p >= 0x80 || end - p < 16 || capacity - count < 16));
+#else
+        codepoints[count++] = bmfont__decode_utf8(&p, end);
+#endif
+    }
+
+    *consumed = (size_t)(p - text);
+    return count;
+}
+
+size_t bmfont_find_glyphs(const BMFont *       font,
+                          const char *         text,
+                          size_t               len,
+                          uint32_t *           codepoints,
+                          const BMFont::Char **chars,
+                          size_t               capacity,
+                          size_t *             consumed) {
+    size_t count = bmfont_decode_utf8(text, len, codepoints, capacity, consumed);
+
+    // Codepoints below BMFONT_DENSE_CHAR_COUNT, i.e. all of ASCII, map straight through the dense
+    // index. Lazily loaded fonts go through bmfont_find_char() to decode pending chars.
+    bool lazy = font->_char_offsets != nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t codepoint = codepoints[i];
+        if (codepoint < BMFONT_DENSE_CHAR_COUNT && !lazy) {
+            uint32_t index = font->char_dense_index[codepoint];
+            chars[i] = index ? &font->chars[index - 1] : nullptr;
+            CMP_BMFONT__COUNT_LOOKUP(index ? BMFONT__LOOKUP_CHAR_HIT : BMFONT__LOOKUP_CHAR_MISS);
+        } else {
+            chars[i] = bmfont_find_char(font, codepoint);
+        }
+    }
+    return count;
+}
+
+// Adds a glyph unless an earlier font, or an earlier char of the same font, has the codepoint.
+void bmfont__chain_add(BMFontChain *chain, uint32_t codepoint, uint32_t glyph) {
+    if (codepoint < BMFONT_DENSE_CHAR_COUNT) {
+        if (!chain->dense[codepoint]) chain->dense[codepoint] = glyph;
+        return;
+    }
+
+    uint32_t slot = bmfont__hash(codepoint) & chain->slot_mask;
+    while (chain->slots[slot].glyph && chain->slots[slot].codepoint != codepoint) {
+        slot = (slot + 1) & chain->slot_mask;
+    }
+    if (!chain->slots[slot].glyph) {
+        chain->slots[slot].codepoint = codepoint;
+        chain->slots[slot].glyph = glyph;
+    }
+}
+
+BMFontChain *bmfont_chain_create(const BMFont *const *  fonts,
+                                 uint32_t               num_fonts,
+                                 const BMFontAllocator *allocator) {
+    if (num_fonts > BMFONT_MAX_CHAIN_FONTS) return nullptr;
+
+    uint64_t total = 0;
+    for (uint32_t f = 0; f < num_fonts; ++f) total += fonts[f]->num_chars;
+    if (total > BMFONT_MAX_COUNT) return nullptr;
+
+    uint32_t capacity = bmfont__hash_capacity((uint32_t)total);
+    BMFontResult result;
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFontChain *chain = (BMFontChain *)bmfont__alloc(
+            &alloc, sizeof(BMFontChain) + capacity * sizeof(BMFont__ChainSlot), &result);
+    if (!chain) return nullptr;
+
+    chain->allocator = alloc;
+    chain->slots = (BMFont__ChainSlot *)(chain + 1);
+    chain->slot_mask = capacity - 1;
+    chain->num_fonts = num_fonts;
+    for (uint32_t f = 0; f < num_fonts; ++f) {
+        chain->fonts[f] = fonts[f];
+        for (uint32_t i = 0; i < fonts[f]->num_chars; ++i) {
+            bmfont__chain_add(chain, fonts[f]->chars[i].id, f << BMFONT__CHAIN_CHAR_BITS | (i + 1));
+        }
+    }
+    return chain;
+}
+
+void bmfont_chain_destroy(BMFontChain *chain) {
+    if (chain) chain->allocator.free(chain, chain->allocator.user);
+}
+
+size_t bmfont_chain_find_glyphs(const BMFontChain *  chain,
+                                const char *         text,
+                                size_t               len,
+                                uint32_t *           codepoints,
+                                const BMFont::Char **chars,
+                                const BMFont **      fonts,
+                                size_t               capacity,
+                                size_t *             consumed) {
+    size_t count = bmfont_decode_utf8(text, len, codepoints, capacity, consumed);
+    for (size_t i = 0; i < count; ++i) {
+        chars[i] = bmfont_chain_find_char(chain, codepoints[i], &fonts[i]);
+    }
+    return count;
+}
+
+void bmfont__write_pair(float *base, size_t stride, uint32_t vertex, float a, float b) {
+    float *dest = (float *)((char *)base + vertex * stride);
+    dest[0] = a;
+    dest[1] = b;
+}
+
+// Writes the quad of ch at index in the quad buffer.
+void bmfont__write_quad(const BMFont *      font,
+                        const BMFont::Char *ch,
+                        float               x,
+                        float               y,
+                        BMFontQuadBuffer *  quads,
+                        uint32_t            index) {
+    size_t position_stride = quads->position_stride ? quads->position_stride : 2 * sizeof(float);
+    size_t uv_stride = quads->uv_stride ? quads->uv_stride : 2 * sizeof(float);
+    uint32_t vertex = index * 4;
+
+    float x0 = x + ch->x_offset;
+    float y0 = y + ch->y_offset;
+    float x1 = x0 + ch->width;
+    float y1 = y0 + ch->height;
+    bmfont__write_pair(quads->positions, position_stride, vertex + 0, x0, y0);
+    bmfont__write_pair(quads->positions, position_stride, vertex + 1, x1, y0);
+    bmfont__write_pair(quads->positions, position_stride, vertex + 2, x1, y1);
+    bmfont__write_pair(quads->positions, position_stride, vertex + 3, x0, y1);
+
+    float inv_w = font->scale_w ? 1.0f / font->scale_w : 0.0f;
+    float inv_h = font->scale_h ? 1.0f / font->scale_h : 0.0f;
+    float u0 = ch->x * inv_w;
+    float v0 = ch->y * inv_h;
+    float u1 = (ch->x + ch->width) * inv_w;
+    float v1 = (ch->y + ch->height) * inv_h;
+    bmfont__write_pair(quads->uvs, uv_stride, vertex + 0, u0, v0);
+    bmfont__write_pair(quads->uvs, uv_stride, vertex + 1, u1, v0);
+    bmfont__write_pair(quads->uvs, uv_stride, vertex + 2, u1, v1);
+    bmfont__write_pair(quads->uvs, uv_stride, vertex + 3, u0, v1);
+
+    if (quads->channels) {
+        // Char::channel has blue in bit 0, green in bit 1, red in bit 2 and alpha in bit 3.
+        uint8_t channel = ch->channel ? ch->channel : 15;
+        uint8_t mask[4] = {(uint8_t)(channel & 4 ? 255 : 0),
+                           (uint8_t)(channel & 2 ? 255 : 0),
+                           (uint8_t)(channel & 1 ? 255 : 0),
+                           (uint8_t)(channel & 8 ? 255 : 0)};
+        size_t channel_stride = quads->channel_stride ? quads->channel_stride : 4;
+        for (uint32_t j = 0; j < 4; ++j) {
+            memcpy(quads->channels + (vertex + j) * channel_stride, mask, 4);
+        }
+    }
+}
+
+void bmfont__emit_quad(const BMFont *      font,
+                       const BMFont::Char *ch,
+                       float               x,
+                       float               y,
+                       BMFontQuadBuffer *  quads) {
+    if (quads->count == quads->capacity) {
+        quads->dropped++;
+        return;
+    }
+
+    bmfont__write_quad(font, ch, x, y, quads, quads->count);
+    quads->count++;
+}
+
+// Where a layout puts its quads. Without pages they are appended in order. With pages, the counting
+// pass only counts the quads on each page, and the next pass writes each quad after the ones
+// already written on its page.
+struct BMFont__QuadSink {
+    BMFontQuadBuffer *quads;
+    BMFontPageRange * pages;
+    uint32_t          end; // One past the last quad of the last page
+    bool              counting;
+    uint8_t           _padding[3];
+};
+
+void bmfont__sink_quad(BMFont__QuadSink *  sink,
+                       const BMFont *      font,
+                       const BMFont::Char *ch,
+                       float               x,
+                       float               y) {
+    if (!sink->pages) {
+        bmfont__emit_quad(font, ch, x, y, sink->quads);
+        return;
+    }
+    if (ch->page >= font->num_pages) return;
+
+    BMFontPageRange *range = &sink->pages[ch->page];
+    if (sink->counting) {
+        range->count++;
+        return;
+    }
+
+    // Pages are contiguous, so a page ends where the next one starts.
+    uint32_t end = ch->page + 1u < font->num_pages ? sink->pages[ch->page + 1].first : sink->end;
+    uint32_t index = range->first + range->count;
+    if (index == end) {
+        sink->quads->dropped++;
+        return;
+    }
+    bmfont__write_quad(font, ch, x, y, sink->quads, index);
+    range->count++;
+}
+
+// Number of glyphs bmfont_layout() decodes and looks up at a time.
+static constexpr size_t BMFONT__GLYPH_BATCH = 64;
+
+float bmfont__layout(const BMFont *    font,
+                     const char *      text,
+                     size_t            len,
+                     float             x,
+                     float             y,
+                     BMFont__QuadSink *sink) {
+    float pen_x = x;
+    float pen_y = y;
+    uint32_t prev = 0;
+
+    uint32_t codepoints[BMFONT__GLYPH_BATCH];
+    const BMFont::Char *chars[BMFONT__GLYPH_BATCH];
+    while (len) {
+        size_t consumed;
+        size_t count = bmfont_find_glyphs(
+                font, text, len, codepoints, chars, BMFONT__GLYPH_BATCH, &consumed);
+        text += consumed;
+        len -= consumed;
+
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t codepoint = codepoints[i];
+            if (codepoint == '\n') {
+                pen_x = x;
+                pen_y += font->line_height;
+                prev = 0;
+                continue;
+            }
+
+            const BMFont::Char *ch = chars[i];
+            if (!ch) continue;
+
+            if (prev) pen_x += bmfont_get_kerning(font, prev, codepoint);
+            if (ch->width && ch->height) bmfont__sink_quad(sink, font, ch, pen_x, pen_y);
+            pen_x += ch->x_advance;
+            prev = codepoint;
+        }
+    }
+
+    return pen_x;
+}
+
+BMFontMetrics *bmfont_metrics_create(const BMFont *         font,
+                                     bool                   with_uvs,
+                                     const BMFontAllocator *allocator) {
+    uint32_t n = font->num_chars;
+    size_t uvs_size = with_uvs ? bmfont__align8((size_t)n * 4 * sizeof(float)) : 0;
+    size_t array_size = bmfont__align8((size_t)n * sizeof(uint16_t));
+    BMFontResult result;
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFontMetrics *metrics = (BMFontMetrics *)bmfont__alloc(
+            &alloc, sizeof(BMFontMetrics) + uvs_size + 3 * array_size + n, &result);
+    if (!metrics) return nullptr;
+
+    char *arrays = (char *)(metrics + 1);
+    metrics->font = font;
+    metrics->uvs = with_uvs ? (float *)arrays : nullptr;
+    metrics->x_advances = (uint16_t *)(arrays + uvs_size);
+    metrics->x_offsets = (int16_t *)(arrays + uvs_size + array_size);
+    metrics->y_offsets = (int16_t *)(arrays + uvs_size + 2 * array_size);
+    metrics->kerning_first = (uint8_t *)(arrays + uvs_size + 3 * array_size);
+    metrics->allocator = alloc;
+    metrics->num_chars = n;
+
+    float inv_w = font->scale_w ? 1.0f / font->scale_w : 0.0f;
+    float inv_h = font->scale_h ? 1.0f / font->scale_h : 0.0f;
+    for (uint32_t i = 0; i < n; ++i) {
+        const BMFont::Char *ch = bmfont__loaded_char(font, i);
+        if (!ch) {
+            bmfont_metrics_destroy(metrics);
+            return nullptr;
+        }
+
+        metrics->x_advances[i] = ch->x_advance;
+        metrics->x_offsets[i] = ch->x_offset;
+        metrics->y_offsets[i] = ch->y_offset;
+        if (with_uvs) {
+            metrics->uvs[i * 4 + 0] = ch->x * inv_w;
+            metrics->uvs[i * 4 + 1] = ch->y * inv_h;
+            metrics->uvs[i * 4 + 2] = (ch->x + ch->width) * inv_w;
+            metrics->uvs[i * 4 + 3] = (ch->y + ch->height) * inv_h;
+        }
+    }
+
+    for (uint32_t i = 0; i < font->num_kernings; ++i) {
+        uint32_t index = bmfont_find_char_index(font, font->kernings[i].first);
+        if (index != BMFONT_NO_CHAR) metrics->kerning_first[index] = 1;
+    }
+    return metrics;
+}
+
+void bmfont_metrics_destroy(BMFontMetrics *metrics) {
+    if (metrics) metrics->allocator.free(metrics, metrics->allocator.user);
+}
+
+float bmfont_measure(const BMFontMetrics *metrics, const char *text, size_t len) {
+    const BMFont *font = metrics->font;
+    float width = 0.0f;
+    float pen_x = 0.0f;
+    uint32_t prev = 0; // Previous codepoint if it starts a kerning pair, or 0
+
+    uint32_t codepoints[BMFONT__GLYPH_BATCH];
+    while (len) {
+        size_t consumed;
+        size_t count = bmfont_decode_utf8(text, len, codepoints, BMFONT__GLYPH_BATCH, &consumed);
+        text += consumed;
+        len -= consumed;
+
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t codepoint = codepoints[i];
+            if (codepoint == '\n') {
+                if (pen_x > width) width = pen_x;
+                pen_x = 0.0f;
+                prev = 0;
+                continue;
+            }
+
+            uint32_t index = bmfont_find_char_index(font, codepoint);
+            if (index == BMFONT_NO_CHAR) continue;
+
+            if (prev) pen_x += bmfont_get_kerning(font, prev, codepoint);
+            pen_x += metrics->x_advances[index];
+            prev = metrics->kerning_first[index] ? codepoint : 0;
+        }
+    }
+
+    return pen_x > width ? pen_x : width;
+}
+
+float bmfont_layout(const BMFont *    font,
+                    const char *      text,
+                    size_t            len,
+                    float             x,
+                    float             y,
+                    BMFontQuadBuffer *quads) {
+    BMFont__QuadSink sink = {};
+    sink.quads = quads;
+    return bmfont__layout(font, text, len, x, y, &sink);
+}
+
+float bmfont_layout_paged(const BMFont *    font,
+                          const char *      text,
+                          size_t            len,
+                          float             x,
+                          float             y,
+                          BMFontQuadBuffer *quads,
+                          BMFontPageRange * pages) {
+    for (uint32_t i = 0; i < font->num_pages; ++i) pages[i] = {};
+
+    BMFont__QuadSink sink = {};
+    sink.quads = quads;
+    sink.pages = pages;
+    sink.counting = true;
+    bmfont__layout(font, text, len, x, y, &sink);
+
+    // Give each page its range, in page order. Pages past the end of the buffer get empty ranges
+    // and their glyphs are dropped when they are written.
+    uint32_t first = quads->count;
+    for (uint32_t i = 0; i < font->num_pages; ++i) {
+        uint32_t count = pages[i].count;
+        pages[i].first = first;
+        pages[i].count = 0;
+        first += count < quads->capacity - first ? count : quads->capacity - first;
+    }
+
+    sink.end = first;
+    sink.counting = false;
+    float pen_x = bmfont__layout(font, text, len, x, y, &sink);
+    quads->count = first;
+    return pen_x;
+}
+
+// A cached layout: num_quads quads at the origin, with all positions followed by all uvs, and then
+// the channel mask of every vertex.
+struct BMFont__CacheEntry {
+    BMFont__CacheEntry *hash_next;
+    BMFont__CacheEntry *lru_prev; // Towards the most recently used entry
+    BMFont__CacheEntry *lru_next;
+    const BMFont *      font;
+    const char *        text;
+    float *             vertices;
+    size_t              len;
+    size_t              size; // Bytes charged against the budget, including this header
+    uint64_t            font_id; // font->_id, as a later font can reuse the address
+    uint64_t            hash;
+    uint32_t            num_quads;
+    float               pen_x;
+};
+
+struct BMFontLayoutCache {
+    BMFontAllocator      allocator;
+    BMFont__CacheEntry **buckets;
+    BMFont__CacheEntry * lru_head; // Most recently used
+    BMFont__CacheEntry * lru_tail;
+    size_t               budget;
+    size_t               used;
+    uint64_t             hits;
+    uint64_t             misses;
+    uint64_t             evictions;
+    uint32_t             bucket_mask;
+    uint32_t             num_entries;
+};
+
+static constexpr uint32_t BMFONT__CACHE_MIN_BUCKETS = 64;
+
+BMFontLayoutCache *bmfont_layout_cache_create(size_t                 memory_budget,
+                                              const BMFontAllocator *allocator) {
+    BMFontResult result;
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFontLayoutCache *cache =
+            (BMFontLayoutCache *)bmfont__alloc(&alloc, sizeof(BMFontLayoutCache), &result);
+    if (!cache) return nullptr;
+
+    cache->buckets = (BMFont__CacheEntry **)bmfont__alloc(
+            &alloc, BMFONT__CACHE_MIN_BUCKETS * sizeof(BMFont__CacheEntry *), &result);
+    if (!cache->buckets) {
+        alloc.free(cache, alloc.user);
+        return nullptr;
+    }
+
+    cache->allocator = alloc;
+    cache->budget = memory_budget;
+    cache->bucket_mask = BMFONT__CACHE_MIN_BUCKETS - 1;
+    return cache;
+}
+
+void bmfont_layout_cache_destroy(BMFontLayoutCache *cache) {
+    if (!cache) return;
+
+    bmfont_layout_cache_clear(cache);
+    cache->allocator.free(cache->buckets, cache->allocator.user);
+    cache->allocator.free(cache, cache->allocator.user);
+}
+
+uint64_t bmfont__cache_hash(const BMFont *font, const char *text, size_t len) {
+    return bmfont__hash_bytes(text, len) ^ (uint64_t)(uintptr_t)font ^
+           font->_id * 0x9E3779B97F4A7C15ull;
+}
+
+void bmfont__cache_unlink_lru(BMFontLayoutCache *cache, BMFont__CacheEntry *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else cache->lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->lru_tail = entry->lru_prev;
+}
+
+void bmfont__cache_push_lru(BMFontLayoutCache *cache, BMFont__CacheEntry *entry) {
+    entry->lru_prev = nullptr;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = entry;
+    else cache->lru_tail = entry;
+    cache->lru_head = entry;
+}
+
+void bmfont__cache_remove(BMFontLayoutCache *cache, BMFont__CacheEntry *entry) {
+    BMFont__CacheEntry **link = &cache->buckets[entry->hash & cache->bucket_mask];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+
+    bmfont__cache_unlink_lru(cache, entry);
+    cache->used -= entry->size;
+    cache->num_entries--;
+    cache->allocator.free(entry, cache->allocator.user);
+}
+
+// Doubles the bucket array once entries outnumber buckets. If that fails the chains just get
+// longer.
+void bmfont__cache_grow(BMFontLayoutCache *cache) {
+    uint32_t num_buckets = cache->bucket_mask + 1;
+    if (cache->num_entries < num_buckets || num_buckets > UINT32_MAX / 2) return;
+
+    BMFontResult result;
+    BMFont__CacheEntry **buckets = (BMFont__CacheEntry **)bmfont__alloc(
+            &cache->allocator, 2 * (size_t)num_buckets * sizeof(BMFont__CacheEntry *), &result);
+    if (!buckets) return;
+
+    uint32_t mask = 2 * num_buckets - 1;
+    for (uint32_t i = 0; i < num_buckets; ++i) {
+        for (BMFont__CacheEntry *entry = cache->buckets[i]; entry;) {
+            BMFont__CacheEntry *next = entry->hash_next;
+            entry->hash_next = buckets[entry->hash & mask];
+            buckets[entry->hash & mask] = entry;
+            entry = next;
+        }
+    }
+
+    cache->allocator.free(cache->buckets, cache->allocator.user);
+    cache->buckets = buckets;
+    cache->bucket_mask = mask;
+}
+
+// Lays out the string at the origin into a new entry, evicting old entries to make room. Returns
+// nullptr if the layout doesn't fit in the budget or can't be allocated.
+BMFont__CacheEntry *bmfont__cache_insert(BMFontLayoutCache *cache,
+                                         const BMFont *     font,
+                                         const char *       text,
+                                         size_t             len,
+                                         uint64_t           hash) {
+    // A layout into an empty buffer counts the quads.
+    BMFontQuadBuffer counter = {};
+    bmfont_layout(font, text, len, 0.0f, 0.0f, &counter);
+
+    size_t vertex_bytes = (size_t)counter.dropped * (16 * sizeof(float) + 16);
+    size_t size = bmfont__align8(sizeof(BMFont__CacheEntry) + vertex_bytes) + len;
+    if (size > cache->budget) return nullptr;
+
+    while (cache->used + size > cache->budget) {
+        bmfont__cache_remove(cache, cache->lru_tail);
+        cache->evictions++;
+    }
+
+    BMFontResult result;
+    BMFont__CacheEntry *entry =
+            (BMFont__CacheEntry *)bmfont__alloc(&cache->allocator, size, &result);
+    if (!entry) return nullptr;
+
+    entry->font = font;
+    entry->font_id = font->_id;
+    entry->vertices = (float *)(entry + 1);
+    entry->text = (char *)entry + bmfont__align8(sizeof(BMFont__CacheEntry) + vertex_bytes);
+    memcpy((char *)entry->text, text, len);
+    entry->len = len;
+    entry->size = size;
+    entry->hash = hash;
+    entry->num_quads = counter.dropped;
+
+    BMFontQuadBuffer quads = {};
+    quads.positions = entry->vertices;
+    quads.uvs = entry->vertices + entry->num_quads * 8;
+    quads.channels = (uint8_t *)(entry->vertices + entry->num_quads * 16);
+    quads.capacity = entry->num_quads;
+    entry->pen_x = bmfont_layout(font, text, len, 0.0f, 0.0f, &quads);
+
+    BMFont__CacheEntry **bucket = &cache->buckets[hash & cache->bucket_mask];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    bmfont__cache_push_lru(cache, entry);
+    cache->used += size;
+    cache->num_entries++;
+    bmfont__cache_grow(cache);
+    return entry;
+}
+
+float bmfont_layout_cached(BMFontLayoutCache *cache,
+                           const BMFont *     font,
+                           const char *       text,
+                           size_t             len,
+                           float              x,
+                           float              y,
+                           BMFontQuadBuffer * quads) {
+    uint64_t hash = bmfont__cache_hash(font, text, len);
+    BMFont__CacheEntry *entry = cache->buckets[hash & cache->bucket_mask];
+    while (entry && (entry->hash != hash || entry->font != font || entry->font_id != font->_id ||
+                     entry->len != len || memcmp(entry->text, text, len))) {
+        entry = entry->hash_next;
+    }
+
+    if (entry) {
+        cache->hits++;
+        bmfont__cache_unlink_lru(cache, entry);
+        bmfont__cache_push_lru(cache, entry);
+    } else {
+        cache->misses++;
+        entry = bmfont__cache_insert(cache, font, text, len, hash);
+        if (!entry) return bmfont_layout(font, text, len, x, y, quads);
+    }
+
+    size_t position_stride = quads->position_stride ? quads->position_stride : 2 * sizeof(float);
+    size_t uv_stride = quads->uv_stride ? quads->uv_stride : 2 * sizeof(float);
+    size_t channel_stride = quads->channel_stride ? quads->channel_stride : 4;
+    const float *positions = entry->vertices;
+    const float *uvs = entry->vertices + entry->num_quads * 8;
+    const uint8_t *channels = (const uint8_t *)(entry->vertices + entry->num_quads * 16);
+    for (uint32_t i = 0; i < entry->num_quads; ++i) {
+        if (quads->count == quads->capacity) {
+            quads->dropped += entry->num_quads - i;
+            break;
+        }
+
+        uint32_t vertex = quads->count * 4;
+        for (uint32_t j = 0; j < 4; ++j) {
+            const float *position = &positions[(i * 4 + j) * 2];
+            const float *uv = &uvs[(i * 4 + j) * 2];
+            bmfont__write_pair(quads->positions, position_stride, vertex + j, x + position[0],
+                               y + position[1]);
+            bmfont__write_pair(quads->uvs, uv_stride, vertex + j, uv[0], uv[1]);
+            if (quads->channels) {
+                memcpy(quads->channels + (vertex + j) * channel_stride,
+                       &channels[(i * 4 + j) * 4],
+                       4);
+            }
+        }
+        quads->count++;
+    }
+
+    return x + entry->pen_x;
+}
+
+void bmfont_layout_cache_evict_font(BMFontLayoutCache *cache, const BMFont *font) {
+    for (BMFont__CacheEntry *entry = cache->lru_head; entry;) {
+        BMFont__CacheEntry *next = entry->lru_next;
+        if (entry->font == font && entry->font_id == font->_id) {
+            bmfont__cache_remove(cache, entry);
+        }
+        entry = next;
+    }
+}
+
+void bmfont_layout_cache_clear(BMFontLayoutCache *cache) {
+    while (cache->lru_tail) bmfont__cache_remove(cache, cache->lru_tail);
+}
+
+void bmfont_layout_cache_get_stats(const BMFontLayoutCache *cache, BMFontLayoutCacheStats *stats) {
+    *stats = {};
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->bytes_used = cache->used;
+    stats->budget = cache->budget;
+    stats->num_entries = cache->num_entries;
+}
+
+struct BMFontWrap {
+    BMFontAllocator      allocator;
+    const BMFont *       font;
+    const BMFontMetrics *metrics; // Where advances are read from, if not nullptr
+    BMFontLine *         lines;
+    BMFontLine *         scratch; // Lines produced by an edit before they are spliced in
+    float                max_width;
+    uint32_t             num_lines;
+    uint32_t             capacity;
+    uint32_t             scratch_count;
+    uint32_t             scratch_capacity;
+    uint8_t              _padding[4];
+};
+
+BMFontWrap *bmfont_wrap_create(const BMFont *font, const BMFontAllocator *allocator) {
+    BMFontResult result;
+    BMFontAllocator alloc = bmfont__allocator_or_default(allocator);
+    BMFontWrap *wrap = (BMFontWrap *)bmfont__alloc(&alloc, sizeof(BMFontWrap), &result);
+    if (!wrap) return nullptr;
+
+    wrap->allocator = alloc;
+    wrap->font = font;
+    return wrap;
+}
+
+void bmfont_wrap_destroy(BMFontWrap *wrap) {
+    if (!wrap) return;
+
+    wrap->allocator.free(wrap->lines, wrap->allocator.user);
+    wrap->allocator.free(wrap->scratch, wrap->allocator.user);
+    wrap->allocator.free(wrap, wrap->allocator.user);
+}
+
+void bmfont_wrap_use_metrics(BMFontWrap *wrap, const BMFontMetrics *metrics) {
+    wrap->metrics = metrics;
+}
+
+bool bmfont__wrap_reserve(BMFontWrap *wrap, BMFontLine **lines, uint32_t *capacity, size_t count) {
+    if (count <= *capacity) return true;
+    if (count > UINT32_MAX) return false;
+
+    size_t grown = *capacity ? *capacity : 16;
+    while (grown < count) grown *= 2;
+    if (grown > UINT32_MAX) grown = UINT32_MAX;
+
+    BMFontResult result;
+    BMFontLine *array =
+            (BMFontLine *)bmfont__alloc(&wrap->allocator, grown * sizeof(BMFontLine), &result);
+    if (!array) return false;
+    if (*capacity) memcpy(array, *lines, *capacity * sizeof(BMFontLine));
+
+    wrap->allocator.free(*lines, wrap->allocator.user);
+    *lines = array;
+    *capacity = (uint32_t)grown;
+    return true;
+}
+
+// Scripts that are written without spaces, and may break before and after every character.
+bool bmfont__is_ideographic(uint32_t codepoint) {
+    return (codepoint >= 0x2E80 && codepoint <= 0x9FFF) ||
+           (codepoint >= 0xAC00 && codepoint <= 0xD7AF) ||
+           (codepoint >= 0xF900 && codepoint <= 0xFAFF) ||
+           (codepoint >= 0x20000 && codepoint <= 0x3FFFF);
+}
+
+// Looks up the advance of a codepoint from the metrics table if there is one, or else from the
+// font's chars. Stores whether the codepoint may start a kerning pair in *kerns. Returns false if
+// the font doesn't have the codepoint.
+bool bmfont__wrap_advance(const BMFont *       font,
+                          const BMFontMetrics *metrics,
+                          uint32_t             codepoint,
+                          uint16_t *           advance,
+                          bool *               kerns) {
+    if (metrics) {
+        uint32_t index = bmfont_find_char_index(font, codepoint);
+        if (index == BMFONT_NO_CHAR) return false;
+        *advance = metrics->x_advances[index];
+        *kerns = metrics->kerning_first[index] != 0;
+        return true;
+    }
+
+    const BMFont::Char *ch = bmfont_find_char(font, codepoint);
+    if (!ch) return false;
+    *advance = ch->x_advance;
+    *kerns = true;
+    return true;
+}
+
+// Wraps one line starting at begin. Stores where the next line starts and returns true if the
+// line runs to the end of the text. Only looks ahead up to the first character that doesn't fit,
+// which is at most one line past begin, so an edit can't change the lines before the previous one.
+bool bmfont__wrap_line(const BMFont *       font,
+                       const BMFontMetrics *metrics,
+                       float                max_width,
+                       const char *         text,
+                       size_t               len,
+                       size_t               begin,
+                       BMFontLine *         line,
+                       size_t *             next) {
+    const char *p = text + begin;
+    const char *end = text + len;
+    size_t content_end = begin;
+    float content_width = 0.0f;
+    size_t break_end = begin; // The last break opportunity, if break_next > begin
+    size_t break_next = begin;
+    float break_width = 0.0f;
+    float pen_x = 0.0f;
+    uint32_t prev = 0; // Previous codepoint if it may start a kerning pair, or 0
+
+    *line = {};
+    line->begin = begin;
+    while (p != end) {
+        size_t at = (size_t)(p - text);
+        uint32_t codepoint = bmfont__decode_utf8(&p, end);
+        if (codepoint == '\n') {
+            line->end = content_end;
+            line->width = content_width;
+            *next = (size_t)(p - text);
+            return false;
+        }
+
+        // Spaces after the content hang past the edge; spaces that start a line are indentation.
+        bool space = codepoint == ' ' && content_end != begin;
+        bool ideographic = bmfont__is_ideographic(codepoint);
+        if (space) {
+            if (break_next <= content_end) {
+                break_end = content_end;
+                break_width = content_width;
+            }
+            break_next = (size_t)(p - text);
+        } else if (ideographic && at != begin && break_next <= content_end) {
+            break_end = break_next = content_end;
+            break_width = content_width;
+        }
+
+        uint16_t x_advance;
+        bool kerns;
+        if (!bmfont__wrap_advance(font, metrics, codepoint, &x_advance, &kerns)) {
+            if (!space) content_end = (size_t)(p - text);
+            continue;
+        }
+
+        float advance = (prev ? bmfont_get_kerning(font, prev, codepoint) : 0) + x_advance;
+        if (!space && at != begin && pen_x + advance > max_width) {
+            if (break_next > begin) {
+                line->end = break_end;
+                line->width = break_width;
+                *next = break_next;
+            } else {
+                line->end = content_end;
+                line->width = content_width;
+                *next = at;
+            }
+            return false;
+        }
+
+        pen_x += advance;
+        prev = kerns ? codepoint : 0;
+        if (!space) {
+            content_end = (size_t)(p - text);
+            content_width = pen_x;
+        }
+        if (ideographic) {
+            break_end = break_next = content_end;
+            break_width = content_width;
+        }
+    }
+
+    line->end = content_end;
+    line->width = content_width;
+    *next = len;
+    return true;
+}
+
+bool bmfont_wrap_text(BMFontWrap *wrap, const char *text, size_t len, float max_width) {
+    wrap->max_width = max_width;
+    wrap->num_lines = 0;
+
+    size_t begin = 0;
+    for (;;) {
+        if (!bmfont__wrap_reserve(wrap, &wrap->lines, &wrap->capacity, wrap->num_lines + 1)) {
+            return false;
+        }
+        BMFontLine *line = &wrap->lines[wrap->num_lines++];
+        if (bmfont__wrap_line(
+                    wrap->font, wrap->metrics, max_width, text, len, begin, line, &begin)) {
+            return true;
+        }
+    }
+}
+
+bool bmfont_wrap_edit(BMFontWrap *wrap,
+                      const char *text,
+                      size_t      len,
+                      size_t      offset,
+                      size_t      removed,
+                      size_t      inserted,
+                      uint32_t *  first_line,
+                      uint32_t *  num_lines) {
+    // Find the line holding the edit. The line before it can change too, e.g. when the first word
+    // of the edited line becomes short enough to move up.
+    uint32_t low = 0;
+    uint32_t high = wrap->num_lines;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (wrap->lines[mid].begin <= offset) low = mid;
+        else high = mid;
+    }
+    uint32_t start = low ? low - 1 : 0;
+
+    // Wrap until a line starts where an old line after the edit started, shifted by the size
+    // change. Wrapping only depends on the text from a line's start on, so from there the old
+    // lines are still valid.
+    size_t old_edit_end = offset + removed;
+    size_t delta = inserted - removed; // Wraps around when shrinking, which the sums undo
+    uint32_t reuse = low + 1;
+    size_t begin = wrap->num_lines ? wrap->lines[start].begin : 0;
+    wrap->scratch_count = 0;
+    for (;;) {
+        if (!bmfont__wrap_reserve(
+                    wrap, &wrap->scratch, &wrap->scratch_capacity, wrap->scratch_count + 1)) {
+            return false;
+        }
+        BMFontLine *line = &wrap->scratch[wrap->scratch_count++];
+        if (bmfont__wrap_line(
+                    wrap->font, wrap->metrics, wrap->max_width, text, len, begin, line, &begin)) {
+            reuse = wrap->num_lines;
+            break;
+        }
+
+        while (reuse < wrap->num_lines && (wrap->lines[reuse].begin < old_edit_end ||
+                                           wrap->lines[reuse].begin + delta < begin)) {
+            reuse++;
+        }
+        if (reuse < wrap->num_lines && wrap->lines[reuse].begin + delta == begin) break;
+    }
+
+    uint32_t kept = wrap->num_lines - reuse;
+    size_t total = (size_t)start + wrap->scratch_count + kept;
+    if (!bmfont__wrap_reserve(wrap, &wrap->lines, &wrap->capacity, total)) return false;
+
+    BMFontLine *tail = &wrap->lines[start + wrap->scratch_count];
+    memmove(tail, &wrap->lines[reuse], kept * sizeof(BMFontLine));
+    for (uint32_t i = 0; i < kept; ++i) {
+        tail[i].begin += delta;
+        tail[i].end += delta;
+    }
+    memcpy(&wrap->lines[start], wrap->scratch, wrap->scratch_count * sizeof(BMFontLine));
+    wrap->num_lines = (uint32_t)total;
+
+    if (first_line) *first_line = start;
+    if (num_lines) *num_lines = wrap->scratch_count;
+    return true;
+}
+
+const BMFontLine *bmfont_wrap_get_lines(const BMFontWrap *wrap, uint32_t *num_lines) {
+    *num_lines = wrap->num_lines;
+    return wrap->lines;
+}
+
+float bmfont_layout_wrapped(const BMFontWrap *wrap,
+                            const char *      text,
+                            uint32_t          first_line,
+                            uint32_t          num_lines,
+                            float             x,
+                            float             y,
+                            BMFontQuadBuffer *quads) {
+    uint32_t end = first_line + num_lines;
+    if (end > wrap->num_lines || end < first_line) end = wrap->num_lines;
+
+    for (uint32_t i = first_line; i < end; ++i) {
+        const BMFontLine *line = &wrap->lines[i];
+        bmfont_layout(wrap->font, text + line->begin, line->end - line->begin, x, y, quads);
+        y += wrap->font->line_height;
+    }
+    return y;
+}
+
+const char *bmfont_get_error_string()
+{
+    return bmfont__error;
+}
+
+} // namespace cmp
+
+#endif // ifdef CMP_BMFONT_IMPLEMENTATION
+
+
+#ifdef CMP_BMFONT_SELF_TEST
+
+#include <stdio.h>
+
+using namespace cmp;
+
+#define ASSERT_NULLPTR(actual)                                                                     \
+    if (actual != nullptr) {                                                                       \
+        printf("%s(%d): failed: expected nullptr, got: %p\n", __FILE__, __LINE__, actual);         \
+        fail = true;                                                                               \
+    }
+
+
+#define ASSERT_TRUE(actual)                                                                        \
+    if (!(actual)) {                                                                               \
+        printf("%s(%d): failed: expected true: %s\n", __FILE__, __LINE__, #actual);               \
+        fail = true;                                                                               \
+    }
+
+#define ASSERT_STR_EQ(expected, actual)                                                            \
+    if (actual == nullptr || strcmp(expected, actual)) {                                           \
+        printf("%s(%d): failed: expected: '%s', got: '%s'\n",                                      \
+               __FILE__,                                                                           \
+               __LINE__,                                                                           \
+               expected,                                                                           \
+               actual);                                                                            \
+        fail = true;                                                    \
+    }
+
+#define ASSERT_FLOAT_EQ(expected, actual)                                                          \
+    if (expected != actual) {                                                                      \
+        printf("%s(%d): failed: expected: %f, got: %f\n", __FILE__, __LINE__, expected, actual);   \
+        fail = true;                                                                               \
+    }
+
+#define ASSERT_INT_EQ(expected, actual)                                                            \
+    if (expected != actual) {                                                                      \
+        printf("%s(%d): failed: expected: %d, got: %d\n", __FILE__, __LINE__, expected, actual);   \
+        fail = true;                                                                               \
+    }
+
+static bool fail = false;
+
+static char *read_test_file(const char *filename, size_t *size) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) return nullptr;
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = (char *)malloc(*size + 1);
+    *size = fread(data, 1, *size, file);
+    fclose(file);
+    return data;
+}
+
+// Feeds a file to a stream parser chunk_size bytes at a time.
+static bool stream_test_file(const char *filename, size_t chunk_size, BMFontResult *result) {
+    size_t size = 0;
+    char *data = read_test_file(filename, &size);
+    if (!data) return false;
+
+    BMFontStreamParser *parser = bmfont_parser_create();
+    for (size_t offset = 0; offset < size; offset += chunk_size) {
+        size_t len = size - offset < chunk_size ? size - offset : chunk_size;
+        if (!bmfont_parser_feed(parser, data + offset, len)) break;
+    }
+    free(data);
+    return bmfont_parser_finish(parser, result);
+}
+
+// Writes the font in format and loads it back. Returns nullptr on error.
+static BMFont *round_trip_fnt(const BMFont *font, uint32_t format) {
+    size_t size;
+    void *data = bmfont_write_fnt(font, format, &size);
+    if (!data) return nullptr;
+    BMFont *copy = bmfont_parse_memory((const char *)data, size);
+    bmfont_free_blob(data);
+    return copy;
+}
+
+// Compares everything that the .fnt formats keep.
+static bool same_font(const BMFont *a, const BMFont *b) {
+    bool same = !strcmp(a->font_name, b->font_name) && a->font_size == b->font_size &&
+                a->line_height == b->line_height && a->base == b->base &&
+                a->scale_w == b->scale_w && a->scale_h == b->scale_h &&
+                a->alpha_channel == b->alpha_channel && a->red_channel == b->red_channel &&
+                a->green_channel == b->green_channel && a->blue_channel == b->blue_channel &&
+                a->packed == b->packed && a->num_pages == b->num_pages &&
+                a->num_chars == b->num_chars && a->num_kernings == b->num_kernings;
+    for (uint32_t i = 0; same && i < a->num_pages; ++i) {
+        same = !strcmp(a->page_names[i], b->page_names[i]);
+    }
+    same = same && (!a->num_chars || !memcmp(a->chars, b->chars, a->num_chars * sizeof(*a->chars)));
+    for (uint32_t i = 0; same && i < a->num_kernings; ++i) {
+        same = a->kernings[i].first == b->kernings[i].first &&
+               a->kernings[i].second == b->kernings[i].second &&
+               a->kernings[i].amount == b->kernings[i].amount;
+    }
+    return same;
+}
+
+struct CountingAllocator {
+    int live;
+    int total;
+};
+
+static void *counting_alloc(size_t size, void *user) {
+    CountingAllocator *counts = (CountingAllocator *)user;
+    counts->live++;
+    counts->total++;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr, void *user) {
+    CountingAllocator *counts = (CountingAllocator *)user;
+    counts->live--;
+    free(ptr);
+}
+
+// Hands out the same block every time, so that a font is loaded where the last one was freed.
+struct FixedBlock {
+    alignas(8) char data[4096];
+    size_t used;
+};
+
+static void *fixed_alloc(size_t size, void *user) {
+    FixedBlock *block = (FixedBlock *)user;
+    if (block->used || size > sizeof(block->data)) return nullptr;
+    block->used = 1;
+    return block->data;
+}
+
+static void fixed_free(void *, void *user) {
+    ((FixedBlock *)user)->used = 0;
+}
+
+#ifdef CMP_BMFONT_HAS_WATCHER
+struct ReloadLog {
+    int reloads;
+    int failures;
+};
+
+static void log_reload(const char *, const BMFontResult *result, void *user) {
+    ReloadLog *log = (ReloadLog *)user;
+    __atomic_add_fetch(result->font ? &log->reloads : &log->failures, 1, __ATOMIC_SEQ_CST);
+}
+
+static void write_test_file(const char *filename, const char *data, size_t size) {
+    FILE *file = fopen(filename, "wb");
+    if (!file) return;
+    fwrite(data, 1, size, file);
+    fclose(file);
+}
+
+// Polls a count updated by the watcher thread until it reaches expected, for up to five seconds.
+static bool wait_for_count(const int *count, int expected) {
+    for (int i = 0; i < 5000; ++i) {
+        if (__atomic_load_n(count, __ATOMIC_SEQ_CST) >= expected) return true;
+        usleep(1000);
+    }
+    return false;
+}
+#endif
+
+#ifdef CMP_BMFONT_STATS
+struct LoadLog {
+    int             loads;
+    bool            loaded;
+    uint8_t         _padding[3];
+    char            filename[64];
+    BMFontLoadStats stats;
+};
+
+static void log_load(const char *filename, const BMFontResult *result,
+                     const BMFontLoadStats *stats, void *user) {
+    LoadLog *log = (LoadLog *)user;
+    log->loads++;
+    log->loaded = result->font != nullptr;
+    snprintf(log->filename, sizeof(log->filename), "%s", filename ? filename : "");
+    log->stats = *stats;
+}
+#endif
+
+#ifdef CMP_BMFONT_HAS_EMBED
+// Same contents as test_data/valid.fnt, with a char outside the dense range added.
+static constexpr char embedded_text[] =
+        "info face=valid size=8 bold=0 italic=0 charset= unicode= stretchH=100 smooth=1 aa=1 "
+        "padding=2,2,2,2 spacing=0,0 outline=0\n"
+        "common lineHeight=8 base=7 scaleW=128 scaleH=512 pages=1 packed=0\n"
+        "page id=0 file=\"valid.png\"\n"
+        "chars count=4\n"
+        "char id=33 x=2 y=3 width=6 height=7 xoffset=0 yoffset=1 xadvance=8 page=0 chnl=15\n"
+        "char id=34 x=2 y=11 width=6 height=3 xoffset=0 yoffset=0 xadvance=8 page=0 chnl=15\n"
+        "char id=32 x=0 y=0 width=0 height=0 xoffset=0 yoffset=7 xadvance=8 page=0 chnl=15\n"
+        "char id=19968 x=9 y=3 width=8 height=8 xoffset=-1 yoffset=0 xadvance=9 page=0 chnl=15\n"
+        "kernings count=2\n"
+        "kerning first=33 second=34 amount=-4\n"
+        "kerning first=32 second=34 amount=-5\n";
+
+static constexpr CMP_BMFONT_EMBEDDED_TYPE(embedded_text) embedded(embedded_text,
+                                                                  sizeof(embedded_text));
+
+// Lookups into an embedded font fold to constants, unless they are counted.
+#ifndef CMP_BMFONT_STATS
+static_assert(bmfont_find_char(&embedded.font, 34)->y == 11, "embedded find_char");
+static_assert(bmfont_find_char(&embedded.font, 34)->channel == 15, "embedded find_char");
+static_assert(bmfont_find_char(&embedded.font, 19968)->x_offset == -1, "embedded find_char");
+static_assert(bmfont_find_char(&embedded.font, 35) == nullptr, "embedded find_char");
+static_assert(bmfont_get_kerning(&embedded.font, 32, 34) == -5, "embedded get_kerning");
+#endif
+#endif
 
 int main() {
     BMFont *font = bmfont_parse_file("test_data/valid.fnt");
@@ -683,11 +5965,668 @@ int main() {
     ASSERT_INT_EQ(1, font->chars[0].y_offset);
     ASSERT_INT_EQ(8, font->chars[0].x_advance);
     ASSERT_INT_EQ(0, font->chars[0].page);
+    ASSERT_INT_EQ(15, font->chars[0].channel);
     ASSERT_INT_EQ(2, font->num_kernings);
     ASSERT_INT_EQ(33, font->kernings[0].first);
     ASSERT_INT_EQ(34, font->kernings[0].second);
     ASSERT_INT_EQ(-4, font->kernings[0].amount);
 
+    ASSERT_TRUE(bmfont_find_char(font, 32) == &font->chars[2]);
+    ASSERT_TRUE(bmfont_find_char(font, 33) == &font->chars[0]);
+    ASSERT_TRUE(bmfont_find_char(font, 34) == &font->chars[1]);
+    ASSERT_NULLPTR(bmfont_find_char(font, 35));
+    ASSERT_NULLPTR(bmfont_find_char(font, 0x10FFFF));
+
+    ASSERT_INT_EQ(-4, bmfont_get_kerning(font, 33, 34));
+    ASSERT_INT_EQ(-5, bmfont_get_kerning(font, 32, 34));
+    ASSERT_INT_EQ(0, bmfont_get_kerning(font, 34, 33));
+    ASSERT_INT_EQ(0, bmfont_get_kerning(font, 34, 34));
+
+    {
+        // Interleaved: position followed by uv in each vertex.
+        float vertices[2 * 4 * 4];
+        BMFontQuadBuffer quads = {};
+        quads.positions = &vertices[0];
+        quads.uvs = &vertices[2];
+        quads.position_stride = 4 * sizeof(float);
+        quads.uv_stride = 4 * sizeof(float);
+        quads.capacity = 2;
+
+        // The space has no quad, and the kerning between ' ' and '"' pulls '"' back by 5.
+        float pen_x = bmfont_layout(font, "! \"", 3, 10.0f, 20.0f, &quads);
+        ASSERT_FLOAT_EQ(29.0f, pen_x);
+        ASSERT_INT_EQ(2, quads.count);
+        ASSERT_INT_EQ(0, quads.dropped);
+        ASSERT_FLOAT_EQ(10.0f, vertices[0]);
+        ASSERT_FLOAT_EQ(21.0f, vertices[1]);
+        ASSERT_FLOAT_EQ(2.0f / 128.0f, vertices[2]);
+        ASSERT_FLOAT_EQ(3.0f / 512.0f, vertices[3]);
+        ASSERT_FLOAT_EQ(16.0f, vertices[2 * 4 + 0]);
+        ASSERT_FLOAT_EQ(28.0f, vertices[2 * 4 + 1]);
+        ASSERT_FLOAT_EQ(8.0f / 128.0f, vertices[2 * 4 + 2]);
+        ASSERT_FLOAT_EQ(10.0f / 512.0f, vertices[2 * 4 + 3]);
+        ASSERT_FLOAT_EQ(21.0f, vertices[4 * 4 + 0]);
+        ASSERT_FLOAT_EQ(20.0f, vertices[4 * 4 + 1]);
+
+        // Separate arrays, appending to the existing batch until it is full.
+        float positions[2 * 4 * 3];
+        float uvs[2 * 4 * 3];
+        quads = {};
+        quads.positions = positions;
+        quads.uvs = uvs;
+        quads.capacity = 3;
+
+        bmfont_layout(font, "!", 1, 0.0f, 0.0f, &quads);
+        bmfont_layout(font, "\"\n!!", 4, 0.0f, 0.0f, &quads);
+        ASSERT_INT_EQ(3, quads.count);
+        ASSERT_INT_EQ(1, quads.dropped);
+        ASSERT_FLOAT_EQ(0.0f, positions[8 * 2 + 0]);
+        ASSERT_FLOAT_EQ(9.0f, positions[8 * 2 + 1]);
+        ASSERT_FLOAT_EQ(8.0f / 128.0f, uvs[8 * 2 + 2]);
+        ASSERT_FLOAT_EQ(3.0f / 512.0f, uvs[8 * 2 + 3]);
+    }
+
+    {
+        // 'A' and 'C' are on page 0, 'B' and 'D' on page 1.
+        BMFont *paged = bmfont_parse_file("test_data/valid_two_pages.fnt");
+        ASSERT_TRUE(paged != nullptr);
+        ASSERT_INT_EQ(2, paged->num_pages);
+        ASSERT_INT_EQ(1, bmfont_find_char(paged, 'B')->page);
+        ASSERT_INT_EQ(2, bmfont_find_char(paged, 'C')->channel);
+
+        float positions[2 * 4 * 8];
+        float uvs[2 * 4 * 8];
+        BMFontQuadBuffer quads = {};
+        quads.positions = positions;
+        quads.uvs = uvs;
+        quads.capacity = 8;
+
+        // Same quads and pen position as bmfont_layout(), sorted by page.
+        BMFontPageRange pages[2];
+        const char *text = "AB CD\nBA";
+        float pen_x = bmfont_layout_paged(paged, text, strlen(text), 0.0f, 0.0f, &quads, pages);
+        BMFontQuadBuffer unsorted = quads;
+        unsorted.count = 0;
+        ASSERT_FLOAT_EQ(bmfont_layout(paged, text, strlen(text), 0.0f, 0.0f, &unsorted), pen_x);
+        ASSERT_FLOAT_EQ(14.0f, pen_x);
+        ASSERT_INT_EQ(0, (int)pages[0].first);
+        ASSERT_INT_EQ(3, (int)pages[0].count);
+        ASSERT_INT_EQ(3, (int)pages[1].first);
+        ASSERT_INT_EQ(3, (int)pages[1].count);
+        ASSERT_INT_EQ(6, quads.count);
+
+        // bmfont_layout() wrote over the same buffer.
+        quads.count = 0;
+        bmfont_layout_paged(paged, text, strlen(text), 0.0f, 0.0f, &quads, pages);
+        const float expected_x[] = {0.0f, 17.0f, 7.0f, 6.0f, 24.0f, 0.0f};
+        const float expected_y[] = {1.0f, 1.0f, 11.0f, 1.0f, 1.0f, 11.0f};
+        for (int i = 0; i < 6; ++i) {
+            ASSERT_FLOAT_EQ(expected_x[i], positions[i * 8 + 0]);
+            ASSERT_FLOAT_EQ(expected_y[i], positions[i * 8 + 1]);
+        }
+
+        // Appends after existing quads; what doesn't fit is dropped from the last pages first.
+        quads.count = 0;
+        quads.capacity = 4;
+        ASSERT_INT_EQ(0, quads.dropped);
+        bmfont_layout(paged, "A", 1, 0.0f, 0.0f, &quads);
+        bmfont_layout_paged(paged, text, strlen(text), 0.0f, 0.0f, &quads, pages);
+        ASSERT_INT_EQ(1, (int)pages[0].first);
+        ASSERT_INT_EQ(3, (int)pages[0].count);
+        ASSERT_INT_EQ(4, (int)pages[1].first);
+        ASSERT_INT_EQ(0, (int)pages[1].count);
+        ASSERT_INT_EQ(4, quads.count);
+        ASSERT_INT_EQ(3, quads.dropped);
+        ASSERT_FLOAT_EQ(17.0f, positions[2 * 8]);
+        bmfont_free(paged);
+
+        paged = bmfont_parse_file_lazy("test_data/valid_two_pages.fnt");
+        ASSERT_INT_EQ(1, bmfont_find_char(paged, 'D')->page);
+        ASSERT_INT_EQ(1, bmfont_find_char(paged, 'D')->channel);
+        bmfont_free(paged);
+    }
+
+    {
+        // Packed: 'A' is in the red channel, 'C' in green and 'D' in blue.
+        BMFont *packed = bmfont_parse_file("test_data/valid_two_pages.fnt");
+        ASSERT_INT_EQ(1, packed->packed);
+        ASSERT_INT_EQ(1, packed->alpha_channel);
+        ASSERT_INT_EQ(0, packed->red_channel);
+        ASSERT_INT_EQ(0, font->packed);
+
+        float positions[2 * 4 * 4];
+        float uvs[2 * 4 * 4];
+        uint8_t channels[4 * 4 * 4];
+        BMFontQuadBuffer quads = {};
+        quads.positions = positions;
+        quads.uvs = uvs;
+        quads.channels = channels;
+        quads.capacity = 4;
+        bmfont_layout(packed, "AC D", 4, 0.0f, 0.0f, &quads);
+        bmfont_layout(font, "!", 1, 0.0f, 0.0f, &quads);
+        ASSERT_INT_EQ(4, quads.count);
+        const uint8_t expected[4][4] = {
+                {255, 0, 0, 0}, {0, 255, 0, 0}, {0, 0, 255, 0}, {255, 255, 255, 255}};
+        bool masks_match = true;
+        for (int v = 0; v < 16; ++v) masks_match &= !memcmp(&channels[v * 4], expected[v / 4], 4);
+        ASSERT_TRUE(masks_match);
+
+        // Cached layouts keep the masks, here into an interleaved buffer.
+        BMFontLayoutCache *cache = bmfont_layout_cache_create(1024);
+        float vertices[5 * 4 * 3];
+        quads = {};
+        quads.positions = &vertices[0];
+        quads.uvs = &vertices[2];
+        quads.channels = (uint8_t *)&vertices[4];
+        quads.position_stride = quads.uv_stride = quads.channel_stride = 5 * sizeof(float);
+        quads.capacity = 3;
+        for (int i = 0; i < 2; ++i) {
+            quads.count = 0;
+            memset(vertices, 0, sizeof(vertices));
+            bmfont_layout_cached(cache, packed, "AC D", 4, 0.0f, 0.0f, &quads);
+            masks_match = true;
+            for (int v = 0; v < 12; ++v) {
+                masks_match &= !memcmp(&vertices[v * 5 + 4], expected[v / 4], 4);
+            }
+            ASSERT_TRUE(masks_match);
+        }
+        bmfont_layout_cache_destroy(cache);
+
+        // Chars without a channel use all four.
+        const char text[] = "info face=a size=8\n"
+                            "common lineHeight=8 base=7 scaleW=64 scaleH=64 pages=1\n"
+                            "page id=0 file=\"a.png\"\n"
+                            "chars count=1\n"
+                            "char id=65 x=0 y=0 width=2 height=2 xoffset=0 yoffset=0 xadvance=3\n";
+        BMFont *plain = bmfont_parse_memory(text, sizeof(text) - 1);
+        quads = {};
+        quads.positions = positions;
+        quads.uvs = uvs;
+        quads.channels = channels;
+        quads.capacity = 1;
+        bmfont_layout(plain, "A", 1, 0.0f, 0.0f, &quads);
+        ASSERT_TRUE(!memcmp(channels, expected[3], 4));
+        bmfont_free(plain);
+
+        // The blob keeps the packing.
+        size_t blob_size;
+        void *blob = bmfont_write_blob(packed, &blob_size);
+        BMFont *view = bmfont_load_blob(blob, blob_size);
+        ASSERT_INT_EQ(1, view->packed);
+        ASSERT_INT_EQ(1, view->alpha_channel);
+        bmfont_free(view);
+        bmfont_free_blob(blob);
+        bmfont_free(packed);
+
+        // In the binary format packed is bit 7 of the common block's bit field.
+        size_t size;
+        char *data = read_test_file("test_data/valid_binary.fnt", &size);
+        uint8_t *common = (uint8_t *)data + 4 + 5 + bmfont__read_u32((uint8_t *)data + 5) + 5;
+        common[10] |= 0x80;
+        common[11] = 2;
+        common[14] = 4;
+        packed = bmfont_parse_memory(data, size);
+        ASSERT_INT_EQ(1, packed->packed);
+        ASSERT_INT_EQ(2, packed->alpha_channel);
+        ASSERT_INT_EQ(4, packed->blue_channel);
+        bmfont_free(packed);
+        free(data);
+    }
+
+    {
+        // ASCII blocks, multibyte sequences, a stray continuation byte and a truncated sequence,
+        // which decodes to one U+FFFD per byte.
+        const char text[] = "!\"! abcdefghijklmnopqrstuvwxyz\xC3\xA9\xE4\xB8\x80\xF0\x9F\x98\x80"
+                            "0123456789ABCDEF!\x80!\xE4\xB8";
+        uint32_t codepoints[64];
+        size_t consumed;
+        size_t count = bmfont_decode_utf8(text, sizeof(text) - 1, codepoints, 64, &consumed);
+        ASSERT_INT_EQ(54, (int)count);
+        ASSERT_INT_EQ((int)sizeof(text) - 1, (int)consumed);
+        ASSERT_INT_EQ('!', codepoints[0]);
+        ASSERT_INT_EQ('z', codepoints[29]);
+        ASSERT_INT_EQ(0xE9, codepoints[30]);
+        ASSERT_INT_EQ(0x4E00, codepoints[31]);
+        ASSERT_INT_EQ(0x1F600, codepoints[32]);
+        ASSERT_INT_EQ('F', codepoints[48]);
+        ASSERT_INT_EQ(0xFFFD, codepoints[50]);
+        ASSERT_INT_EQ(0xFFFD, codepoints[53]);
+
+        // Stops when the output is full, after whole sequences.
+        count = bmfont_decode_utf8(text, sizeof(text) - 1, codepoints, 31, &consumed);
+        ASSERT_INT_EQ(31, (int)count);
+        ASSERT_INT_EQ(32, (int)consumed);
+        count = bmfont_decode_utf8(text + consumed, sizeof(text) - 1 - consumed, codepoints, 1,
+                                   &consumed);
+        ASSERT_INT_EQ(0x4E00, codepoints[0]);
+        ASSERT_INT_EQ(3, (int)consumed);
+
+        const BMFont::Char *chars[64];
+        count = bmfont_find_glyphs(font, text, sizeof(text) - 1, codepoints, chars, 64, &consumed);
+        ASSERT_INT_EQ(54, (int)count);
+        ASSERT_TRUE(chars[0] == &font->chars[0]);
+        ASSERT_TRUE(chars[1] == &font->chars[1]);
+        ASSERT_TRUE(chars[3] == &font->chars[2]);
+        ASSERT_NULLPTR(chars[4]);
+        ASSERT_NULLPTR(chars[31]);
+    }
+
+    {
+        // Fits "! \"" (two quads) and "!" (one quad), but not a third string as well.
+        BMFontLayoutCache *cache = bmfont_layout_cache_create(420);
+        ASSERT_TRUE(cache != nullptr);
+
+        float expected[2 * 4 * 2];
+        float expected_uvs[2 * 4 * 2];
+        BMFontQuadBuffer reference = {};
+        reference.positions = expected;
+        reference.uvs = expected_uvs;
+        reference.capacity = 2;
+        float expected_pen_x = bmfont_layout(font, "! \"", 3, 10.0f, 20.0f, &reference);
+
+        float vertices[2 * 4 * 4];
+        for (int i = 0; i < 2; ++i) {
+            BMFontQuadBuffer quads = {};
+            quads.positions = &vertices[0];
+            quads.uvs = &vertices[2];
+            quads.position_stride = 4 * sizeof(float);
+            quads.uv_stride = 4 * sizeof(float);
+            quads.capacity = 2;
+            float pen_x = bmfont_layout_cached(cache, font, "! \"", 3, 10.0f, 20.0f, &quads);
+            ASSERT_FLOAT_EQ(expected_pen_x, pen_x);
+            ASSERT_INT_EQ(2, quads.count);
+            for (int v = 0; v < 8; ++v) {
+                ASSERT_FLOAT_EQ(expected[v * 2 + 0], vertices[v * 4 + 0]);
+                ASSERT_FLOAT_EQ(expected[v * 2 + 1], vertices[v * 4 + 1]);
+                ASSERT_FLOAT_EQ(expected_uvs[v * 2 + 0], vertices[v * 4 + 2]);
+                ASSERT_FLOAT_EQ(expected_uvs[v * 2 + 1], vertices[v * 4 + 3]);
+            }
+        }
+
+        // A hit at another position is translated, and a full buffer counts dropped quads.
+        BMFontQuadBuffer quads = {};
+        quads.positions = &vertices[0];
+        quads.uvs = &vertices[8];
+        quads.capacity = 1;
+        ASSERT_FLOAT_EQ(19.0f, bmfont_layout_cached(cache, font, "! \"", 3, 0.0f, 0.0f, &quads));
+        ASSERT_INT_EQ(1, quads.count);
+        ASSERT_INT_EQ(1, quads.dropped);
+        ASSERT_FLOAT_EQ(0.0f, vertices[0]);
+        ASSERT_FLOAT_EQ(1.0f, vertices[1]);
+
+        BMFontLayoutCacheStats stats;
+        bmfont_layout_cache_get_stats(cache, &stats);
+        ASSERT_INT_EQ(2, (int)stats.hits);
+        ASSERT_INT_EQ(1, (int)stats.misses);
+        ASSERT_INT_EQ(1, stats.num_entries);
+
+        // "!" is now the least recently used entry, so "\"" evicts it.
+        quads = {};
+        bmfont_layout_cached(cache, font, "!", 1, 0.0f, 0.0f, &quads);
+        bmfont_layout_cached(cache, font, "! \"", 3, 0.0f, 0.0f, &quads);
+        bmfont_layout_cached(cache, font, "\"", 1, 0.0f, 0.0f, &quads);
+        bmfont_layout_cache_get_stats(cache, &stats);
+        ASSERT_INT_EQ(3, (int)stats.hits);
+        ASSERT_INT_EQ(3, (int)stats.misses);
+        ASSERT_INT_EQ(1, (int)stats.evictions);
+        ASSERT_INT_EQ(2, stats.num_entries);
+        ASSERT_TRUE(stats.bytes_used <= stats.budget);
+        bmfont_layout_cached(cache, font, "\"", 1, 0.0f, 0.0f, &quads);
+        bmfont_layout_cached(cache, font, "!", 1, 0.0f, 0.0f, &quads);
+        bmfont_layout_cache_get_stats(cache, &stats);
+        ASSERT_INT_EQ(4, (int)stats.hits);
+        ASSERT_INT_EQ(4, (int)stats.misses);
+        ASSERT_INT_EQ(2, (int)stats.evictions);
+
+        bmfont_layout_cache_evict_font(cache, font);
+        bmfont_layout_cache_get_stats(cache, &stats);
+        ASSERT_INT_EQ(0, stats.num_entries);
+        ASSERT_INT_EQ(0, (int)stats.bytes_used);
+        bmfont_layout_cache_destroy(cache);
+
+        // Layouts larger than the budget are still produced, just not cached.
+        cache = bmfont_layout_cache_create(16);
+        quads = {};
+        quads.positions = &vertices[0];
+        quads.uvs = &vertices[8];
+        quads.capacity = 2;
+        ASSERT_FLOAT_EQ(19.0f, bmfont_layout_cached(cache, font, "! \"", 3, 0.0f, 0.0f, &quads));
+        ASSERT_INT_EQ(2, quads.count);
+        bmfont_layout_cache_get_stats(cache, &stats);
+        ASSERT_INT_EQ(1, (int)stats.misses);
+        ASSERT_INT_EQ(0, stats.num_entries);
+        bmfont_layout_cache_destroy(cache);
+
+        // A font loaded at the address of a freed one doesn't get the freed font's layouts.
+        char text[] = "info face=a size=8\n"
+                      "common lineHeight=8 base=7 scaleW=64 scaleH=64 pages=1\n"
+                      "page id=0 file=\"a.png\"\n"
+                      "chars count=1\n"
+                      "char id=65 x=0 y=0 width=4 height=4 xoffset=0 yoffset=0 xadvance=6\n";
+        static FixedBlock block;
+        BMFontAllocator fixed = {fixed_alloc, fixed_free, &block};
+        cache = bmfont_layout_cache_create(1024);
+        BMFont *reused = bmfont_parse_memory(text, sizeof(text) - 1, &fixed);
+        quads = {};
+        ASSERT_FLOAT_EQ(6.0f, bmfont_layout_cached(cache, reused, "A", 1, 0.0f, 0.0f, &quads));
+        bmfont_free(reused);
+        memcpy(strstr(text, "xadvance=6"), "xadvance=9", 10);
+        reused = bmfont_parse_memory(text, sizeof(text) - 1, &fixed);
+        ASSERT_TRUE((char *)reused == block.data);
+        ASSERT_FLOAT_EQ(9.0f, bmfont_layout_cached(cache, reused, "A", 1, 0.0f, 0.0f, &quads));
+        bmfont_free(reused);
+        bmfont_layout_cache_destroy(cache);
+    }
+
+    {
+        // Every glyph advances 8. Spaces hang past the edge, and a word wider than the line is
+        // broken where it overflows.
+        BMFontWrap *wrap = bmfont_wrap_create(font);
+        uint32_t num_lines;
+        const char *text = "!! !!! !";
+        ASSERT_TRUE(bmfont_wrap_text(wrap, text, strlen(text), 32.0f));
+        const BMFontLine *lines = bmfont_wrap_get_lines(wrap, &num_lines);
+        ASSERT_INT_EQ(3, num_lines);
+        ASSERT_INT_EQ(0, (int)lines[0].begin);
+        ASSERT_INT_EQ(2, (int)lines[0].end);
+        ASSERT_FLOAT_EQ(16.0f, lines[0].width);
+        ASSERT_INT_EQ(3, (int)lines[1].begin);
+        ASSERT_INT_EQ(6, (int)lines[1].end);
+        ASSERT_INT_EQ(7, (int)lines[2].begin);
+        ASSERT_INT_EQ(8, (int)lines[2].end);
+
+        text = "!!!!!\n\n!\"";
+        ASSERT_TRUE(bmfont_wrap_text(wrap, text, strlen(text), 20.0f));
+        lines = bmfont_wrap_get_lines(wrap, &num_lines);
+        ASSERT_INT_EQ(5, num_lines);
+        ASSERT_INT_EQ(2, (int)lines[1].begin);
+        ASSERT_INT_EQ(4, (int)lines[1].end);
+        ASSERT_INT_EQ(4, (int)lines[2].begin);
+        ASSERT_INT_EQ(5, (int)lines[2].end);
+        ASSERT_INT_EQ(6, (int)lines[3].begin);
+        ASSERT_INT_EQ(6, (int)lines[3].end);
+        ASSERT_FLOAT_EQ(12.0f, lines[4].width); // Kerned
+
+        float vertices[2 * 4 * 8];
+        BMFontQuadBuffer quads = {};
+        quads.positions = &vertices[0];
+        quads.uvs = &vertices[2];
+        quads.position_stride = 4 * sizeof(float);
+        quads.uv_stride = 4 * sizeof(float);
+        quads.capacity = 8;
+        ASSERT_FLOAT_EQ(36.0f, bmfont_layout_wrapped(wrap, text, 1, 3, 0.0f, 12.0f, &quads));
+        ASSERT_INT_EQ(3, quads.count);
+        ASSERT_FLOAT_EQ(12.0f + 1.0f, vertices[1]);
+        ASSERT_FLOAT_EQ(20.0f + 1.0f, vertices[2 * 4 * 4 + 1]);
+
+        // Random edits rewrap only a few lines and match wrapping from scratch. The edited wrap
+        // reads advances from a metrics table and the reference from the chars.
+        BMFontMetrics *metrics = bmfont_metrics_create(font);
+        bmfont_wrap_use_metrics(wrap, metrics);
+        char edited[512];
+        size_t len = 0;
+        uint32_t state = 1;
+        for (; len < 300; ++len) {
+            state = state * 1664525 + 1013904223;
+            edited[len] = "!!!!  \"x\n"[(state >> 16) % 9];
+        }
+        ASSERT_TRUE(bmfont_wrap_text(wrap, edited, len, 40.0f));
+        BMFontWrap *reference = bmfont_wrap_create(font);
+        bool matches = true;
+        uint32_t max_rewrapped = 0;
+        for (int edit = 0; edit < 500; ++edit) {
+            state = state * 1664525 + 1013904223;
+            size_t offset = (state >> 8) % (len + 1);
+            size_t removed = len - offset < 3 ? len - offset : (state >> 4) % 3;
+            size_t inserted = len > 400 ? 0 : (state >> 2) % 3;
+            memmove(edited + offset + inserted,
+                    edited + offset + removed,
+                    len - offset - removed);
+            for (size_t i = 0; i < inserted; ++i) edited[offset + i] = "! \n"[(state >> i) % 3];
+            len += inserted - removed;
+
+            uint32_t first, rewrapped;
+            ASSERT_TRUE(bmfont_wrap_edit(
+                    wrap, edited, len, offset, removed, inserted, &first, &rewrapped));
+            if (rewrapped > max_rewrapped) max_rewrapped = rewrapped;
+
+            uint32_t expected_lines;
+            bmfont_wrap_text(reference, edited, len, 40.0f);
+            const BMFontLine *expected = bmfont_wrap_get_lines(reference, &expected_lines);
+            lines = bmfont_wrap_get_lines(wrap, &num_lines);
+            matches = matches && num_lines == expected_lines;
+            for (uint32_t i = 0; matches && i < num_lines; ++i) {
+                matches = lines[i].begin == expected[i].begin && lines[i].end == expected[i].end &&
+                          lines[i].width == expected[i].width;
+            }
+        }
+        ASSERT_TRUE(matches);
+        ASSERT_TRUE(max_rewrapped <= 8);
+        bmfont_wrap_destroy(reference);
+        bmfont_wrap_destroy(wrap);
+        bmfont_metrics_destroy(metrics);
+    }
+
+    {
+        ASSERT_INT_EQ(1, (int)bmfont_find_char_index(font, 34));
+        ASSERT_INT_EQ((int)BMFONT_NO_CHAR, (int)bmfont_find_char_index(font, 35));
+        ASSERT_INT_EQ((int)BMFONT_NO_CHAR, (int)bmfont_find_char_index(font, 19968));
+
+        BMFontMetrics *metrics = bmfont_metrics_create(font, true);
+        ASSERT_TRUE(metrics);
+        ASSERT_INT_EQ(3, metrics->num_chars);
+        ASSERT_INT_EQ(8, metrics->x_advances[0]);
+        ASSERT_INT_EQ(0, metrics->x_offsets[0]);
+        ASSERT_INT_EQ(1, metrics->y_offsets[0]);
+        ASSERT_INT_EQ(7, metrics->y_offsets[2]);
+        ASSERT_TRUE(metrics->kerning_first[0] && !metrics->kerning_first[1]);
+        ASSERT_TRUE(metrics->kerning_first[2]);
+        ASSERT_FLOAT_EQ(2.0f / 128.0f, metrics->uvs[0]);
+        ASSERT_FLOAT_EQ(3.0f / 512.0f, metrics->uvs[1]);
+        ASSERT_FLOAT_EQ(8.0f / 128.0f, metrics->uvs[2]);
+        ASSERT_FLOAT_EQ(10.0f / 512.0f, metrics->uvs[3]);
+
+        // Same widths as the pen advance of bmfont_layout(); the widest line wins.
+        BMFontQuadBuffer quads = {};
+        const char *text = "#! \"";
+        ASSERT_FLOAT_EQ(bmfont_layout(font, text, strlen(text), 0.0f, 0.0f, &quads),
+                        bmfont_measure(metrics, text, strlen(text)));
+        ASSERT_FLOAT_EQ(19.0f, bmfont_measure(metrics, text, strlen(text)));
+        text = "!\"\n!!!\n!";
+        ASSERT_FLOAT_EQ(24.0f, bmfont_measure(metrics, text, strlen(text)));
+        ASSERT_FLOAT_EQ(0.0f, bmfont_measure(metrics, "", 0));
+        bmfont_metrics_destroy(metrics);
+
+        metrics = bmfont_metrics_create(font);
+        ASSERT_NULLPTR(metrics->uvs);
+        bmfont_metrics_destroy(metrics);
+    }
+
+    {
+        size_t blob_size;
+        void *blob = bmfont_write_blob(font, &blob_size);
+        if (!blob) {
+            printf("%s: failed: %s\n", __FILE__, bmfont_get_error_string());
+            exit(1);
+        }
+
+        BMFont *view = bmfont_load_blob(blob, blob_size);
+        if (!view) {
+            printf("%s: failed: %s\n", __FILE__, bmfont_get_error_string());
+            exit(1);
+        }
+
+        ASSERT_STR_EQ("valid", view->font_name);
+        ASSERT_INT_EQ(8, view->font_size);
+        ASSERT_INT_EQ(512, view->scale_h);
+        ASSERT_INT_EQ(1, view->num_pages);
+        ASSERT_STR_EQ("valid.png", view->page_names[0]);
+        ASSERT_INT_EQ(3, view->num_chars);
+        ASSERT_INT_EQ(7, view->chars[0].height);
+        ASSERT_INT_EQ(2, view->num_kernings);
+        ASSERT_TRUE(bmfont_find_char(view, 34) == &view->chars[1]);
+        ASSERT_INT_EQ(-4, bmfont_get_kerning(view, 33, 34));
+        bmfont_free(view);
+
+        ASSERT_NULLPTR(bmfont_load_blob(blob, blob_size - 1));
+        ((char *)blob)[0] = 'X';
+        ASSERT_NULLPTR(bmfont_load_blob(blob, blob_size));
+        bmfont_free_blob(blob);
+
+        const char *blob_filename = "test_data/valid.blob.tmp";
+        ASSERT_TRUE(bmfont_write_blob_file(font, blob_filename));
+        view = bmfont_load_blob_file(blob_filename);
+        if (!view) {
+            printf("%s: failed: %s\n", __FILE__, bmfont_get_error_string());
+            exit(1);
+        }
+        ASSERT_STR_EQ("valid.png", view->page_names[0]);
+        ASSERT_INT_EQ(-5, bmfont_get_kerning(view, 32, 34));
+        bmfont_free(view);
+        remove(blob_filename);
+
+        ASSERT_NULLPTR(bmfont_load_blob_file("test_data/valid.fnt"));
+    }
+
+    {
+        // Codepoints the font doesn't have and repeats are skipped.
+        const uint32_t codepoints[] = {34, 999, 33, 34};
+        CountingAllocator counts = {};
+        BMFontAllocator allocator = {counting_alloc, counting_free, &counts};
+        BMFont *subset = bmfont_subset(font, codepoints, 4, &allocator);
+        if (!subset) {
+            printf("%s: failed: %s\n", __FILE__, bmfont_get_error_string());
+            exit(1);
+        }
+        ASSERT_INT_EQ(1, counts.live);
+        ASSERT_STR_EQ("valid", subset->font_name);
+        ASSERT_INT_EQ(8, subset->line_height);
+        ASSERT_STR_EQ("valid.png", subset->page_names[0]);
+        ASSERT_INT_EQ(2, subset->num_chars);
+        ASSERT_INT_EQ(33, (int)subset->chars[0].id);
+        ASSERT_INT_EQ(34, (int)subset->chars[1].id);
+        ASSERT_TRUE(bmfont_find_char(subset, 34) == &subset->chars[1]);
+        ASSERT_NULLPTR(bmfont_find_char(subset, 32));
+        ASSERT_INT_EQ(1, subset->num_kernings);
+        ASSERT_INT_EQ(-4, bmfont_get_kerning(subset, 33, 34));
+        ASSERT_INT_EQ(0, bmfont_get_kerning(subset, 32, 34));
+
+        BMFont *copy = round_trip_fnt(subset, BMFONT_FORMAT_TEXT);
+        ASSERT_TRUE(copy && same_font(subset, copy));
+        bmfont_free(copy);
+        copy = round_trip_fnt(subset, BMFONT_FORMAT_BINARY);
+        ASSERT_TRUE(copy && same_font(subset, copy));
+        bmfont_free(copy);
+        bmfont_free(subset);
+        ASSERT_INT_EQ(0, counts.live);
+
+        subset = bmfont_subset(font, nullptr, 0);
+        ASSERT_INT_EQ(0, subset->num_chars);
+        ASSERT_INT_EQ(0, subset->num_kernings);
+        ASSERT_NULLPTR(bmfont_find_char(subset, 33));
+        copy = round_trip_fnt(subset, BMFONT_FORMAT_TEXT);
+        ASSERT_TRUE(copy && same_font(subset, copy));
+        bmfont_free(copy);
+        bmfont_free(subset);
+
+        // Lazy fonts are subset and written from their source, without decoding them in place.
+        BMFont *lazy = bmfont_parse_file_lazy("test_data/valid.fnt");
+        subset = bmfont_subset(lazy, codepoints, 4);
+        ASSERT_INT_EQ(-4, bmfont_get_kerning(subset, 33, 34));
+        bmfont_free(subset);
+        copy = round_trip_fnt(lazy, BMFONT_FORMAT_TEXT);
+        ASSERT_TRUE(copy && same_font(font, copy));
+        bmfont_free(copy);
+        ASSERT_TRUE(lazy->_char_offsets[0] != 0 && lazy->_kerning_offsets[0] != 0);
+        bmfont_free(lazy);
+
+        // Packed fonts keep their pages and channels in both formats.
+        BMFont *paged = bmfont_parse_file("test_data/valid_two_pages.fnt");
+        const uint32_t letters[] = {66, 65, 68};
+        subset = bmfont_subset(paged, letters, 3);
+        ASSERT_INT_EQ(3, subset->num_chars);
+        ASSERT_INT_EQ(1, subset->num_kernings);
+        copy = round_trip_fnt(subset, BMFONT_FORMAT_BINARY);
+        ASSERT_TRUE(copy && same_font(subset, copy));
+        ASSERT_STR_EQ("two_pages_1.png", copy->page_names[1]);
+        ASSERT_INT_EQ(1, copy->packed);
+        ASSERT_INT_EQ(1, copy->chars[2].channel);
+        bmfont_free(copy);
+        copy = round_trip_fnt(subset, BMFONT_FORMAT_TEXT);
+        ASSERT_TRUE(copy && same_font(subset, copy));
+        bmfont_free(copy);
+
+        // Every page name takes the same number of bytes in the pages block.
+        size_t size;
+        const uint8_t *binary =
+                (const uint8_t *)bmfont_write_fnt(subset, BMFONT_FORMAT_BINARY, &size);
+        size_t offset = 4;
+        while (offset + 5 <= size && binary[offset] != BMFONT__BINARY_BLOCK_PAGES) {
+            offset += 5 + bmfont__read_u32(binary + offset + 1);
+        }
+        ASSERT_TRUE(offset + 5 <= size);
+        size_t name_len = strlen(subset->page_names[0]);
+        ASSERT_INT_EQ((int)(subset->num_pages * (name_len + 1)),
+                      (int)bmfont__read_u32(binary + offset + 1));
+        bmfont_free_blob((void *)binary);
+
+        // Names of different lengths, and counts over 16 bits, don't fit the binary format.
+        BMFont unfit = *subset;
+        char *names[2] = {subset->page_names[0], (char *)"short.png"};
+        unfit.page_names = names;
+        ASSERT_NULLPTR(bmfont_write_fnt(&unfit, BMFONT_FORMAT_BINARY, &size));
+        copy = round_trip_fnt(&unfit, BMFONT_FORMAT_TEXT);
+        ASSERT_STR_EQ("short.png", copy->page_names[1]);
+        bmfont_free(copy);
+        unfit.num_pages = 0x10000;
+        ASSERT_NULLPTR(bmfont_write_fnt(&unfit, BMFONT_FORMAT_BINARY, &size));
+        bmfont_free(subset);
+        bmfont_free(paged);
+
+        // The binary format stores names without their quotes.
+        const char text[] = "info face=\"Quoted\" size=8\n"
+                            "common lineHeight=8 base=7 scaleW=64 scaleH=64 pages=1\n"
+                            "page id=0 file=\"a.png\"\n"
+                            "chars count=0\n";
+        BMFont *quoted = bmfont_parse_memory(text, sizeof(text) - 1);
+        copy = round_trip_fnt(quoted, BMFONT_FORMAT_TEXT);
+        ASSERT_STR_EQ("\"Quoted\"", copy->font_name);
+        bmfont_free(copy);
+        copy = round_trip_fnt(quoted, BMFONT_FORMAT_BINARY);
+        ASSERT_STR_EQ("Quoted", copy->font_name);
+        bmfont_free(copy);
+        bmfont_free(quoted);
+
+        void *data = bmfont_write_fnt(font, BMFONT_FORMAT_TEXT, &size);
+        ASSERT_INT_EQ((int)size, (int)strlen((const char *)data));
+        bmfont_free_blob(data);
+        ASSERT_NULLPTR(bmfont_write_fnt(font, 2, &size));
+
+        // The _r versions report through their result only.
+        BMFontResult result;
+        ASSERT_TRUE(bmfont_subset_r(font, codepoints, 4, &result));
+        ASSERT_STR_EQ("Success", result.error);
+        ASSERT_INT_EQ(2, result.font->num_chars);
+        bmfont_free(result.font);
+        ASSERT_TRUE(!bmfont_write_fnt_r(font, 2, &data, &size, &result));
+        ASSERT_NULLPTR(data);
+        ASSERT_STR_EQ("Unknown .fnt format: 2", result.error);
+        ASSERT_TRUE(bmfont_write_fnt_r(font, BMFONT_FORMAT_BINARY, &data, &size, &result));
+        copy = bmfont_parse_memory((const char *)data, size);
+        ASSERT_TRUE(copy && same_font(font, copy));
+        bmfont_free(copy);
+        bmfont_free_blob(data);
+        ASSERT_TRUE(!bmfont_write_fnt_file_r(font, "test_data/missing/a.fnt", 0, &result));
+        ASSERT_TRUE(!strncmp(result.error, "Couldn't open file", 18));
+
+        const char *fnt_filename = "test_data/valid.fnt.tmp";
+        ASSERT_TRUE(bmfont_write_fnt_file(font, fnt_filename, BMFONT_FORMAT_BINARY));
+        copy = bmfont_parse_file(fnt_filename);
+        ASSERT_TRUE(copy && same_font(font, copy));
+        bmfont_free(copy);
+        remove(fnt_filename);
+    }
+
     bmfont_free(font);
 
 
@@ -702,9 +6641,508 @@ int main() {
     ASSERT_STR_EQ("valid.png", font->page_names[0]);
     ASSERT_INT_EQ(3, font->num_chars);
     ASSERT_INT_EQ(0, font->num_kernings);
+    ASSERT_INT_EQ(0, bmfont_get_kerning(font, 33, 34));
+
+    bmfont_free(font);
+
+
+    {
+        // Parse from a buffer that is not NUL terminated; the trailing 'X' must not be seen.
+        const char text[] = "info face=mem size=12\n"
+                            "common lineHeight=14 base=11 scaleW=64 scaleH=64 pages=1\n"
+                            "page id=0 file=\"mem.png\"\n"
+                            "chars count=2\n"
+                            "char id=65 x=1 y=2 width=3 height=4 xoffset=0 yoffset=0 xadvance=5\n"
+                            "char id=19968 x=5 y=2 width=9 height=9 xoffset=-1 yoffset=0 "
+                            "xadvance=10\n"
+                            "kernings count=0X";
+        font = bmfont_parse_memory(text, sizeof(text) - 2);
+        if (!font) {
+            printf("%s: failed: %s\n", __FILE__, bmfont_get_error_string());
+            exit(1);
+        }
+
+        ASSERT_STR_EQ("mem", font->font_name);
+        ASSERT_INT_EQ(12, font->font_size);
+        ASSERT_STR_EQ("mem.png", font->page_names[0]);
+        ASSERT_INT_EQ(2, font->num_chars);
+        ASSERT_INT_EQ(65, font->chars[0].id);
+        ASSERT_INT_EQ(5, font->chars[0].x_advance);
+        ASSERT_INT_EQ(-1, font->chars[1].x_offset);
+        ASSERT_INT_EQ(0, font->num_kernings);
+
+        ASSERT_TRUE(bmfont_find_char(font, 65) == &font->chars[0]);
+        ASSERT_TRUE(bmfont_find_char(font, 19968) == &font->chars[1]);
+        ASSERT_NULLPTR(bmfont_find_char(font, 66));
+        ASSERT_NULLPTR(bmfont_find_char(font, 19969));
+
+        bmfont_free(font);
+
+        font = bmfont_parse_memory(text, sizeof(text) - 1);
+        ASSERT_NULLPTR(font);
+    }
+
+    {
+        // A lazy font decodes each record on first lookup, to the same values as an eager load.
+        BMFont *eager = bmfont_parse_file("test_data/valid.fnt");
+        font = bmfont_parse_file_lazy("test_data/valid.fnt");
+        ASSERT_TRUE(eager != nullptr && font != nullptr);
+        ASSERT_STR_EQ("valid", font->font_name);
+        ASSERT_STR_EQ("valid.png", font->page_names[0]);
+        ASSERT_INT_EQ(3, font->num_chars);
+        ASSERT_INT_EQ(33, font->chars[0].id);
+        ASSERT_INT_EQ(0, font->chars[0].width);
+
+        ASSERT_TRUE(bmfont_find_char(font, 33) == &font->chars[0]);
+        ASSERT_INT_EQ(6, font->chars[0].width);
+        ASSERT_INT_EQ(0, font->chars[1].width);
+        for (uint32_t i = 0; i < eager->num_chars; ++i) {
+            const BMFont::Char *ch = bmfont_find_char(font, eager->chars[i].id);
+            ASSERT_TRUE(ch == &font->chars[i]);
+            ASSERT_TRUE(!memcmp(ch, &eager->chars[i], sizeof(*ch)));
+        }
+        ASSERT_NULLPTR(bmfont_find_char(font, 35));
+
+        ASSERT_INT_EQ(0, font->kernings[1].amount);
+        ASSERT_INT_EQ(-5, bmfont_get_kerning(font, 32, 34));
+        ASSERT_INT_EQ(-5, font->kernings[1].amount);
+        ASSERT_INT_EQ(0, bmfont_get_kerning(font, 34, 33));
+
+        // Writing a blob decodes whatever is still pending, into a copy from the font's allocator.
+        CountingAllocator counts = {};
+        BMFontAllocator counting = {counting_alloc, counting_free, &counts};
+        BMFont *unused = bmfont_parse_file_lazy("test_data/valid.fnt", &counting);
+        CountingAllocator loaded = counts;
+        size_t eager_size, lazy_size;
+        void *eager_blob = bmfont_write_blob(eager, &eager_size);
+        void *lazy_blob = bmfont_write_blob(unused, &lazy_size);
+        ASSERT_TRUE(eager_blob != nullptr && lazy_blob != nullptr);
+        ASSERT_TRUE(counts.total > loaded.total);
+        ASSERT_INT_EQ(loaded.live, counts.live);
+        ASSERT_TRUE(eager_size == lazy_size && !memcmp(eager_blob, lazy_blob, eager_size));
+        bmfont_free_blob(lazy_blob);
+        bmfont_free_blob(eager_blob);
+        bmfont_free(unused);
+
+        // So does building a metrics table.
+        unused = bmfont_parse_file_lazy("test_data/valid.fnt");
+        BMFontMetrics *metrics = bmfont_metrics_create(unused);
+        ASSERT_TRUE(metrics != nullptr);
+        ASSERT_INT_EQ(7, metrics->y_offsets[2]);
+        ASSERT_INT_EQ(3, unused->chars[1].height);
+        bmfont_metrics_destroy(metrics);
+        bmfont_free(unused);
+        bmfont_free(font);
+        bmfont_free(eager);
+
+        // Binary fonts are loaded eagerly, and the structure of a text font is still checked at
+        // load.
+        font = bmfont_parse_file_lazy("test_data/valid_binary.fnt");
+        ASSERT_TRUE(font != nullptr);
+        ASSERT_INT_EQ(3, font->chars[1].height);
+        bmfont_free(font);
+        ASSERT_NULLPTR(bmfont_parse_file_lazy("test_data/too_few_chars.fnt"));
+        ASSERT_NULLPTR(bmfont_parse_file_lazy("test_data/too_many_kernings.fnt"));
+
+        // Records whose keys come in another order are parsed in full at load. A malformed record
+        // is only found on lookup, where it counts as missing, or when the font is written out.
+        const char text[] = "info face=lazy size=12\n"
+                            "common lineHeight=14 base=11 scaleW=64 scaleH=64 pages=1\n"
+                            "page id=0 file=\"lazy.png\"\n"
+                            "chars count=3\n"
+                            "char x=1 id=65 y=2 width=3 height=4 xoffset=0 yoffset=0 xadvance=5\n"
+                            "char id=66 x=oops y=2 width=3 height=4 xoffset=0 yoffset=0 "
+                            "xadvance=5\n"
+                            "char id=67 x=9 y=2 width=3 height=4 xoffset=0 yoffset=0 xadvance=7\n"
+                            "kernings count=1\n"
+                            "kerning amount=-2 first=65 second=67\n";
+        font = bmfont_parse_memory_lazy(text, sizeof(text) - 1);
+        ASSERT_TRUE(font != nullptr);
+        ASSERT_INT_EQ(5, font->chars[0].x_advance);
+        ASSERT_INT_EQ(-2, font->kernings[0].amount);
+        ASSERT_NULLPTR(bmfont_find_char(font, 66));
+        ASSERT_INT_EQ(7, bmfont_find_char(font, 67)->x_advance);
+        ASSERT_INT_EQ(-2, bmfont_get_kerning(font, 65, 67));
+
+        BMFontResult result;
+        ASSERT_TRUE(!bmfont_parse_memory_r(text, sizeof(text) - 1, &result));
+        size_t size;
+        ASSERT_NULLPTR(bmfont_write_blob(font, &size));
+        ASSERT_STR_EQ(result.error, bmfont_get_error_string());
+        ASSERT_NULLPTR(bmfont_metrics_create(font));
+        bmfont_free(font);
+    }
+
+    {
+        // Record lines that the fast path leaves to the token parser: hex and octal values, keys
+        // it doesn't know, CRLF line ends and runs of padding longer than a SIMD block.
+        const char text[] = "info face=fast size=12\r\n"
+                            "common lineHeight=14 base=11 scaleW=64 scaleH=64 pages=1\r\n"
+                            "page id=0 file=\"fast.png\"\r\n"
+                            "chars count=3\r\n"
+                            "char id=0x41 x=010 y=2 width=3 height=4 xoffset=-1 yoffset=+2 "
+                            "xadvance=5 page=0 chnl=15\r\n"
+                            "char id=66                       x=7 y=2 width=3 height=4\r\n"
+                            "char id=67 x=1 y=2 width=3 height=4 xoffset=0 yoffset=0 xadvance=7\n"
+                            "kernings count=2\n"
+                            "kerning first=65   second=66   amount=-1  \r\n"
+                            "kerning amount=-2 second=67 first=66";
+        font = bmfont_parse_memory(text, sizeof(text) - 1);
+        ASSERT_TRUE(font != nullptr);
+        ASSERT_INT_EQ(65, font->chars[0].id);
+        ASSERT_INT_EQ(8, font->chars[0].x);
+        ASSERT_INT_EQ(-1, font->chars[0].x_offset);
+        ASSERT_INT_EQ(2, font->chars[0].y_offset);
+        ASSERT_INT_EQ(7, font->chars[1].x);
+        ASSERT_INT_EQ(7, font->chars[2].x_advance);
+        ASSERT_INT_EQ(-1, bmfont_get_kerning(font, 65, 66));
+        ASSERT_INT_EQ(-2, bmfont_get_kerning(font, 66, 67));
+        bmfont_free(font);
+
+        // Errors in record lines keep their positions.
+        const char bad_value[] = "info face=fast size=12\n"
+                                 "common lineHeight=14 base=11 scaleW=64 scaleH=64 pages=1\n"
+                                 "page id=0 file=\"fast.png\"\n"
+                                 "chars count=1\n"
+                                 "char id=65 x=1 y=2 width=3 height=4 xadvance=5a\n"
+                                 "kernings count=0\n";
+        BMFontResult result;
+        ASSERT_TRUE(!bmfont_parse_memory_r(bad_value, sizeof(bad_value) - 1, &result));
+        ASSERT_STR_EQ("Expected an integer value (line 5, col 46). Got: 5a", result.error);
+        ASSERT_INT_EQ(5, result.line);
+        ASSERT_INT_EQ(46, result.col);
+
+        const char out_of_range[] = "info face=fast size=12\n"
+                                    "common lineHeight=14 base=11 scaleW=64 scaleH=64 pages=1\n"
+                                    "page id=0 file=\"fast.png\"\n"
+                                    "chars count=0\n"
+                                    "kernings count=1\n"
+                                    "kerning first=65 second=66 amount=40000\n";
+        ASSERT_TRUE(!bmfont_parse_memory_r(out_of_range, sizeof(out_of_range) - 1, &result));
+        ASSERT_STR_EQ("Integer value out of range (line 6, col 35). Got: 40000", result.error);
+    }
+
+    {
+        CountingAllocator counts = {};
+        BMFontAllocator allocator = {};
+        allocator.alloc = counting_alloc;
+        allocator.free = counting_free;
+        allocator.user = &counts;
+
+        // The whole font, including its lookup tables, is one allocation.
+        font = bmfont_parse_file("test_data/valid.fnt", &allocator);
+        ASSERT_TRUE(font != nullptr);
+        ASSERT_INT_EQ(1, counts.live);
+        ASSERT_STR_EQ("valid.png", font->page_names[0]);
+        ASSERT_INT_EQ(-5, bmfont_get_kerning(font, 32, 34));
+        bmfont_free(font);
+        ASSERT_INT_EQ(0, counts.live);
+
+        font = bmfont_parse_file("test_data/valid_binary.fnt", &allocator);
+        ASSERT_TRUE(font != nullptr);
+        ASSERT_INT_EQ(1, counts.live);
+        bmfont_free(font);
+        ASSERT_INT_EQ(0, counts.live);
+
+        font = bmfont_parse_file("test_data/too_few_kernings.fnt", &allocator);
+        ASSERT_NULLPTR(font);
+        ASSERT_INT_EQ(0, counts.live);
+    }
+
+    font = bmfont_parse_file("test_data/valid_binary.fnt");
+    if (!font) {
+        printf("%s: failed: %s\n", __FILE__, bmfont_get_error_string());
+        exit(1);
+    }
+
+    ASSERT_STR_EQ("valid", font->font_name);
+    ASSERT_INT_EQ(8, font->font_size);
+    ASSERT_INT_EQ(8, font->line_height);
+    ASSERT_INT_EQ(7, font->base);
+    ASSERT_INT_EQ(128, font->scale_w);
+    ASSERT_INT_EQ(512, font->scale_h);
+    ASSERT_INT_EQ(1, font->num_pages);
+    ASSERT_STR_EQ("valid.png", font->page_names[0]);
+    ASSERT_INT_EQ(3, font->num_chars);
+    ASSERT_INT_EQ(34, font->chars[1].id);
+    ASSERT_INT_EQ(11, font->chars[1].y);
+    ASSERT_INT_EQ(3, font->chars[1].height);
+    ASSERT_INT_EQ(7, font->chars[2].y_offset);
+    ASSERT_INT_EQ(8, font->chars[2].x_advance);
+    ASSERT_INT_EQ(15, font->chars[2].channel);
+    ASSERT_INT_EQ(2, font->num_kernings);
+    ASSERT_INT_EQ(32, font->kernings[1].first);
+    ASSERT_INT_EQ(34, font->kernings[1].second);
+    ASSERT_INT_EQ(-5, font->kernings[1].amount);
+    ASSERT_INT_EQ(-5, bmfont_get_kerning(font, 32, 34));
 
     bmfont_free(font);
 
+    {
+        // Counts beyond 16 bits and codepoints beyond U+FFFF.
+        const uint32_t count = 70000;
+        size_t capacity = 256 + (size_t)count * 128;
+        char *text = (char *)malloc(capacity);
+        int len = snprintf(text,
+                           capacity,
+                           "info face=big size=16\n"
+                           "common lineHeight=18 base=14 scaleW=4096 scaleH=4096 pages=1\n"
+                           "page id=0 file=\"big.png\"\n"
+                           "chars count=%u\n",
+                           count);
+        for (uint32_t i = 0; i < count; ++i) {
+            len += snprintf(text + len,
+                            capacity - (size_t)len,
+                            "char id=%u x=0 y=0 width=8 height=8 xoffset=0 yoffset=0 xadvance=%u\n",
+                            0x10000 + i,
+                            i % 16);
+        }
+        len += snprintf(text + len, capacity - (size_t)len, "kernings count=%u\n", count);
+        for (uint32_t i = 0; i < count; ++i) {
+            len += snprintf(text + len,
+                            capacity - (size_t)len,
+                            "kerning first=%u second=%u amount=-%u\n",
+                            0x10000 + i,
+                            0x10000 + (i + 1) % count,
+                            i % 8);
+        }
+
+        font = bmfont_parse_memory(text, (size_t)len);
+        free(text);
+        if (!font) {
+            printf("%s: failed: %s\n", __FILE__, bmfont_get_error_string());
+            exit(1);
+        }
+
+        ASSERT_INT_EQ(70000, font->num_chars);
+        ASSERT_INT_EQ(70000, font->num_kernings);
+        ASSERT_TRUE(bmfont_find_char(font, 0x10000 + 69999) == &font->chars[69999]);
+        ASSERT_INT_EQ(15, bmfont_find_char(font, 0x10000 + 69999)->x_advance);
+        ASSERT_NULLPTR(bmfont_find_char(font, 0x10000 + 70000));
+        ASSERT_NULLPTR(bmfont_find_char(font, 0));
+        ASSERT_INT_EQ(-7, bmfont_get_kerning(font, 0x10000 + 69999, 0x10000));
+        bmfont_free(font);
+    }
+
+    {
+        // Chunks split lines, tokens and the binary header at every possible point.
+        const char *valid_files[] = {
+            "test_data/valid.fnt", "test_data/valid_binary.fnt", "test_data/valid_no_kernings.fnt"};
+        for (size_t f = 0; f < sizeof(valid_files) / sizeof(valid_files[0]); ++f) {
+            BMFont *expected = bmfont_parse_file(valid_files[f]);
+            for (size_t chunk_size = 1; chunk_size <= 64; ++chunk_size) {
+                BMFontResult result;
+                ASSERT_TRUE(stream_test_file(valid_files[f], chunk_size, &result));
+                if (!result.font) break;
+
+                ASSERT_STR_EQ("Success", result.error);
+                ASSERT_STR_EQ(expected->font_name, result.font->font_name);
+                ASSERT_STR_EQ(expected->page_names[0], result.font->page_names[0]);
+                ASSERT_INT_EQ(expected->line_height, result.font->line_height);
+                ASSERT_INT_EQ(expected->num_chars, result.font->num_chars);
+                ASSERT_INT_EQ(expected->num_kernings, result.font->num_kernings);
+                ASSERT_TRUE(!memcmp(expected->chars,
+                                    result.font->chars,
+                                    expected->num_chars * sizeof(BMFont::Char)));
+                ASSERT_TRUE(bmfont_find_char(result.font, 34) == &result.font->chars[1]);
+                ASSERT_INT_EQ(bmfont_get_kerning(expected, 32, 34),
+                              bmfont_get_kerning(result.font, 32, 34));
+                bmfont_free(result.font);
+            }
+            bmfont_free(expected);
+        }
+
+        // Errors match those from parsing the whole file.
+        const char *invalid_files[] = {"test_data/too_few_chars.fnt",
+                                       "test_data/too_few_kernings.fnt",
+                                       "test_data/too_few_pages.fnt",
+                                       "test_data/too_many_chars.fnt",
+                                       "test_data/too_many_kernings.fnt",
+                                       "test_data/too_many_pages.fnt",
+                                       "test_data/binary_truncated.fnt"};
+        for (size_t f = 0; f < sizeof(invalid_files) / sizeof(invalid_files[0]); ++f) {
+            BMFontResult expected;
+            bmfont_parse_file_r(invalid_files[f], &expected);
+            for (size_t chunk_size = 1; chunk_size <= 64; chunk_size *= 2) {
+                BMFontResult result;
+                ASSERT_TRUE(!stream_test_file(invalid_files[f], chunk_size, &result));
+                ASSERT_NULLPTR(result.font);
+                ASSERT_STR_EQ(expected.error, result.error);
+                ASSERT_INT_EQ(expected.line, result.line);
+            }
+        }
+
+        // The kernings are parsed straight into the font, so only its block is left at the end.
+        CountingAllocator counts = {};
+        BMFontAllocator counting = {counting_alloc, counting_free, &counts};
+        size_t valid_size = 0;
+        char *valid_data = read_test_file("test_data/valid.fnt", &valid_size);
+        BMFontStreamParser *kerning_parser = bmfont_parser_create(&counting);
+        ASSERT_TRUE(bmfont_parser_feed(kerning_parser, valid_data, valid_size));
+        BMFontResult kerning_result;
+        ASSERT_TRUE(bmfont_parser_finish(kerning_parser, &kerning_result));
+        ASSERT_INT_EQ(1, counts.live);
+        ASSERT_INT_EQ(-4, bmfont_get_kerning(kerning_result.font, 33, 34));
+        ASSERT_INT_EQ(-5, bmfont_get_kerning(kerning_result.font, 32, 34));
+        bmfont_free(kerning_result.font);
+        ASSERT_INT_EQ(0, counts.live);
+        free(valid_data);
+
+        // The input may end without a newline, and before the optional kernings.
+        const char text[] = "info face=stream size=8\n"
+                            "common lineHeight=8 base=7 scaleW=64 scaleH=64 pages=1\n"
+                            "page id=0 file=\"stream.png\"\n"
+                            "chars count=1\n"
+                            "char id=65 x=1 y=2 width=3 height=4 xoffset=0 yoffset=0 xadvance=5";
+        BMFontStreamParser *parser = bmfont_parser_create();
+        ASSERT_TRUE(bmfont_parser_feed(parser, text, sizeof(text) - 1));
+        BMFontResult result;
+        ASSERT_TRUE(bmfont_parser_finish(parser, &result));
+        if (result.font) {
+            ASSERT_STR_EQ("stream.png", result.font->page_names[0]);
+            ASSERT_INT_EQ(5, bmfont_find_char(result.font, 65)->x_advance);
+            ASSERT_INT_EQ(0, result.font->num_kernings);
+        }
+        bmfont_free(result.font);
+
+        // Once the input is invalid, later chunks are rejected.
+        parser = bmfont_parser_create();
+        ASSERT_TRUE(!bmfont_parser_feed(parser, "info size=x\n", 12));
+        ASSERT_TRUE(!bmfont_parser_feed(parser, text, sizeof(text) - 1));
+        ASSERT_TRUE(!bmfont_parser_finish(parser, &result));
+        ASSERT_INT_EQ(1, result.line);
+        ASSERT_INT_EQ(11, result.col);
+    }
+
+    font = bmfont_parse_file("test_data/binary_truncated.fnt");
+    ASSERT_NULLPTR(font);
+
+#ifdef CMP_BMFONT_HAS_EMBED
+    {
+        const BMFont *embedded_font = &embedded.font;
+        ASSERT_STR_EQ("valid", embedded_font->font_name);
+        ASSERT_INT_EQ(8, embedded_font->font_size);
+        ASSERT_INT_EQ(512, embedded_font->scale_h);
+        ASSERT_INT_EQ(1, embedded_font->num_pages);
+        ASSERT_STR_EQ("valid.png", embedded_font->page_names[0]);
+        ASSERT_INT_EQ(4, embedded_font->num_chars);
+        ASSERT_INT_EQ(2, embedded_font->num_kernings);
+        ASSERT_TRUE(bmfont_find_char(embedded_font, 33) == &embedded_font->chars[0]);
+        ASSERT_TRUE(bmfont_find_char(embedded_font, 19968) == &embedded_font->chars[3]);
+        ASSERT_INT_EQ(-4, bmfont_get_kerning(embedded_font, 33, 34));
+        ASSERT_INT_EQ(0, bmfont_get_kerning(embedded_font, 34, 33));
+    }
+#endif
+
+    {
+        BMFontResult result;
+        ASSERT_TRUE(bmfont_parse_file_r("test_data/valid.fnt", &result));
+        ASSERT_STR_EQ("Success", result.error);
+        ASSERT_INT_EQ(3, result.font->num_chars);
+        bmfont_free(result.font);
+
+        ASSERT_TRUE(!bmfont_parse_file_r("test_data/too_many_chars.fnt", &result));
+        ASSERT_NULLPTR(result.font);
+        ASSERT_INT_EQ(8, result.line);
+        ASSERT_INT_EQ(1, result.col);
+
+        ASSERT_TRUE(!bmfont_parse_file_r("test_data/binary_truncated.fnt", &result));
+        ASSERT_NULLPTR(result.font);
+        ASSERT_INT_EQ(0, result.line);
+        ASSERT_TRUE(strncmp(result.error, "Invalid binary BMFont", 21) == 0);
+
+        const char memory_font[] = "info face=mem size=12\n"
+                                   "common lineHeight=14 base=11 scaleW=64 scaleH=64 pages=1\n"
+                                   "page id=0 file=\"mem.png\"\n"
+                                   "chars count=2\n"
+                                   "char id=65 x=1 y=2 width=3 height=4 xoffset=0 yoffset=0 "
+                                   "xadvance=5\n"
+                                   "char id=66 x=5 y=2 width=3 height=4 xoffset=0 yoffset=0 "
+                                   "xadvance=5\n";
+        BMFontSource sources[] = {
+            {"test_data/valid.fnt", nullptr, 0},
+            {"test_data/valid_binary.fnt", nullptr, 0},
+            {nullptr, memory_font, strlen(memory_font)},
+            {"test_data/too_few_chars.fnt", nullptr, 0},
+            {"test_data/valid_no_kernings.fnt", nullptr, 0},
+        };
+        const size_t num_sources = sizeof(sources) / sizeof(sources[0]);
+        BMFontResult results[num_sources];
+        ASSERT_TRUE(!bmfont_parse_batch(sources, num_sources, results, 3));
+        ASSERT_INT_EQ(3, results[0].font->num_chars);
+        ASSERT_INT_EQ(3, results[1].font->num_chars);
+        ASSERT_INT_EQ(2, results[2].font->num_chars);
+        ASSERT_NULLPTR(results[3].font);
+        ASSERT_STR_EQ("Fewer chars than specified in file. Expected: 3, actual: 2", results[3].error);
+        ASSERT_INT_EQ(0, results[4].font->num_kernings);
+        for (size_t i = 0; i < num_sources; ++i) bmfont_free(results[i].font);
+
+        ASSERT_TRUE(bmfont_parse_batch(sources, 3, results));
+        for (size_t i = 0; i < 3; ++i) bmfont_free(results[i].font);
+
+        // The shared error string is left alone by the reentrant functions
+        ASSERT_TRUE(strncmp(bmfont_get_error_string(), "Invalid binary BMFont", 21) == 0);
+        ASSERT_TRUE(!bmfont_parse_file_r("test_data/does_not_exist", &result));
+        ASSERT_TRUE(strncmp(bmfont_get_error_string(), "Invalid binary BMFont", 21) == 0);
+    }
+
+#ifdef CMP_BMFONT_HAS_WATCHER
+    {
+        size_t size;
+        char *data = read_test_file("test_data/valid.fnt", &size);
+        const char *watched = "test_data/watched.fnt.tmp";
+        write_test_file(watched, data, size);
+
+        ReloadLog log = {};
+        BMFontWatcher *watcher = bmfont_watcher_create(2, log_reload, &log);
+        ASSERT_TRUE(watcher != nullptr);
+
+        BMFontResult result;
+        ASSERT_NULLPTR(bmfont_watcher_add(watcher, "test_data/does_not_exist", &result));
+        BMFontLive *live = bmfont_watcher_add(watcher, watched, &result);
+        ASSERT_TRUE(live != nullptr);
+
+        int reader = bmfont_watcher_add_reader(watcher);
+        ASSERT_INT_EQ(0, reader);
+        ASSERT_INT_EQ(1, bmfont_watcher_add_reader(watcher));
+        ASSERT_INT_EQ(-1, bmfont_watcher_add_reader(watcher));
+        bmfont_watcher_remove_reader(watcher, 1);
+        ASSERT_INT_EQ(1, bmfont_watcher_add_reader(watcher));
+        bmfont_watcher_read_begin(watcher, -1);
+        bmfont_watcher_read_end(watcher, 2);
+
+        // The font is swapped while a read is in progress, but the old one stays valid, and the
+        // reload doesn't complete, until the read ends.
+        bmfont_watcher_read_begin(watcher, reader);
+        const BMFont *old = bmfont_live_font(live);
+        ASSERT_INT_EQ(8, old->font_size);
+
+        data[size] = '\0';
+        strstr(data, "size=8")[5] = '9';
+        write_test_file(watched, data, size);
+        for (int i = 0; i < 5000 && bmfont_live_font(live) == old; ++i) usleep(1000);
+        ASSERT_INT_EQ(9, bmfont_live_font(live)->font_size);
+        ASSERT_INT_EQ(8, old->font_size);
+        ASSERT_INT_EQ(0, __atomic_load_n(&log.reloads, __ATOMIC_SEQ_CST));
+        bmfont_watcher_read_end(watcher, reader);
+        ASSERT_TRUE(wait_for_count(&log.reloads, 1));
+
+        // Saving without changes doesn't reload, and a broken file keeps the current font.
+        write_test_file(watched, data, size);
+        const char broken[] = "info face=broken\n";
+        write_test_file(watched, broken, sizeof(broken) - 1);
+        ASSERT_TRUE(wait_for_count(&log.failures, 1));
+        ASSERT_INT_EQ(1, __atomic_load_n(&log.reloads, __ATOMIC_SEQ_CST));
+
+        bmfont_watcher_read_begin(watcher, reader);
+        ASSERT_INT_EQ(9, bmfont_live_font(live)->font_size);
+        bmfont_watcher_read_end(watcher, reader);
+
+        bmfont_watcher_destroy(watcher);
+        remove(watched);
+        free(data);
+    }
+#endif
 
     font = bmfont_parse_file("test_data/does_not_exist");
     ASSERT_NULLPTR(font);
@@ -727,6 +7165,140 @@ int main() {
     font = bmfont_parse_file("test_data/too_few_pages.fnt");
     ASSERT_NULLPTR(font);
 
+    {
+        BMFont *latin = bmfont_parse_file("test_data/valid.fnt");
+        ASSERT_TRUE(latin);
+
+        // Has '!' too, which the first font shadows, and two chars past the dense range.
+        const char text[] =
+                "info face=b size=10\n"
+                "common lineHeight=10 base=9 scaleW=64 scaleH=64 pages=1\n"
+                "page id=0 file=\"b.png\"\n"
+                "chars count=3\n"
+                "char id=33 x=1 y=1 width=1 height=1 xoffset=0 yoffset=0 xadvance=3\n"
+                "char id=19968 x=5 y=1 width=9 height=9 xoffset=0 yoffset=0 xadvance=10\n"
+                "char id=128512 x=15 y=1 width=9 height=9 xoffset=0 yoffset=0 xadvance=11\n";
+        BMFont *cjk = bmfont_parse_memory(text, sizeof(text) - 1);
+        ASSERT_TRUE(cjk);
+
+        const BMFont *fonts[] = {latin, cjk};
+        BMFontChain *chain = bmfont_chain_create(fonts, 2);
+        ASSERT_TRUE(chain);
+
+        const BMFont *owner;
+        const BMFont::Char *ch = bmfont_chain_find_char(chain, 33, &owner);
+        ASSERT_TRUE(ch == bmfont_find_char(latin, 33) && owner == latin);
+        ch = bmfont_chain_find_char(chain, 19968, &owner);
+        ASSERT_TRUE(ch == bmfont_find_char(cjk, 19968) && owner == cjk);
+        ch = bmfont_chain_find_char(chain, 128512, &owner);
+        ASSERT_INT_EQ(11, ch->x_advance);
+        ASSERT_NULLPTR(bmfont_chain_find_char(chain, 35, &owner));
+        ASSERT_NULLPTR(owner);
+        ASSERT_NULLPTR(bmfont_chain_find_char(chain, 19969, &owner));
+
+        uint32_t codepoints[8];
+        const BMFont::Char *chars[8];
+        const BMFont *owners[8];
+        size_t consumed;
+        const char mixed[] = "\" \xe4\xb8\x80#";
+        ASSERT_INT_EQ(4, (int)bmfont_chain_find_glyphs(chain, mixed, sizeof(mixed) - 1, codepoints,
+                                                       chars, owners, 8, &consumed));
+        ASSERT_INT_EQ((int)sizeof(mixed) - 1, (int)consumed);
+        ASSERT_TRUE(owners[0] == latin && owners[1] == latin && owners[2] == cjk);
+        ASSERT_INT_EQ(19968, (int)codepoints[2]);
+        ASSERT_NULLPTR(chars[3]);
+        ASSERT_NULLPTR(owners[3]);
+        bmfont_chain_destroy(chain);
+
+        // The order decides which font wins.
+        fonts[0] = cjk;
+        fonts[1] = latin;
+        chain = bmfont_chain_create(fonts, 2);
+        ch = bmfont_chain_find_char(chain, 33, &owner);
+        ASSERT_TRUE(owner == cjk);
+        ASSERT_INT_EQ(3, ch->x_advance);
+        ASSERT_TRUE(bmfont_chain_find_char(chain, 32, &owner) && owner == latin);
+        bmfont_chain_destroy(chain);
+
+        chain = bmfont_chain_create(fonts, 0);
+        ASSERT_NULLPTR(bmfont_chain_find_char(chain, 33, &owner));
+        bmfont_chain_destroy(chain);
+        ASSERT_NULLPTR(bmfont_chain_create(fonts, BMFONT_MAX_CHAIN_FONTS + 1));
+
+        bmfont_free(cjk);
+        bmfont_free(latin);
+    }
+
+#ifdef CMP_BMFONT_STATS
+    {
+        LoadLog log = {};
+        bmfont_set_load_hook(log_load, &log);
+
+        // One report per load, from the outermost function.
+        font = bmfont_parse_file("test_data/valid.fnt");
+        ASSERT_INT_EQ(1, log.loads);
+        ASSERT_TRUE(log.loaded);
+        ASSERT_STR_EQ("test_data/valid.fnt", log.filename);
+        ASSERT_INT_EQ(566, (int)log.stats.bytes_read);
+        ASSERT_TRUE(log.stats.tokens > 0);
+        ASSERT_TRUE(log.stats.allocations >= 1);
+        ASSERT_TRUE(log.stats.allocated_bytes > 0);
+        ASSERT_TRUE(log.stats.total_ns >= log.stats.phase_ns[BMFONT_PHASE_CHARS]);
+        bmfont_free(font);
+
+        // bold is skipped. The last line has no newline, so it is tokenized.
+        const char text[] =
+                "info face=a size=8 bold=0\n"
+                "common lineHeight=8 base=7 scaleW=64 scaleH=64 pages=1 packed=0\n"
+                "page id=0 file=\"a.png\"\n"
+                "chars count=2\n"
+                "char id=33 x=0 y=0 width=1 height=1 xoffset=0 yoffset=0 xadvance=2 "
+                "page=0 chnl=15\n"
+                "char id=34 x=0 y=0 width=1 height=1 xoffset=0 yoffset=0 xadvance=2 "
+                "page=0 chnl=15\n"
+                "kernings count=2\n"
+                "kerning first=33 second=34 amount=-1\n"
+                "kerning first=34 second=33 amount=-1";
+        font = bmfont_parse_memory(text, sizeof(text) - 1);
+        ASSERT_INT_EQ(2, log.loads);
+        ASSERT_INT_EQ(3, (int)log.stats.fast_lines);
+        ASSERT_INT_EQ(1, (int)log.stats.unknown_keys);
+
+        bmfont_reset_lookup_stats();
+        bmfont_find_char(font, 33);
+        bmfont_find_char(font, 35);
+        bmfont_get_kerning(font, 33, 34);
+        bmfont_get_kerning(font, 34, 34);
+        BMFontLookupStats lookups;
+        bmfont_get_lookup_stats(&lookups);
+        ASSERT_INT_EQ(1, (int)lookups.char_hits);
+        ASSERT_INT_EQ(1, (int)lookups.char_misses);
+        ASSERT_INT_EQ(1, (int)lookups.kerning_hits);
+        ASSERT_INT_EQ(1, (int)lookups.kerning_misses);
+        bmfont_free(font);
+
+        size_t size;
+        char *data = read_test_file("test_data/valid_binary.fnt", &size);
+        font = bmfont_parse_memory(data, size);
+        ASSERT_INT_EQ(3, log.loads);
+        ASSERT_STR_EQ("", log.filename);
+        ASSERT_INT_EQ((int)size, (int)log.stats.bytes_read);
+        ASSERT_INT_EQ(0, (int)log.stats.tokens);
+        ASSERT_INT_EQ(1, (int)log.stats.allocations);
+        bmfont_free(font);
+        free(data);
+
+        font = bmfont_parse_file("test_data/too_few_chars.fnt");
+        ASSERT_INT_EQ(4, log.loads);
+        ASSERT_TRUE(!log.loaded);
+
+        bmfont_set_load_hook(nullptr, nullptr);
+        font = bmfont_parse_file("test_data/valid.fnt");
+        ASSERT_INT_EQ(4, log.loads);
+        bmfont_free(font);
+    }
+#endif
+
     if (!fail) {
         printf("%s: success\n", __FILE__);
         return 0;
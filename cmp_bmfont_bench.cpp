@@ -0,0 +1,827 @@
+// Benchmarks for cmp_bmfont.hpp. Generates synthetic fonts in memory at realistic scales and
+// reports parse throughput, memory use and allocation counts, lookup latency and layout throughput.
+//
+// Build and run with bench.sh, or:
+//
+//     c++ -O2 -std=c++14 -I. cmp_bmfont_bench.cpp -o cmp_bmfont_bench -lpthread
+//     ./cmp_bmfont_bench [num_chars] [num_kernings]
+
+#define CMP_BMFONT_IMPLEMENTATION
+#include "cmp_bmfont.hpp"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+using namespace cmp;
+
+static double now_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Keeps the optimizer from discarding results that are otherwise unused.
+static volatile uint64_t sink;
+
+//
+// Allocator that tracks allocation count and peak bytes
+//
+
+struct TrackingAllocator {
+    size_t count;
+    size_t live_bytes;
+    size_t peak_bytes;
+};
+
+// Size prefix kept in front of each block, large enough to keep the block 16 byte aligned.
+static const size_t TRACKING_HEADER = 16;
+
+static void *tracking_alloc(size_t size, void *user) {
+    TrackingAllocator *tracking = (TrackingAllocator *)user;
+    char *block = (char *)malloc(size + TRACKING_HEADER);
+    if (!block) return nullptr;
+
+    memcpy(block, &size, sizeof(size));
+    tracking->count++;
+    tracking->live_bytes += size;
+    if (tracking->live_bytes > tracking->peak_bytes) tracking->peak_bytes = tracking->live_bytes;
+    return block + TRACKING_HEADER;
+}
+
+static void tracking_free(void *ptr, void *user) {
+    TrackingAllocator *tracking = (TrackingAllocator *)user;
+    char *block = (char *)ptr - TRACKING_HEADER;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    tracking->live_bytes -= size;
+    free(block);
+}
+
+//
+// Synthetic font generation
+//
+
+struct Buffer {
+    char * data;
+    size_t size;
+    size_t capacity;
+};
+
+static void buffer_reserve(Buffer *buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity) return;
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->size + extra) capacity *= 2;
+    buffer->data = (char *)realloc(buffer->data, capacity);
+    if (!buffer->data) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    buffer->capacity = capacity;
+}
+
+static void buffer_printf(Buffer *buffer, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+static void buffer_printf(Buffer *buffer, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    buffer_reserve(buffer, 256);
+    int len = vsnprintf(buffer->data + buffer->size, buffer->capacity - buffer->size, fmt, args);
+    va_end(args);
+    buffer->size += (size_t)len;
+}
+
+static void buffer_bytes(Buffer *buffer, const void *data, size_t size) {
+    buffer_reserve(buffer, size);
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void buffer_u8(Buffer *buffer, uint32_t value) {
+    uint8_t byte = (uint8_t)value;
+    buffer_bytes(buffer, &byte, 1);
+}
+
+static void buffer_u16(Buffer *buffer, uint32_t value) {
+    buffer_u8(buffer, value & 0xFF);
+    buffer_u8(buffer, value >> 8);
+}
+
+static void buffer_u32(Buffer *buffer, uint32_t value) {
+    buffer_u16(buffer, value & 0xFFFF);
+    buffer_u16(buffer, value >> 16);
+}
+
+static void buffer_utf8(Buffer *buffer, uint32_t cp) {
+    if (cp < 0x80) {
+        buffer_u8(buffer, cp);
+    } else if (cp < 0x800) {
+        buffer_u8(buffer, 0xC0 | (cp >> 6));
+        buffer_u8(buffer, 0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        buffer_u8(buffer, 0xE0 | (cp >> 12));
+        buffer_u8(buffer, 0x80 | ((cp >> 6) & 0x3F));
+        buffer_u8(buffer, 0x80 | (cp & 0x3F));
+    } else {
+        buffer_u8(buffer, 0xF0 | (cp >> 18));
+        buffer_u8(buffer, 0x80 | ((cp >> 12) & 0x3F));
+        buffer_u8(buffer, 0x80 | ((cp >> 6) & 0x3F));
+        buffer_u8(buffer, 0x80 | (cp & 0x3F));
+    }
+}
+
+struct SyntheticChar {
+    uint32_t id;
+    int      x, y, width, height, x_offset, y_offset, x_advance;
+};
+
+struct SyntheticKerning {
+    uint32_t first, second;
+    int      amount;
+};
+
+struct SyntheticFont {
+    SyntheticChar *   chars;
+    SyntheticKerning *kernings;
+    uint32_t          num_chars;
+    uint32_t          num_kernings;
+};
+
+// Small deterministic generator so that runs are comparable.
+static uint32_t random_next(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Printable ASCII followed by CJK ideographs (and beyond U+9FFF for large counts), laid out on a
+// 4096 x 4096 atlas of 16 pixel cells.
+static uint32_t synthetic_codepoint(uint32_t i) {
+    return i < 95 ? 32 + i : 0x4E00 + (i - 95);
+}
+
+static SyntheticFont generate_font(uint32_t num_chars, uint32_t num_kernings) {
+    SyntheticFont font = {};
+    font.num_chars = num_chars;
+    font.num_kernings = num_kernings;
+    font.chars = (SyntheticChar *)calloc(num_chars ? num_chars : 1, sizeof(SyntheticChar));
+    font.kernings = (SyntheticKerning *)calloc(num_kernings ? num_kernings : 1,
+                                               sizeof(SyntheticKerning));
+
+    uint32_t state = 0x12345678;
+    for (uint32_t i = 0; i < num_chars; ++i) {
+        SyntheticChar *ch = &font.chars[i];
+        ch->id = synthetic_codepoint(i);
+        ch->x = (int)(i % 256) * 16;
+        ch->y = (int)(i / 256 % 256) * 16;
+        ch->width = 8 + (int)(random_next(&state) % 8);
+        ch->height = 8 + (int)(random_next(&state) % 8);
+        ch->x_offset = (int)(random_next(&state) % 5) - 2;
+        ch->y_offset = (int)(random_next(&state) % 5);
+        ch->x_advance = ch->width + 1;
+    }
+
+    // Pairs are unique: each first codepoint gets a run of distinct seconds.
+    uint32_t seconds_per_first = num_chars < 64 ? num_chars : 64;
+    for (uint32_t i = 0; i < num_kernings; ++i) {
+        SyntheticKerning *kerning = &font.kernings[i];
+        uint32_t first = i / seconds_per_first;
+        kerning->first = synthetic_codepoint(first % num_chars);
+        kerning->second = synthetic_codepoint((first + i % seconds_per_first) % num_chars);
+        kerning->amount = -1 - (int)(random_next(&state) % 4);
+    }
+
+    return font;
+}
+
+static Buffer write_text(const SyntheticFont *font) {
+    Buffer buffer = {};
+    buffer_printf(&buffer,
+                  "info face=\"Synthetic\" size=16 bold=0 italic=0 charset=\"\" unicode=1 "
+                  "stretchH=100 smooth=1 aa=1 padding=0,0,0,0 spacing=1,1 outline=0\n");
+    buffer_printf(&buffer,
+                  "common lineHeight=18 base=14 scaleW=4096 scaleH=4096 pages=1 packed=0 "
+                  "alphaChnl=0 redChnl=4 greenChnl=4 blueChnl=4\n");
+    buffer_printf(&buffer, "page id=0 file=\"synthetic_0.png\"\n");
+    buffer_printf(&buffer, "chars count=%u\n", font->num_chars);
+    for (uint32_t i = 0; i < font->num_chars; ++i) {
+        const SyntheticChar *ch = &font->chars[i];
+        buffer_printf(&buffer,
+                      "char id=%-6u x=%-5d y=%-5d width=%-5d height=%-5d xoffset=%-5d "
+                      "yoffset=%-5d xadvance=%-5d page=0  chnl=15\n",
+                      ch->id,
+                      ch->x,
+                      ch->y,
+                      ch->width,
+                      ch->height,
+                      ch->x_offset,
+                      ch->y_offset,
+                      ch->x_advance);
+    }
+    buffer_printf(&buffer, "kernings count=%u\n", font->num_kernings);
+    for (uint32_t i = 0; i < font->num_kernings; ++i) {
+        const SyntheticKerning *kerning = &font->kernings[i];
+        buffer_printf(&buffer,
+                      "kerning first=%-5u second=%-5u amount=%-3d\n",
+                      kerning->first,
+                      kerning->second,
+                      kerning->amount);
+    }
+    return buffer;
+}
+
+static Buffer write_binary(const SyntheticFont *font) {
+    Buffer buffer = {};
+    buffer_bytes(&buffer, "BMF\3", 4);
+
+    const char face[] = "Synthetic";
+    buffer_u8(&buffer, 1);
+    buffer_u32(&buffer, 14 + sizeof(face));
+    buffer_u16(&buffer, 16);             // fontSize
+    buffer_u8(&buffer, 0x80 | 0x02);     // bitField: smooth, unicode
+    buffer_u8(&buffer, 0);               // charSet
+    buffer_u16(&buffer, 100);            // stretchH
+    buffer_u8(&buffer, 1);               // aa
+    buffer_u32(&buffer, 0);              // padding
+    buffer_u16(&buffer, 0x0101);         // spacing
+    buffer_u8(&buffer, 0);               // outline
+    buffer_bytes(&buffer, face, sizeof(face));
+
+    buffer_u8(&buffer, 2);
+    buffer_u32(&buffer, 15);
+    buffer_u16(&buffer, 18);             // lineHeight
+    buffer_u16(&buffer, 14);             // base
+    buffer_u16(&buffer, 4096);           // scaleW
+    buffer_u16(&buffer, 4096);           // scaleH
+    buffer_u16(&buffer, 1);              // pages
+    buffer_u8(&buffer, 0);               // bitField
+    buffer_u32(&buffer, 0x04040400);     // alpha, red, green, blue channels
+
+    const char page[] = "synthetic_0.png";
+    buffer_u8(&buffer, 3);
+    buffer_u32(&buffer, sizeof(page));
+    buffer_bytes(&buffer, page, sizeof(page));
+
+    buffer_u8(&buffer, 4);
+    buffer_u32(&buffer, font->num_chars * 20);
+    for (uint32_t i = 0; i < font->num_chars; ++i) {
+        const SyntheticChar *ch = &font->chars[i];
+        buffer_u32(&buffer, ch->id);
+        buffer_u16(&buffer, (uint32_t)ch->x);
+        buffer_u16(&buffer, (uint32_t)ch->y);
+        buffer_u16(&buffer, (uint32_t)ch->width);
+        buffer_u16(&buffer, (uint32_t)ch->height);
+        buffer_u16(&buffer, (uint32_t)ch->x_offset & 0xFFFF);
+        buffer_u16(&buffer, (uint32_t)ch->y_offset & 0xFFFF);
+        buffer_u16(&buffer, (uint32_t)ch->x_advance);
+        buffer_u8(&buffer, 0);
+        buffer_u8(&buffer, 15);
+    }
+
+    if (font->num_kernings) {
+        buffer_u8(&buffer, 5);
+        buffer_u32(&buffer, font->num_kernings * 10);
+        for (uint32_t i = 0; i < font->num_kernings; ++i) {
+            const SyntheticKerning *kerning = &font->kernings[i];
+            buffer_u32(&buffer, kerning->first);
+            buffer_u32(&buffer, kerning->second);
+            buffer_u16(&buffer, (uint32_t)kerning->amount & 0xFFFF);
+        }
+    }
+    return buffer;
+}
+
+//
+// Benchmarks
+//
+
+static const int PARSE_RUNS = 10;
+
+typedef BMFont *LoadFunction(const void *data, size_t size, const BMFontAllocator *allocator);
+
+static BMFont *load_memory(const void *data, size_t size, const BMFontAllocator *allocator) {
+    return bmfont_parse_memory((const char *)data, size, allocator);
+}
+
+static BMFont *load_lazy(const void *data, size_t size, const BMFontAllocator *allocator) {
+    return bmfont_parse_memory_lazy((const char *)data, size, allocator);
+}
+
+static BMFont *load_stream(const void *data, size_t size, const BMFontAllocator *allocator) {
+    const size_t chunk_size = 64 * 1024;
+    BMFontStreamParser *parser = bmfont_parser_create(allocator);
+    for (size_t offset = 0; offset < size; offset += chunk_size) {
+        size_t len = size - offset < chunk_size ? size - offset : chunk_size;
+        if (!bmfont_parser_feed(parser, (const char *)data + offset, len)) break;
+    }
+
+    BMFontResult result;
+    bmfont_parser_finish(parser, &result);
+    return result.font;
+}
+
+static BMFont *load_blob(const void *data, size_t size, const BMFontAllocator *allocator) {
+    return bmfont_load_blob(data, size, allocator);
+}
+
+// Loads the font PARSE_RUNS times and reports the fastest run, which is the least disturbed by
+// the rest of the system.
+static void bench_load(const char *name, LoadFunction *load, const void *data, size_t size) {
+    TrackingAllocator tracking = {};
+    BMFontAllocator allocator = {tracking_alloc, tracking_free, &tracking};
+
+    double best = 1e30;
+    for (int run = 0; run < PARSE_RUNS; ++run) {
+        double start = now_seconds();
+        BMFont *font = load(data, size, &allocator);
+        double elapsed = now_seconds() - start;
+        if (!font) {
+            fprintf(stderr, "%s: failed to load: %s\n", name, bmfont_get_error_string());
+            exit(1);
+        }
+        bmfont_free(font);
+        if (elapsed < best) best = elapsed;
+    }
+
+    printf("  %-18s %9.2f MB %9.3f ms %9.1f MB/s %9.2f MB peak %6.1f allocs/load\n",
+           name,
+           (double)size / (1024.0 * 1024.0),
+           best * 1000.0,
+           (double)size / (1024.0 * 1024.0) / best,
+           (double)tracking.peak_bytes / (1024.0 * 1024.0),
+           (double)tracking.count / PARSE_RUNS);
+}
+
+static const uint32_t LOOKUPS = 1u << 24;
+
+static void bench_lookups(const BMFont *font, const SyntheticFont *source) {
+    // Random queries over the ids in the font, with a few misses mixed in.
+    uint32_t *queries = (uint32_t *)malloc(4096 * sizeof(uint32_t));
+    uint32_t state = 0xCAFEF00D;
+    for (uint32_t i = 0; i < 4096; ++i) {
+        uint32_t index = random_next(&state) % (source->num_chars + source->num_chars / 16 + 1);
+        queries[i] = synthetic_codepoint(index);
+    }
+
+    uint64_t found = 0;
+    double start = now_seconds();
+    for (uint32_t i = 0; i < LOOKUPS; ++i) {
+        found += bmfont_find_char(font, queries[i & 4095]) != nullptr;
+    }
+    double chars = now_seconds() - start;
+    sink = found;
+
+    uint32_t *pairs = (uint32_t *)malloc(4096 * 2 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < 4096; ++i) {
+        uint32_t index = source->num_kernings ? random_next(&state) % source->num_kernings : 0;
+        bool hit = source->num_kernings && (random_next(&state) & 3);
+        pairs[i * 2] = hit ? source->kernings[index].first : queries[i];
+        pairs[i * 2 + 1] = hit ? source->kernings[index].second : queries[(i + 1) & 4095];
+    }
+
+    int64_t total = 0;
+    start = now_seconds();
+    for (uint32_t i = 0; i < LOOKUPS; ++i) {
+        uint32_t j = (i & 4095) * 2;
+        total += bmfont_get_kerning(font, pairs[j], pairs[j + 1]);
+    }
+    double kernings = now_seconds() - start;
+    sink = (uint64_t)total;
+
+    printf("  %-18s %9.2f ns/lookup\n", "find_char", chars * 1e9 / LOOKUPS);
+    printf("  %-18s %9.2f ns/lookup\n", "get_kerning", kernings * 1e9 / LOOKUPS);
+
+    free(pairs);
+    free(queries);
+}
+
+static void bench_layout(const BMFont *font, const SyntheticFont *source) {
+    // A mix of ASCII and CJK text with occasional newlines, encoded as UTF-8.
+    Buffer text = {};
+    uint32_t state = 0xBEEF;
+    for (int i = 0; i < 64 * 1024; ++i) {
+        uint32_t r = random_next(&state);
+        uint32_t cp = synthetic_codepoint((r >> 8) % source->num_chars);
+        if (r & 1) cp = 32 + (r >> 8) % 95;
+        if (i % 80 == 79) cp = '\n';
+        buffer_utf8(&text, cp);
+    }
+
+    const uint32_t capacity = 64 * 1024;
+    float *vertices = (float *)malloc(capacity * 4 * 4 * sizeof(float));
+    BMFontQuadBuffer quads = {};
+    quads.positions = &vertices[0];
+    quads.uvs = &vertices[2];
+    quads.position_stride = quads.uv_stride = 4 * sizeof(float);
+    quads.capacity = capacity;
+
+    const int runs = 50;
+    uint64_t glyphs = 0;
+    double start = now_seconds();
+    for (int run = 0; run < runs; ++run) {
+        quads.count = 0;
+        bmfont_layout(font, text.data, text.size, 0.0f, 0.0f, &quads);
+        glyphs += quads.count;
+    }
+    double elapsed = now_seconds() - start;
+    sink = glyphs;
+
+    printf("  %-18s %9.2f M glyphs/s %9.1f MB/s of UTF-8\n",
+           "layout",
+           (double)glyphs / elapsed * 1e-6,
+           (double)text.size * runs / (1024.0 * 1024.0) / elapsed);
+
+    free(vertices);
+    free(text.data);
+}
+
+// Decoding a mostly ASCII chat log, the common case for glyph iteration.
+static void bench_decode(const BMFont *font, const SyntheticFont *source) {
+    Buffer text = {};
+    uint32_t state = 0xD00D;
+    for (int i = 0; i < 1024 * 1024; ++i) {
+        uint32_t r = random_next(&state);
+        uint32_t cp = 32 + r % 95;
+        if (r % 64 == 0) cp = synthetic_codepoint((r >> 8) % source->num_chars);
+        buffer_utf8(&text, cp);
+    }
+
+    const size_t batch = 256;
+    uint32_t codepoints[batch];
+    const BMFont::Char *chars[batch];
+    const int runs = 20;
+    double elapsed[2];
+    for (int lookup = 0; lookup < 2; ++lookup) {
+        uint64_t decoded = 0;
+        double start = now_seconds();
+        for (int run = 0; run < runs; ++run) {
+            const char *p = text.data;
+            size_t len = text.size;
+            while (len) {
+                size_t consumed;
+                if (lookup) {
+                    decoded +=
+                            bmfont_find_glyphs(font, p, len, codepoints, chars, batch, &consumed);
+                } else {
+                    decoded += bmfont_decode_utf8(p, len, codepoints, batch, &consumed);
+                }
+                p += consumed;
+                len -= consumed;
+            }
+        }
+        elapsed[lookup] = now_seconds() - start;
+        sink = decoded;
+    }
+
+    double megabytes = (double)text.size * runs / (1024.0 * 1024.0);
+    printf("  %-18s %9.1f MB/s\n", "decode utf8", megabytes / elapsed[0]);
+    printf("  %-18s %9.1f MB/s\n", "find glyphs", megabytes / elapsed[1]);
+
+    free(text.data);
+}
+
+// Measuring a long document over the whole font, reading advances out of the chars and out of a
+// metrics table.
+static void bench_measure(const BMFont *font, const SyntheticFont *source) {
+    Buffer text = {};
+    uint32_t state = 0xBEEF;
+    for (int i = 0; i < 1024 * 1024; ++i) {
+        uint32_t r = random_next(&state);
+        buffer_utf8(&text, i % 80 == 79 ? '\n' : synthetic_codepoint(r % source->num_chars));
+    }
+
+    BMFontMetrics *metrics = bmfont_metrics_create(font);
+    const size_t batch = 64;
+    uint32_t codepoints[batch];
+    const BMFont::Char *chars[batch];
+    const int runs = 10;
+
+    float width = 0.0f;
+    double start = now_seconds();
+    for (int run = 0; run < runs; ++run) {
+        const char *p = text.data;
+        size_t len = text.size;
+        float pen_x = 0.0f;
+        uint32_t prev = 0;
+        while (len) {
+            size_t consumed;
+            size_t count = bmfont_find_glyphs(font, p, len, codepoints, chars, batch, &consumed);
+            p += consumed;
+            len -= consumed;
+            for (size_t i = 0; i < count; ++i) {
+                if (codepoints[i] == '\n') {
+                    if (pen_x > width) width = pen_x;
+                    pen_x = 0.0f;
+                    prev = 0;
+                } else if (chars[i]) {
+                    if (prev) pen_x += bmfont_get_kerning(font, prev, codepoints[i]);
+                    pen_x += chars[i]->x_advance;
+                    prev = codepoints[i];
+                }
+            }
+        }
+    }
+    double from_chars = now_seconds() - start;
+    sink = (uint64_t)width;
+
+    start = now_seconds();
+    for (int run = 0; run < runs; ++run) width += bmfont_measure(metrics, text.data, text.size);
+    double from_metrics = now_seconds() - start;
+    sink = (uint64_t)width;
+
+    double megabytes = (double)text.size * runs / (1024.0 * 1024.0);
+    printf("  %-18s %9.1f MB/s\n", "measure chars", megabytes / from_chars);
+    printf("  %-18s %9.1f MB/s\n", "measure metrics", megabytes / from_metrics);
+
+    bmfont_metrics_destroy(metrics);
+    free(text.data);
+}
+
+// A UI drawing the same few hundred labels every frame, laid out from scratch and from the cache.
+static void bench_layout_cache(const BMFont *font) {
+    const int num_labels = 512;
+    const int label_len = 24;
+    char labels[num_labels][label_len];
+    uint32_t state = 0xCAFE;
+    for (int i = 0; i < num_labels; ++i) {
+        for (int j = 0; j < label_len; ++j) labels[i][j] = (char)(32 + random_next(&state) % 95);
+    }
+
+    const uint32_t capacity = num_labels * label_len;
+    float *vertices = (float *)malloc(capacity * 4 * 4 * sizeof(float));
+    BMFontQuadBuffer quads = {};
+    quads.positions = &vertices[0];
+    quads.uvs = &vertices[2];
+    quads.position_stride = quads.uv_stride = 4 * sizeof(float);
+    quads.capacity = capacity;
+
+    BMFontLayoutCache *cache = bmfont_layout_cache_create(4 * 1024 * 1024);
+    const int frames = 200;
+    double elapsed[2];
+    for (int cached = 0; cached < 2; ++cached) {
+        double start = now_seconds();
+        for (int frame = 0; frame < frames; ++frame) {
+            quads.count = 0;
+            for (int i = 0; i < num_labels; ++i) {
+                float y = (float)(i * 16 + frame);
+                if (cached) {
+                    bmfont_layout_cached(cache, font, labels[i], label_len, 8.0f, y, &quads);
+                } else {
+                    bmfont_layout(font, labels[i], label_len, 8.0f, y, &quads);
+                }
+            }
+        }
+        elapsed[cached] = now_seconds() - start;
+        sink = quads.count;
+    }
+
+    BMFontLayoutCacheStats stats;
+    bmfont_layout_cache_get_stats(cache, &stats);
+    printf("  %-18s %9.2f us/frame\n", "layout labels", elapsed[0] * 1e6 / frames);
+    printf("  %-18s %9.2f us/frame %9.1f%% hits %9zu KB\n",
+           "layout cached",
+           elapsed[1] * 1e6 / frames,
+           100.0 * (double)stats.hits / (double)(stats.hits + stats.misses),
+           stats.bytes_used / 1024);
+
+    bmfont_layout_cache_destroy(cache);
+    free(vertices);
+}
+
+// A chat log with a long scrollback, wrapped once and then edited one character at a time.
+static void bench_wrap(const BMFont *font) {
+    Buffer text = {};
+    uint32_t state = 0xF00D;
+    for (int i = 0; i < 1024 * 1024; ++i) {
+        uint32_t r = random_next(&state);
+        char c = (char)('a' + r % 26);
+        if (r % 6 == 0) c = ' ';
+        if (r % 400 == 0) c = '\n';
+        buffer_u8(&text, (uint8_t)c);
+    }
+    const int edits = 1000;
+    buffer_reserve(&text, edits);
+
+    float max_width = 60.0f * font->chars[0].x_advance;
+    BMFontWrap *wrap = bmfont_wrap_create(font);
+    double start = now_seconds();
+    bmfont_wrap_text(wrap, text.data, text.size, max_width);
+    double full = now_seconds() - start;
+
+    uint64_t rewrapped = 0;
+    start = now_seconds();
+    for (int i = 0; i < edits; ++i) {
+        size_t offset = random_next(&state) % text.size;
+        memmove(text.data + offset + 1, text.data + offset, text.size - offset);
+        text.data[offset] = (i & 1) ? ' ' : 'x';
+        text.size++;
+
+        uint32_t first_line, num_lines;
+        bmfont_wrap_edit(wrap, text.data, text.size, offset, 0, 1, &first_line, &num_lines);
+        rewrapped += num_lines;
+    }
+    double incremental = (now_seconds() - start) / edits;
+
+    uint32_t num_lines;
+    bmfont_wrap_get_lines(wrap, &num_lines);
+    printf("  %-18s %9.2f ms for %u lines\n", "wrap", full * 1e3, num_lines);
+    printf("  %-18s %9.2f us/edit %9.1f lines/edit\n",
+           "wrap edit",
+           incremental * 1e6,
+           (double)rewrapped / edits);
+
+    bmfont_wrap_destroy(wrap);
+    free(text.data);
+}
+
+static BMFont *parse_synthetic(const SyntheticFont *source) {
+    Buffer text = write_text(source);
+    BMFont *font = bmfont_parse_memory(text.data, text.size);
+    if (!font) {
+        fprintf(stderr, "Failed to parse synthetic font: %s\n", bmfont_get_error_string());
+        exit(1);
+    }
+    free(text.data);
+    return font;
+}
+
+// The source split into a Latin and a CJK font, followed by a small symbol font, looked up by
+// probing each font in turn and through a chain.
+static void bench_chain(const SyntheticFont *source) {
+    const uint32_t latin_chars = source->num_chars < 95 ? source->num_chars : 95;
+    SyntheticFont latin = {source->chars, source->kernings, latin_chars, 0};
+    SyntheticFont cjk = {
+            source->chars + latin_chars, source->kernings, source->num_chars - latin_chars, 0};
+    SyntheticFont symbols = generate_font(64, 0);
+    for (uint32_t i = 0; i < symbols.num_chars; ++i) symbols.chars[i].id = 0x1F300 + i;
+
+    const BMFont *fonts[3] = {
+            parse_synthetic(&latin), parse_synthetic(&cjk), parse_synthetic(&symbols)};
+    BMFontChain *chain = bmfont_chain_create(fonts, 3);
+
+    // Mostly Latin text with some CJK, a few symbols and a few misses.
+    uint32_t *queries = (uint32_t *)malloc(4096 * sizeof(uint32_t));
+    uint32_t state = 0xC4A1;
+    for (uint32_t i = 0; i < 4096; ++i) {
+        uint32_t r = random_next(&state);
+        uint32_t kind = r % 100;
+        r = random_next(&state);
+        if (kind < 70 || !cjk.num_chars) {
+            queries[i] = latin.chars[r % latin.num_chars].id;
+        } else if (kind < 92) {
+            queries[i] = cjk.chars[r % cjk.num_chars].id;
+        } else if (kind < 98) {
+            queries[i] = symbols.chars[r % symbols.num_chars].id;
+        } else {
+            queries[i] = 0x1F600 + r % 64;
+        }
+    }
+
+    uint64_t found = 0;
+    double start = now_seconds();
+    for (uint32_t i = 0; i < LOOKUPS; ++i) {
+        for (uint32_t f = 0; f < 3; ++f) {
+            const BMFont::Char *ch = bmfont_find_char(fonts[f], queries[i & 4095]);
+            if (ch) {
+                found += ch->x_advance;
+                break;
+            }
+        }
+    }
+    double probe = now_seconds() - start;
+    sink = found;
+
+    found = 0;
+    start = now_seconds();
+    for (uint32_t i = 0; i < LOOKUPS; ++i) {
+        const BMFont *font;
+        const BMFont::Char *ch = bmfont_chain_find_char(chain, queries[i & 4095], &font);
+        if (ch) found += ch->x_advance;
+    }
+    double chained = now_seconds() - start;
+    sink = found;
+
+    printf("  %-18s %9.2f ns/lookup\n", "fallback probe", probe * 1e9 / LOOKUPS);
+    printf("  %-18s %9.2f ns/lookup\n", "fallback chain", chained * 1e9 / LOOKUPS);
+
+    bmfont_chain_destroy(chain);
+    for (uint32_t f = 0; f < 3; ++f) bmfont_free((BMFont *)fonts[f]);
+    free(queries);
+    free(symbols.kernings);
+    free(symbols.chars);
+}
+
+// Cuts the font down to a locale's worth of glyphs, printable ASCII plus one in eight of the rest,
+// and loads the subset written back out in both formats.
+static void bench_subset(const BMFont *font, const SyntheticFont *source) {
+    uint32_t *codepoints = (uint32_t *)malloc(source->num_chars * sizeof(uint32_t));
+    uint32_t num_codepoints = 0;
+    for (uint32_t i = 0; i < source->num_chars; ++i) {
+        if (i < 95 || i % 8 == 0) codepoints[num_codepoints++] = source->chars[i].id;
+    }
+
+    double best = 1e30;
+    BMFont *subset = nullptr;
+    for (int run = 0; run < PARSE_RUNS; ++run) {
+        bmfont_free(subset);
+        double start = now_seconds();
+        subset = bmfont_subset(font, codepoints, num_codepoints);
+        double elapsed = now_seconds() - start;
+        if (!subset) {
+            fprintf(stderr, "Failed to subset font: %s\n", bmfont_get_error_string());
+            exit(1);
+        }
+        if (elapsed < best) best = elapsed;
+    }
+    printf("  %-18s %9u chars %8.3f ms %9u kernings\n",
+           "subset",
+           subset->num_chars,
+           best * 1000.0,
+           subset->num_kernings);
+
+    size_t text_size, binary_size;
+    void *text = bmfont_write_fnt(subset, BMFONT_FORMAT_TEXT, &text_size);
+    void *binary = bmfont_write_fnt(subset, BMFONT_FORMAT_BINARY, &binary_size);
+    if (!text || !binary) {
+        fprintf(stderr, "Failed to write subset: %s\n", bmfont_get_error_string());
+        exit(1);
+    }
+    bench_load("parse subset text", load_memory, text, text_size);
+    bench_load("parse subset bin", load_memory, binary, binary_size);
+
+    bmfont_free_blob(binary);
+    bmfont_free_blob(text);
+    bmfont_free(subset);
+    free(codepoints);
+}
+
+static void bench_font(uint32_t num_chars, uint32_t num_kernings) {
+    printf("%u chars, %u kernings\n", num_chars, num_kernings);
+
+    SyntheticFont source = generate_font(num_chars, num_kernings);
+    Buffer text = write_text(&source);
+    Buffer binary = write_binary(&source);
+
+    BMFont *font = bmfont_parse_memory(text.data, text.size);
+    if (!font) {
+        fprintf(stderr, "Failed to parse synthetic font: %s\n", bmfont_get_error_string());
+        exit(1);
+    }
+
+    size_t blob_size = 0;
+    void *blob = bmfont_write_blob(font, &blob_size);
+    if (!blob) {
+        fprintf(stderr, "Failed to write blob: %s\n", bmfont_get_error_string());
+        exit(1);
+    }
+
+    bench_load("parse text", load_memory, text.data, text.size);
+    bench_load("parse text lazy", load_lazy, text.data, text.size);
+    bench_load("parse text stream", load_stream, text.data, text.size);
+    bench_load("parse binary", load_memory, binary.data, binary.size);
+    bench_load("load blob", load_blob, blob, blob_size);
+    bench_lookups(font, &source);
+    bench_decode(font, &source);
+    bench_layout(font, &source);
+    bench_measure(font, &source);
+    bench_layout_cache(font);
+    bench_wrap(font);
+    bench_chain(&source);
+    bench_subset(font, &source);
+
+    bmfont_free_blob(blob);
+    bmfont_free(font);
+    free(binary.data);
+    free(text.data);
+    free(source.kernings);
+    free(source.chars);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        uint32_t num_chars = (uint32_t)strtoul(argv[1], nullptr, 10);
+        uint32_t num_kernings = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : 0;
+        if (num_chars == 0) {
+            // The text and kerning generators pick from the font's chars.
+            fprintf(stderr, "usage: %s num_chars [num_kernings], with num_chars > 0\n", argv[0]);
+            return 1;
+        }
+        bench_font(num_chars, num_kernings);
+    } else {
+        // A typical Latin UI font, and a large CJK font reaching into the supplementary planes.
+        bench_font(191, 1000);
+        bench_font(65000, 120000);
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Process peak RSS: %.1f MB\n", (double)usage.ru_maxrss / 1024.0);
+    return 0;
+}